@@ -23,6 +23,7 @@
 #endif
 
 #include "add-carddav-object.h"
+#include "carddav-stats.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -45,16 +46,16 @@ gboolean carddav_add(carddav_settings* settings, carddav_error* error) {
 	struct curl_slist *http_header = NULL;
 	gboolean result = FALSE;
 	gchar* url;
+	const gchar* body;
+	gsize body_len;
 
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&chunk);
+	init_memory_struct(&headers);
 
 	curl = get_curl(settings);
 	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
 		return TRUE;
@@ -65,50 +66,45 @@ gboolean carddav_add(carddav_settings* settings, carddav_error* error) {
 	http_header = curl_slist_append(http_header, "If-None-Match: *");
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
+	http_header = append_connection_header(http_header);
 	data.trace_ascii = settings->trace_ascii;
 
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,	WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	set_memory_callbacks(curl, settings, &chunk, &headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
 	if (settings->debug) {
 		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
 		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	gchar* tmp = random_file_name(settings->file);
-	gchar* s = rebuild_url(settings, NULL);
+	gchar* tmp = random_file_name(settings->arena,
+			settings->object, settings->object_len);
+	const gchar* s = rebuild_url(settings, NULL);
 	if (g_str_has_suffix(s, "/")) {
-		url = g_strdup_printf("%slibcarddav-%s.vcf", s, tmp);
+		url = arena_strdup_printf(settings->arena,
+				"%slibcarddav-%s.vcf", s, tmp);
 	}
 	else {
-		url = g_strdup_printf("%s/libcarddav-%s.vcf", s, tmp);
+		url = arena_strdup_printf(settings->arena,
+				"%s/libcarddav-%s.vcf", s, tmp);
 	}
-	g_free(s);
-	g_free(tmp);
 	curl_easy_setopt(curl, CURLOPT_URL, url);
-	tmp = g_strdup(settings->file);
-	g_free(settings->file);
-	settings->file = verify_uid(tmp);
-	g_free(tmp);
+	body_len = settings->object_len;
+	body = verify_uid(settings->arena, settings->object, &body_len);
+	if (!body)
+		body = settings->object;
 	/* enable uploading */
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->file);
-	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(settings->file));
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, (long) body_len);
+	set_request_method(curl, settings, CARDDAV_METHOD_PUT);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = perform_curl(curl, settings, &chunk, &headers);
+	if (res == CURLE_OK && !map_memory_struct(&chunk, error_buf))
+		res = CURLE_WRITE_ERROR;
 	if (res != 0) {
-		error->code = -1;
-		error->str = g_strdup_printf("%s", error_buf);
+		set_curl_error(error, CARDDAV_PHASE_WRITE, res, error_buf);
 		g_free(settings->file);
 		settings->file = NULL;
 		result = TRUE;
@@ -117,15 +113,12 @@ gboolean carddav_add(carddav_settings* settings, carddav_error* error) {
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 		if (code != 201) {
-			error->str = g_strdup(chunk.memory);
-			error->code = code;
+			set_http_error(error, CARDDAV_PHASE_WRITE, code, chunk.memory);
 			result = TRUE;
 		}
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_memory_struct(&chunk);
+	free_memory_struct(&headers);
 	curl_slist_free_all(http_header);
 	curl_easy_cleanup(curl);
 	return result;
@@ -0,0 +1,220 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include "carddav-alloc.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Number of CARDDAV_ACTION values */
+#define ALLOC_ACTIONS (OPTIONS + 1)
+
+/*
+ * What the operation running in a thread has allocated so far. Live
+ * sizes are signed: an operation may free memory an earlier one left
+ * behind, like an arena block returned by arena_reset().
+ */
+typedef struct {
+	guint depth;
+	gint64 live;
+	gint64 live_category[CARDDAV_MEM_CATEGORIES];
+	carddav_mem_stats stats;
+} alloc_op;
+
+static GPrivate alloc_op_key = G_PRIVATE_INIT(g_free);
+
+static GMutex alloc_lock;
+static carddav_mem_stats alloc_totals[ALLOC_ACTIONS];
+
+/**
+ * Start counting allocations of the calling thread. Calls nest; only the
+ * outermost operation is recorded.
+ */
+void alloc_begin(void) {
+	alloc_op* op = g_private_get(&alloc_op_key);
+
+	if (!op) {
+		op = g_new0(alloc_op, 1);
+		g_private_set(&alloc_op_key, op);
+	}
+	if (op->depth++ == 0) {
+		op->live = 0;
+		memset(op->live_category, 0, sizeof(op->live_category));
+		memset(&op->stats, 0, sizeof(op->stats));
+	}
+}
+
+/**
+ * Stop counting and add what was counted to the totals of an action.
+ * @param action The operation which ran. @see CARDDAV_ACTION
+ */
+void alloc_end(CARDDAV_ACTION action) {
+	alloc_op* op = g_private_get(&alloc_op_key);
+	carddav_mem_stats* total;
+	int i;
+
+	if (!op || op->depth == 0 || --op->depth > 0)
+		return;
+	if ((guint) action >= ALLOC_ACTIONS)
+		action = UNKNOWN;
+	g_mutex_lock(&alloc_lock);
+	total = &alloc_totals[action];
+	total->calls++;
+	for (i = 0; i < CARDDAV_MEM_CATEGORIES; i++) {
+		total->allocations[i] += op->stats.allocations[i];
+		total->bytes[i] += op->stats.bytes[i];
+		if (op->stats.category_peak[i] > total->category_peak[i])
+			total->category_peak[i] = op->stats.category_peak[i];
+	}
+	if (op->stats.peak > total->peak)
+		total->peak = op->stats.peak;
+	g_mutex_unlock(&alloc_lock);
+}
+
+/**
+ * Replace the counting state of the calling thread, for code which
+ * interleaves several operations on one thread.
+ * @param state State returned by an earlier call, or NULL for none
+ * @return The state which was replaced. Free it with g_free() when the
+ * operation it belongs to is over.
+ */
+gpointer alloc_switch(gpointer state) {
+	gpointer previous = g_private_get(&alloc_op_key);
+
+	g_private_set(&alloc_op_key, state);
+	return previous;
+}
+
+/**
+ * Count a change in the size of a block of memory allocated elsewhere,
+ * like the buffer of a GString.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param old_size Size before, 0 (zero) for a new block
+ * @param new_size Size after, 0 (zero) if the block was freed
+ */
+void alloc_account(CARDDAV_MEM category, gsize old_size, gsize new_size) {
+	alloc_op* op = g_private_get(&alloc_op_key);
+	gint64 delta = (gint64) new_size - (gint64) old_size;
+
+	if (!op || op->depth == 0 || delta == 0)
+		return;
+	if (delta > 0) {
+		op->stats.allocations[category]++;
+		op->stats.bytes[category] += (guint64) delta;
+	}
+	op->live += delta;
+	op->live_category[category] += delta;
+	if (op->live > 0 && (guint64) op->live > op->stats.peak)
+		op->stats.peak = (size_t) op->live;
+	if (op->live_category[category] > 0 &&
+			(guint64) op->live_category[category] >
+				op->stats.category_peak[category])
+		op->stats.category_peak[category] =
+			(size_t) op->live_category[category];
+}
+
+/**
+ * realloc() which counts the change in size.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param mem Memory from malloc() or alloc_realloc(), or NULL
+ * @param old_size Current size of mem
+ * @param size New size
+ * @return The new memory or NULL if out of memory, in which case mem
+ * is untouched
+ */
+gpointer alloc_realloc(CARDDAV_MEM category, gpointer mem,
+		gsize old_size, gsize size) {
+	/* There might be a realloc() out there that doesn't like reallocing
+	 * NULL pointers, so we take care of it here */
+	gpointer result = (mem) ? realloc(mem, size) : malloc(size);
+
+	if (result)
+		alloc_account(category, old_size, size);
+	return result;
+}
+
+/**
+ * free() which counts the freed size.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param mem Memory from alloc_realloc() or NULL
+ * @param size Size of mem
+ */
+void alloc_free(CARDDAV_MEM category, gpointer mem, gsize size) {
+	if (!mem)
+		return;
+	free(mem);
+	alloc_account(category, size, 0);
+}
+
+/**
+ * g_malloc() which counts the size.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param size Number of bytes
+ * @return The memory
+ */
+gpointer alloc_g_malloc(CARDDAV_MEM category, gsize size) {
+	gpointer mem = g_malloc(size);
+
+	alloc_account(category, 0, size);
+	return mem;
+}
+
+/**
+ * g_free() which counts the freed size.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param mem Memory from alloc_g_malloc() or NULL
+ * @param size Size of mem
+ */
+void alloc_g_free(CARDDAV_MEM category, gpointer mem, gsize size) {
+	if (!mem)
+		return;
+	g_free(mem);
+	alloc_account(category, size, 0);
+}
+
+/**
+ * Function for getting memory statistics of an operation type, counted
+ * since the process started or since carddav_reset_mem_stats().
+ * @param action The operation. @see CARDDAV_ACTION
+ * @param stats Filled with the statistics. @see carddav_mem_stats
+ */
+void carddav_get_mem_stats(CARDDAV_ACTION action, carddav_mem_stats* stats) {
+	g_return_if_fail(stats != NULL);
+
+	if ((guint) action >= ALLOC_ACTIONS) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	g_mutex_lock(&alloc_lock);
+	*stats = alloc_totals[action];
+	g_mutex_unlock(&alloc_lock);
+}
+
+/**
+ * Function for clearing the memory statistics of all operation types.
+ */
+void carddav_reset_mem_stats(void) {
+	g_mutex_lock(&alloc_lock);
+	memset(alloc_totals, 0, sizeof(alloc_totals));
+	g_mutex_unlock(&alloc_lock);
+}
@@ -0,0 +1,101 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_ALLOC_H__
+#define __CARDDAV_ALLOC_H__
+
+#include <glib.h>
+#include "carddav.h"
+
+/*
+ * Allocations of the buffers that grow with the size of a response go
+ * through these functions, which count them against the operation the
+ * calling thread is running. Memory allocated outside an operation is
+ * not counted. Counts are merged into per action totals when the
+ * operation ends. @see carddav_get_mem_stats()
+ */
+
+/**
+ * Start counting allocations of the calling thread. Calls nest; only the
+ * outermost operation is recorded.
+ */
+void alloc_begin(void);
+
+/**
+ * Stop counting and add what was counted to the totals of an action.
+ * @param action The operation which ran. @see CARDDAV_ACTION
+ */
+void alloc_end(CARDDAV_ACTION action);
+
+/**
+ * Replace the counting state of the calling thread, for code which
+ * interleaves several operations on one thread.
+ * @param state State returned by an earlier call, or NULL for none
+ * @return The state which was replaced. Free it with g_free() when the
+ * operation it belongs to is over.
+ */
+gpointer alloc_switch(gpointer state);
+
+/**
+ * Count a change in the size of a block of memory allocated elsewhere,
+ * like the buffer of a GString.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param old_size Size before, 0 (zero) for a new block
+ * @param new_size Size after, 0 (zero) if the block was freed
+ */
+void alloc_account(CARDDAV_MEM category, gsize old_size, gsize new_size);
+
+/**
+ * realloc() which counts the change in size.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param mem Memory from malloc() or alloc_realloc(), or NULL
+ * @param old_size Current size of mem
+ * @param size New size
+ * @return The new memory or NULL if out of memory, in which case mem
+ * is untouched
+ */
+gpointer alloc_realloc(CARDDAV_MEM category, gpointer mem,
+		gsize old_size, gsize size);
+
+/**
+ * free() which counts the freed size.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param mem Memory from alloc_realloc() or NULL
+ * @param size Size of mem
+ */
+void alloc_free(CARDDAV_MEM category, gpointer mem, gsize size);
+
+/**
+ * g_malloc() which counts the size.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param size Number of bytes
+ * @return The memory
+ */
+gpointer alloc_g_malloc(CARDDAV_MEM category, gsize size);
+
+/**
+ * g_free() which counts the freed size.
+ * @param category What the memory is used for. @see CARDDAV_MEM
+ * @param mem Memory from alloc_g_malloc() or NULL
+ * @param size Size of mem
+ */
+void alloc_g_free(CARDDAV_MEM category, gpointer mem, gsize size);
+
+#endif
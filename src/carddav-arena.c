@@ -0,0 +1,305 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include "carddav-arena.h"
+#include "carddav-alloc.h"
+#include <glib.h>
+#include <string.h>
+
+/* Size of an ordinary block including its header */
+#define ARENA_BLOCK_SIZE 4096
+
+/* Requests larger than this get a block of their own */
+#define ARENA_LARGE (ARENA_BLOCK_SIZE / 4)
+
+/* Bytes of blocks kept by arena_reset() */
+#define ARENA_RETAIN (16 * ARENA_BLOCK_SIZE)
+
+/* Arenas cached per thread, enough for nested operations */
+#define ARENA_CACHE 4
+
+#define ARENA_ALIGN (2 * sizeof(gpointer))
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(gsize) (ARENA_ALIGN - 1))
+
+typedef struct _arena_block arena_block;
+
+struct _arena_block {
+	arena_block* next;
+	gsize size;
+	gsize used;
+};
+
+#define ARENA_HEADER ARENA_ROUND(sizeof(arena_block))
+#define BLOCK_DATA(b) ((gchar*) (b) + ARENA_HEADER)
+
+/*
+ * The first of blocks is the one allocations are carved from. Blocks
+ * kept by arena_reset() wait in spare until they are needed again.
+ */
+struct _carddav_arena {
+	arena_block* blocks;
+	arena_block* spare;
+};
+
+typedef struct {
+	carddav_arena* free[ARENA_CACHE];
+	guint count;
+} arena_cache;
+
+static void free_arena_cache(gpointer data) {
+	arena_cache* cache = (arena_cache *) data;
+
+	while (cache->count > 0)
+		arena_free(cache->free[--cache->count]);
+	g_free(cache);
+}
+
+static GPrivate arena_cache_key = G_PRIVATE_INIT(free_arena_cache);
+
+static arena_block* new_block(gsize size) {
+	arena_block* block = alloc_g_malloc(CARDDAV_MEM_PARSE, ARENA_HEADER + size);
+
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+static void free_block(arena_block* block) {
+	alloc_g_free(CARDDAV_MEM_PARSE, block, ARENA_HEADER + block->size);
+}
+
+/**
+ * Take a spare block of at least size bytes or allocate a new one.
+ */
+static arena_block* take_block(carddav_arena* arena, gsize size) {
+	arena_block** link = &arena->spare;
+	arena_block* block;
+
+	while ((block = *link) != NULL) {
+		if (block->size >= size) {
+			*link = block->next;
+			block->next = NULL;
+			return block;
+		}
+		link = &block->next;
+	}
+	return new_block(size);
+}
+
+/**
+ * Create an empty arena.
+ * @return A new arena. Free with arena_free()
+ */
+carddav_arena* arena_new(void) {
+	carddav_arena* arena = g_new(carddav_arena, 1);
+
+	arena->blocks = new_block(ARENA_BLOCK_SIZE - ARENA_HEADER);
+	arena->spare = NULL;
+	return arena;
+}
+
+/**
+ * Free an arena and everything allocated from it.
+ * @param arena @see carddav_arena
+ */
+void arena_free(carddav_arena* arena) {
+	arena_block* block;
+
+	if (!arena)
+		return;
+	while ((block = arena->blocks) != NULL) {
+		arena->blocks = block->next;
+		free_block(block);
+	}
+	while ((block = arena->spare) != NULL) {
+		arena->spare = block->next;
+		free_block(block);
+	}
+	g_free(arena);
+}
+
+/**
+ * Release everything allocated from an arena. Blocks are kept for
+ * reuse up to a fixed limit.
+ * @param arena @see carddav_arena
+ */
+void arena_reset(carddav_arena* arena) {
+	arena_block* block;
+	arena_block* next;
+	gsize kept = 0;
+
+	for (block = arena->spare; block; block = block->next)
+		kept += block->size;
+	for (block = arena->blocks; block; block = next) {
+		next = block->next;
+		if (kept + block->size <= ARENA_RETAIN) {
+			kept += block->size;
+			block->used = 0;
+			block->next = arena->spare;
+			arena->spare = block;
+		}
+		else
+			free_block(block);
+	}
+	arena->blocks = take_block(arena, ARENA_BLOCK_SIZE - ARENA_HEADER);
+}
+
+/**
+ * Take an empty arena from the cache of the calling thread, or create
+ * one if the cache is empty.
+ * @return An arena. Give it back with arena_release()
+ */
+carddav_arena* arena_acquire(void) {
+	arena_cache* cache = g_private_get(&arena_cache_key);
+
+	if (cache && cache->count > 0)
+		return cache->free[--cache->count];
+	return arena_new();
+}
+
+/**
+ * Reset an arena and return it to the cache of the calling thread.
+ * @param arena An arena from arena_acquire() or NULL
+ */
+void arena_release(carddav_arena* arena) {
+	arena_cache* cache;
+
+	if (!arena)
+		return;
+	cache = g_private_get(&arena_cache_key);
+	if (!cache) {
+		cache = g_new0(arena_cache, 1);
+		g_private_set(&arena_cache_key, cache);
+	}
+	if (cache->count < ARENA_CACHE) {
+		arena_reset(arena);
+		cache->free[cache->count++] = arena;
+	}
+	else
+		arena_free(arena);
+}
+
+/**
+ * Allocate memory from an arena. The memory is suitably aligned for
+ * any type and is not initialized.
+ * @param arena @see carddav_arena
+ * @param size Number of bytes
+ * @return Memory valid until the arena is reset
+ */
+gpointer arena_alloc(carddav_arena* arena, gsize size) {
+	arena_block* block = arena->blocks;
+	arena_block* next;
+	gpointer mem;
+
+	size = ARENA_ROUND(size ? size : 1);
+	if (block->size - block->used < size) {
+		if (size > ARENA_LARGE) {
+			/* Keep carving from the current block */
+			next = take_block(arena, size);
+			next->used = size;
+			next->next = block->next;
+			block->next = next;
+			return BLOCK_DATA(next);
+		}
+		next = take_block(arena, ARENA_BLOCK_SIZE - ARENA_HEADER);
+		next->next = block;
+		arena->blocks = block = next;
+	}
+	mem = BLOCK_DATA(block) + block->used;
+	block->used += size;
+	return mem;
+}
+
+/**
+ * Copy a string into an arena.
+ * @param arena @see carddav_arena
+ * @param str String to copy or NULL
+ * @return The copy or NULL if str is NULL
+ */
+gchar* arena_strdup(carddav_arena* arena, const gchar* str) {
+	if (!str)
+		return NULL;
+	return arena_strndup(arena, str, strlen(str));
+}
+
+/**
+ * Copy the first len bytes of a string into an arena and terminate it.
+ * @param arena @see carddav_arena
+ * @param str String to copy
+ * @param len Number of bytes to copy
+ * @return The copy
+ */
+gchar* arena_strndup(carddav_arena* arena, const gchar* str, gsize len) {
+	gchar* copy = arena_alloc(arena, len + 1);
+
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+/**
+ * Format a string into an arena. @see g_strdup_vprintf()
+ * @param arena @see carddav_arena
+ * @param format printf style format
+ * @param args Arguments for format
+ * @return The formatted string
+ */
+gchar* arena_strdup_vprintf(carddav_arena* arena,
+		const gchar* format, va_list args) {
+	arena_block* block = arena->blocks;
+	gsize room = block->size - block->used;
+	gchar* str = BLOCK_DATA(block) + block->used;
+	va_list copy;
+	gint len;
+
+	/* Format straight into the free space, retry when it is too small */
+	G_VA_COPY(copy, args);
+	len = g_vsnprintf(str, room, format, copy);
+	va_end(copy);
+	if (len < 0)
+		return arena_strdup(arena, "");
+	if ((gsize) len < room) {
+		block->used += ARENA_ROUND(len + 1);
+		return str;
+	}
+	str = arena_alloc(arena, len + 1);
+	g_vsnprintf(str, len + 1, format, args);
+	return str;
+}
+
+/**
+ * Format a string into an arena. @see g_strdup_printf()
+ * @param arena @see carddav_arena
+ * @param format printf style format
+ * @return The formatted string
+ */
+gchar* arena_strdup_printf(carddav_arena* arena, const gchar* format, ...) {
+	va_list args;
+	gchar* str;
+
+	va_start(args, format);
+	str = arena_strdup_vprintf(arena, format, args);
+	va_end(args);
+	return str;
+}
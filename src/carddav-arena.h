@@ -0,0 +1,111 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_ARENA_H__
+#define __CARDDAV_ARENA_H__
+
+#include <glib.h>
+#include <stdarg.h>
+
+/**
+ * @typedef struct _carddav_arena carddav_arena
+ * Bump allocator for memory living no longer than one operation. Every
+ * allocation is released at once by arena_reset() or arena_release().
+ */
+typedef struct _carddav_arena carddav_arena;
+
+/**
+ * Create an empty arena.
+ * @return A new arena. Free with arena_free()
+ */
+carddav_arena* arena_new(void);
+
+/**
+ * Free an arena and everything allocated from it.
+ * @param arena @see carddav_arena
+ */
+void arena_free(carddav_arena* arena);
+
+/**
+ * Release everything allocated from an arena. Blocks are kept for
+ * reuse up to a fixed limit.
+ * @param arena @see carddav_arena
+ */
+void arena_reset(carddav_arena* arena);
+
+/**
+ * Take an empty arena from the cache of the calling thread, or create
+ * one if the cache is empty.
+ * @return An arena. Give it back with arena_release()
+ */
+carddav_arena* arena_acquire(void);
+
+/**
+ * Reset an arena and return it to the cache of the calling thread.
+ * @param arena An arena from arena_acquire() or NULL
+ */
+void arena_release(carddav_arena* arena);
+
+/**
+ * Allocate memory from an arena. The memory is suitably aligned for
+ * any type and is not initialized.
+ * @param arena @see carddav_arena
+ * @param size Number of bytes
+ * @return Memory valid until the arena is reset
+ */
+gpointer arena_alloc(carddav_arena* arena, gsize size);
+
+/**
+ * Copy a string into an arena.
+ * @param arena @see carddav_arena
+ * @param str String to copy or NULL
+ * @return The copy or NULL if str is NULL
+ */
+gchar* arena_strdup(carddav_arena* arena, const gchar* str);
+
+/**
+ * Copy the first len bytes of a string into an arena and terminate it.
+ * @param arena @see carddav_arena
+ * @param str String to copy
+ * @param len Number of bytes to copy
+ * @return The copy
+ */
+gchar* arena_strndup(carddav_arena* arena, const gchar* str, gsize len);
+
+/**
+ * Format a string into an arena. @see g_strdup_printf()
+ * @param arena @see carddav_arena
+ * @param format printf style format
+ * @return The formatted string
+ */
+gchar* arena_strdup_printf(carddav_arena* arena,
+		const gchar* format, ...) G_GNUC_PRINTF(2, 3);
+
+/**
+ * Format a string into an arena. @see g_strdup_vprintf()
+ * @param arena @see carddav_arena
+ * @param format printf style format
+ * @param args Arguments for format
+ * @return The formatted string
+ */
+gchar* arena_strdup_vprintf(carddav_arena* arena,
+		const gchar* format, va_list args);
+
+#endif
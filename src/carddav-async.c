@@ -0,0 +1,1105 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-async.h"
+#include "carddav-call.h"
+#include "carddav-alloc.h"
+#include "carddav-utils.h"
+#include <glib.h>
+#include <curl/curl.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+/* Smallest usable stack of an operation, libcurl needs some itself */
+#define ASYNC_STACK_MIN (CARDDAV_ENGINE_STACK_SIZE / 4)
+
+/* How often a parked operation looks again when its engine could not
+ * get a pipe for async_unpark() */
+#define ASYNC_PARK_POLL_US (10 * 1000)
+
+typedef struct _async_op async_op;
+
+struct _carddav_engine {
+	CURLM* multi;
+	carddav_socket_func socket_func;
+	carddav_timer_func timer_func;
+	void* user_data;
+	GDestroyNotify free_func;	/* releases user_data with the engine */
+	GQueue running;		/* operations which have not finished */
+	GQueue finished;	/* operations waiting for their callback */
+	GQueue sleeping;	/* operations in async_sleep(), soonest first */
+	guint transfers;	/* handles added to the multi handle */
+	gint64 deadline;	/* when libcurl wants its timer, -1 for never */
+	gboolean woken;		/* timer armed to deliver finished operations */
+	gboolean closing;
+	gsize stack_size;	/* usable stack of new operations */
+	/* async_unpark() may come from any thread */
+	GMutex wake_lock;	/* guards unparked, the parked flags and wake_signalled */
+	GQueue unparked;	/* parked operations to resume */
+	int wake_pipe[2];	/* tells the loop about unparked, -1 until needed */
+	gboolean wake_signalled;	/* a byte is waiting in wake_pipe */
+};
+
+struct _async_op {
+	carddav_engine* engine;
+	carddav_call call;
+	/* completion */
+	carddav_done_func done;
+	void* user_data;
+	CARDDAV_RESPONSE response;
+	gboolean finished;
+	/* execution */
+	ucontext_t context;
+	ucontext_t* caller;
+	guchar* stack;
+	gsize stack_size;
+	gpointer alloc_state;
+	CURL* curl;
+	CURLcode res;
+	gint64 wake_at;		/* while sleeping */
+	gboolean parked;	/* in async_park(), guarded by wake_lock */
+	gboolean unpark;	/* async_unpark() came, guarded by wake_lock */
+};
+
+/* The operation running on the calling thread, if any */
+static GPrivate async_current = G_PRIVATE_INIT(NULL);
+
+/**
+ * Check whether the calling code runs inside an asynchronous operation.
+ * @return TRUE if transfers are to go through async_perform()
+ */
+gboolean async_active(void) {
+	return g_private_get(&async_current) != NULL;
+}
+
+static void free_op(async_op* op) {
+	if (op->stack)
+		munmap(op->stack, op->stack_size);
+	g_free(op->alloc_state);
+	call_clear(&op->call);
+	g_free(op);
+}
+
+/**
+ * Arm the timer of the event loop at once, so finished operations get
+ * their callback from carddav_engine_socket_action() and never from the
+ * call which started them.
+ */
+static void wake_engine(carddav_engine* engine) {
+	if (engine->woken)
+		return;
+	engine->woken = TRUE;
+	if (engine->timer_func)
+		engine->timer_func(0, engine->user_data);
+}
+
+/**
+ * When the engine next has something to do without socket activity:
+ * the timer of libcurl or the first sleeping operation, -1 for never.
+ */
+static gint64 next_wakeup(carddav_engine* engine) {
+	async_op* sleeper = g_queue_peek_head(&engine->sleeping);
+
+	if (!sleeper)
+		return engine->deadline;
+	if (engine->deadline < 0)
+		return sleeper->wake_at;
+	return MIN(engine->deadline, sleeper->wake_at);
+}
+
+/**
+ * Arm the timer of the event loop for next_wakeup().
+ */
+static void set_timer(carddav_engine* engine) {
+	gint64 wakeup;
+	gint64 remaining;
+
+	if (!engine->timer_func)
+		return;
+	wakeup = next_wakeup(engine);
+	if (wakeup < 0) {
+		engine->timer_func(-1, engine->user_data);
+		return;
+	}
+	remaining = wakeup - g_get_monotonic_time();
+	engine->timer_func((remaining > 0) ? (long) ((remaining + 999) / 1000) : 0,
+			engine->user_data);
+}
+
+/**
+ * Give the timer back to libcurl and sleeping operations after
+ * wake_engine() took it over.
+ */
+static void restore_timer(carddav_engine* engine) {
+	engine->woken = FALSE;
+	set_timer(engine);
+}
+
+/**
+ * Switch to the stack of an operation until it waits for a transfer or
+ * finishes.
+ */
+static void resume_op(async_op* op) {
+	ucontext_t here;
+	gpointer outer = g_private_get(&async_current);
+	gpointer alloc_state = alloc_switch(op->alloc_state);
+
+	op->caller = &here;
+	g_private_set(&async_current, op);
+	swapcontext(&here, &op->context);
+	g_private_set(&async_current, outer);
+	op->alloc_state = alloc_switch(alloc_state);
+	if (op->finished) {
+		g_queue_remove(&op->engine->running, op);
+		g_queue_push_tail(&op->engine->finished, op);
+	}
+}
+
+/*
+ * Entry point of an operation's stack. makecontext() only passes int
+ * arguments, so the pointer arrives in two halves.
+ */
+static void async_main(unsigned int high, unsigned int low) {
+	async_op* op = (async_op *) (guintptr) (((guint64) high << 32) | low);
+
+	op->response = call_run(&op->call);
+	op->finished = TRUE;
+	setcontext(op->caller);
+}
+
+/**
+ * Run a transfer of the current asynchronous operation. Returns when the
+ * transfer is complete, with the operation's stack having been suspended
+ * in the meantime. Only call it when async_active() is TRUE.
+ * @param curl The prepared transfer
+ * @return Result of the transfer, as from curl_easy_perform()
+ */
+CURLcode async_perform(CURL* curl) {
+	async_op* op = g_private_get(&async_current);
+	carddav_engine* engine = op->engine;
+	CURLMcode code;
+
+	if (engine->closing)
+		return CURLE_ABORTED_BY_CALLBACK;
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, op);
+	code = curl_multi_add_handle(engine->multi, curl);
+	if (code != CURLM_OK)
+		return (code == CURLM_OUT_OF_MEMORY) ?
+			CURLE_OUT_OF_MEMORY : CURLE_FAILED_INIT;
+	op->curl = curl;
+	engine->transfers++;
+	swapcontext(&op->context, op->caller);
+	op->curl = NULL;
+	return op->res;
+}
+
+/**
+ * Add an operation to the sleepers, soonest first.
+ */
+static void add_sleeper(carddav_engine* engine, async_op* op, gint64 until) {
+	GList* next;
+
+	op->wake_at = until;
+	for (next = engine->sleeping.head;
+			next && ((async_op *) next->data)->wake_at <= until;
+			next = next->next)
+		;
+	if (next)
+		g_queue_insert_before(&engine->sleeping, next, op);
+	else
+		g_queue_push_tail(&engine->sleeping, op);
+	if (!engine->woken)
+		set_timer(engine);
+}
+
+/**
+ * Suspend the current asynchronous operation until a point in time,
+ * leaving its engine free to run other operations. Only call it when
+ * async_active() is TRUE.
+ * @param until Monotonic time in microseconds
+ * @return FALSE if the engine is being freed and the operation should
+ * give up
+ */
+gboolean async_sleep(gint64 until) {
+	async_op* op = g_private_get(&async_current);
+	carddav_engine* engine = op->engine;
+
+	if (engine->closing)
+		return FALSE;
+	add_sleeper(engine, op, until);
+	swapcontext(&op->context, op->caller);
+	return !engine->closing;
+}
+
+/**
+ * Create the pipe through which async_unpark() reaches the event loop.
+ * @return FALSE if there is no pipe
+ */
+static gboolean open_wake_pipe(carddav_engine* engine) {
+	int i;
+
+	if (engine->wake_pipe[0] >= 0)
+		return TRUE;
+	if (pipe(engine->wake_pipe) != 0) {
+		engine->wake_pipe[0] = engine->wake_pipe[1] = -1;
+		return FALSE;
+	}
+	for (i = 0; i < 2; i++) {
+		fcntl(engine->wake_pipe[i], F_SETFL,
+				fcntl(engine->wake_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(engine->wake_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	if (engine->socket_func)
+		engine->socket_func(engine->wake_pipe[0], CARDDAV_POLL_IN,
+				engine->user_data);
+	return TRUE;
+}
+
+/**
+ * Get the current asynchronous operation, to be handed to
+ * async_unpark(). Only call it when async_active() is TRUE.
+ * @return The operation
+ */
+gpointer async_self(void) {
+	return g_private_get(&async_current);
+}
+
+/**
+ * Suspend the current asynchronous operation until async_unpark() is
+ * called for it or a point in time, whichever comes first. It may also
+ * return early, so callers check what they wait for again. Only call it
+ * when async_active() is TRUE.
+ * @param until Monotonic time in microseconds, -1 for no limit
+ * @return FALSE if the engine is being freed and the operation should
+ * give up
+ */
+gboolean async_park(gint64 until) {
+	async_op* op = g_private_get(&async_current);
+	carddav_engine* engine = op->engine;
+
+	if (engine->closing)
+		return FALSE;
+	if (!open_wake_pipe(engine)) {
+		/* nothing can wake the loop, so look again soon */
+		gint64 soon = g_get_monotonic_time() + ASYNC_PARK_POLL_US;
+
+		until = (until < 0) ? soon : MIN(until, soon);
+	}
+	g_mutex_lock(&engine->wake_lock);
+	if (op->unpark) {
+		op->unpark = FALSE;
+		g_mutex_unlock(&engine->wake_lock);
+		return TRUE;
+	}
+	op->parked = TRUE;
+	g_mutex_unlock(&engine->wake_lock);
+	if (until >= 0)
+		add_sleeper(engine, op, until);
+	swapcontext(&op->context, op->caller);
+	g_mutex_lock(&engine->wake_lock);
+	op->parked = FALSE;
+	op->unpark = FALSE;
+	g_queue_remove(&engine->unparked, op);
+	g_mutex_unlock(&engine->wake_lock);
+	g_queue_remove(&engine->sleeping, op);
+	return !engine->closing;
+}
+
+/**
+ * End async_park() of an operation, or make its next one return at
+ * once. May be called from any thread, as long as the operation cannot
+ * finish meanwhile: the caller typically holds the lock under which the
+ * operation takes itself off a list of waiters.
+ * @param waiter @see async_self()
+ */
+void async_unpark(gpointer waiter) {
+	async_op* op = (async_op *) waiter;
+	carddav_engine* engine = op->engine;
+
+	g_mutex_lock(&engine->wake_lock);
+	if (op->parked && !op->unpark) {
+		g_queue_push_tail(&engine->unparked, op);
+		if (!engine->wake_signalled && engine->wake_pipe[1] >= 0) {
+			engine->wake_signalled = TRUE;
+			while (write(engine->wake_pipe[1], "", 1) < 0 && errno == EINTR)
+				;
+		}
+	}
+	op->unpark = TRUE;
+	g_mutex_unlock(&engine->wake_lock);
+}
+
+/**
+ * Resume the parked operations async_unpark() ended.
+ * @return TRUE if any was resumed
+ */
+static gboolean wake_parked(carddav_engine* engine) {
+	gboolean woke = FALSE;
+	async_op* op;
+
+	if (engine->wake_pipe[0] < 0)
+		return FALSE;
+	for (;;) {
+		char drain[64];
+
+		g_mutex_lock(&engine->wake_lock);
+		if (engine->wake_signalled) {
+			engine->wake_signalled = FALSE;
+			while (read(engine->wake_pipe[0], drain, sizeof(drain)) > 0)
+				;
+		}
+		op = g_queue_pop_head(&engine->unparked);
+		g_mutex_unlock(&engine->wake_lock);
+		if (!op)
+			return woke;
+		resume_op(op);
+		woke = TRUE;
+	}
+}
+
+/**
+ * Resume the sleeping operations whose time has come.
+ * @return TRUE if any was resumed
+ */
+static gboolean wake_sleepers(carddav_engine* engine) {
+	gint64 now = g_get_monotonic_time();
+	gboolean woke = FALSE;
+	async_op* op;
+
+	while ((op = g_queue_peek_head(&engine->sleeping)) && op->wake_at <= now) {
+		g_queue_pop_head(&engine->sleeping);
+		resume_op(op);
+		woke = TRUE;
+	}
+	return woke;
+}
+
+/**
+ * Resume the operations whose transfers libcurl reports as done.
+ */
+static void check_transfers(carddav_engine* engine) {
+	CURLMsg* msg;
+	int pending;
+
+	while ((msg = curl_multi_info_read(engine->multi, &pending))) {
+		CURL* curl;
+		CURLcode res;
+		char* op;
+
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+		/* msg is gone once the handle is removed */
+		curl = msg->easy_handle;
+		res = msg->data.result;
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, &op);
+		curl_multi_remove_handle(engine->multi, curl);
+		engine->transfers--;
+		((async_op *) op)->res = res;
+		resume_op((async_op *) op);
+	}
+}
+
+/**
+ * Invoke the callbacks of finished operations. A callback may start
+ * operations which finish at once; they are delivered in the same pass.
+ */
+static void finish_operations(carddav_engine* engine) {
+	async_op* op;
+
+	while ((op = g_queue_pop_head(&engine->finished))) {
+		if (op->done)
+			op->done(op->response, op->user_data);
+		free_op(op);
+	}
+}
+
+static int socket_callback(CURL* curl G_GNUC_UNUSED, curl_socket_t fd,
+		int what, void* data, void* socket_data G_GNUC_UNUSED) {
+	carddav_engine* engine = (carddav_engine *) data;
+	CARDDAV_POLL poll;
+
+	switch (what) {
+		case CURL_POLL_IN: poll = CARDDAV_POLL_IN; break;
+		case CURL_POLL_OUT: poll = CARDDAV_POLL_OUT; break;
+		case CURL_POLL_INOUT: poll = CARDDAV_POLL_INOUT; break;
+		case CURL_POLL_REMOVE: poll = CARDDAV_POLL_REMOVE; break;
+		default: return 0;
+	}
+	if (engine->socket_func)
+		engine->socket_func((int) fd, poll, engine->user_data);
+	return 0;
+}
+
+static int timer_callback(CURLM* multi G_GNUC_UNUSED, long timeout_ms,
+		void* data) {
+	carddav_engine* engine = (carddav_engine *) data;
+
+	engine->deadline = (timeout_ms < 0) ?
+		-1 : g_get_monotonic_time() + (gint64) timeout_ms * 1000;
+	if (!engine->woken)
+		set_timer(engine);
+	return 0;
+}
+
+/**
+ * Function for creating an engine.
+ * @param socket_func Called when sockets are to be watched or released.
+ * @see carddav_socket_func
+ * @param timer_func Called when the timer is to be changed.
+ * @see carddav_timer_func
+ * @param user_data Passed unchanged to socket_func and timer_func
+ * @return A new engine or NULL if libcurl could not be initialized. Free
+ * it with carddav_engine_free().
+ */
+carddav_engine* carddav_engine_new(carddav_socket_func socket_func,
+				carddav_timer_func timer_func,
+				void* user_data) {
+	carddav_engine* engine;
+	CURLM* multi;
+
+	if (!init_libcurl())
+		return NULL;
+	multi = curl_multi_init();
+	if (!multi)
+		return NULL;
+	engine = g_new0(carddav_engine, 1);
+	engine->multi = multi;
+	engine->socket_func = socket_func;
+	engine->timer_func = timer_func;
+	engine->user_data = user_data;
+	engine->deadline = -1;
+	engine->stack_size = CARDDAV_ENGINE_STACK_SIZE;
+	g_queue_init(&engine->running);
+	g_queue_init(&engine->finished);
+	g_queue_init(&engine->sleeping);
+	g_mutex_init(&engine->wake_lock);
+	g_queue_init(&engine->unparked);
+	engine->wake_pipe[0] = engine->wake_pipe[1] = -1;
+	curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+	curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, engine);
+	curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+	curl_multi_setopt(multi, CURLMOPT_TIMERDATA, engine);
+	return engine;
+}
+
+/**
+ * Release the user data of an engine when the engine is freed, after
+ * the last socket and timer callback.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param free_func Called with the user data given to the engine
+ */
+void async_set_free_func(carddav_engine* engine, GDestroyNotify free_func) {
+	engine->free_func = free_func;
+}
+
+/**
+ * Function for freeing an engine. Operations still running are aborted
+ * and their callbacks invoked with CANCELLED before this function returns.
+ * @param engine Address to a pointer to an engine
+ */
+void carddav_engine_free(carddav_engine** engine) {
+	carddav_engine* e;
+	async_op* op;
+
+	g_return_if_fail(engine != NULL);
+
+	e = *engine;
+	if (!e)
+		return;
+	/* Once closing, transfers fail at once, so each operation runs to
+	 * its end when resumed */
+	e->closing = TRUE;
+	while ((op = g_queue_peek_head(&e->running))) {
+		if (op->curl) {
+			curl_multi_remove_handle(e->multi, op->curl);
+			e->transfers--;
+			op->res = CURLE_ABORTED_BY_CALLBACK;
+		} else {
+			g_queue_remove(&e->sleeping, op);
+		}
+		resume_op(op);
+	}
+	finish_operations(e);
+	curl_multi_cleanup(e->multi);
+	if (e->wake_pipe[0] >= 0) {
+		if (e->socket_func)
+			e->socket_func(e->wake_pipe[0], CARDDAV_POLL_REMOVE,
+					e->user_data);
+		close(e->wake_pipe[0]);
+		close(e->wake_pipe[1]);
+	}
+	g_mutex_clear(&e->wake_lock);
+	if (e->free_func)
+		e->free_func(e->user_data);
+	g_free(e);
+	*engine = NULL;
+}
+
+/**
+ * Function reporting socket activity or an expired timer to an engine.
+ * Operations advance and completion callbacks are invoked from here.
+ * Must not be called from a callback of the library.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param fd The active socket or CARDDAV_SOCKET_TIMEOUT
+ * @param events CARDDAV_POLL_IN, CARDDAV_POLL_OUT and CARDDAV_POLL_ERR
+ * or'ed together, 0 (zero) for a timeout
+ */
+void carddav_engine_socket_action(carddav_engine* engine, int fd, int events) {
+	int mask = 0;
+	int running;
+	gboolean woke;
+
+	g_return_if_fail(engine != NULL);
+
+	if (events & CARDDAV_POLL_IN)
+		mask |= CURL_CSELECT_IN;
+	if (events & CARDDAV_POLL_OUT)
+		mask |= CURL_CSELECT_OUT;
+	if (events & CARDDAV_POLL_ERR)
+		mask |= CURL_CSELECT_ERR;
+	/* the wake pipe belongs to the engine, libcurl does not know it */
+	if (fd == CARDDAV_SOCKET_TIMEOUT || fd != engine->wake_pipe[0])
+		curl_multi_socket_action(engine->multi,
+				(fd == CARDDAV_SOCKET_TIMEOUT) ? CURL_SOCKET_TIMEOUT : fd,
+				mask, &running);
+	if (fd == CARDDAV_SOCKET_TIMEOUT) {
+		long timeout_ms;
+
+		/* libcurl only reports a timer when it changes, so a deadline
+		 * which has passed would otherwise keep the timer at zero */
+		if (curl_multi_timeout(engine->multi, &timeout_ms) == CURLM_OK)
+			engine->deadline = (timeout_ms < 0) ?
+				-1 : g_get_monotonic_time() + (gint64) timeout_ms * 1000;
+	}
+	check_transfers(engine);
+	woke = wake_sleepers(engine);
+	if (wake_parked(engine))
+		woke = TRUE;
+	finish_operations(engine);
+	/* the timer may have fired for a sleeping operation, which libcurl
+	 * does not know about, so it is armed again for the next one */
+	if (engine->woken || woke || (fd == CARDDAV_SOCKET_TIMEOUT &&
+				!g_queue_is_empty(&engine->sleeping)))
+		restore_timer(engine);
+}
+
+/**
+ * Drive an engine which has no event loop: wait for its sockets or its
+ * timer, at most timeout_ms, then advance transfers and invoke the
+ * callbacks of finished operations.
+ * @param engine An engine created without callbacks
+ * @param timeout_ms Longest wait in milliseconds
+ */
+void async_engine_wait(carddav_engine* engine, long timeout_ms) {
+	struct curl_waitfd wake;
+	int running;
+	int fds;
+
+	if (engine->woken) {
+		timeout_ms = 0;
+	} else if (!g_queue_is_empty(&engine->sleeping)) {
+		gint64 remaining = ((async_op *)
+				g_queue_peek_head(&engine->sleeping))->wake_at -
+			g_get_monotonic_time();
+
+		timeout_ms = MIN(timeout_ms, MAX(remaining + 999, 0) / 1000);
+	}
+	/* without transfers or the wake pipe curl_multi_wait() returns at
+	 * once, which would spin while operations only sleep */
+	if (engine->wake_pipe[0] >= 0) {
+		wake.fd = engine->wake_pipe[0];
+		wake.events = CURL_WAIT_POLLIN;
+		wake.revents = 0;
+		curl_multi_wait(engine->multi, &wake, 1,
+				(int) MIN(timeout_ms, G_MAXINT), &fds);
+	} else if (engine->transfers > 0)
+		curl_multi_wait(engine->multi, NULL, 0,
+				(int) MIN(timeout_ms, G_MAXINT), &fds);
+	else if (timeout_ms > 0)
+		g_usleep((gulong) MIN(timeout_ms,
+					(long) (G_MAXULONG / 1000)) * 1000);
+	curl_multi_perform(engine->multi, &running);
+	check_transfers(engine);
+	wake_sleepers(engine);
+	wake_parked(engine);
+	finish_operations(engine);
+	engine->woken = FALSE;
+}
+
+/**
+ * Function for getting the number of operations which have not invoked
+ * their callback yet.
+ * @param engine An engine. @see carddav_engine_new()
+ * @return Number of unfinished operations
+ */
+int carddav_engine_running(carddav_engine* engine) {
+	g_return_val_if_fail(engine != NULL, 0);
+
+	return (int) (g_queue_get_length(&engine->running) +
+			g_queue_get_length(&engine->finished));
+}
+
+/**
+ * Function for changing the stack size of operations started on an
+ * engine from now on. Raise it when the callbacks of an operation need
+ * much stack. @see carddav_engine
+ * @param engine An engine. @see carddav_engine_new()
+ * @param size Usable stack in bytes. Rounded up to whole pages and to at
+ * least CARDDAV_ENGINE_STACK_SIZE / 4
+ */
+void carddav_engine_set_stack_size(carddav_engine* engine, size_t size) {
+	gsize page = (gsize) sysconf(_SC_PAGESIZE);
+
+	g_return_if_fail(engine != NULL);
+	g_return_if_fail(size <= G_MAXSIZE - page);
+
+	size = MAX(size, ASYNC_STACK_MIN);
+	engine->stack_size = (size + page - 1) / page * page;
+}
+
+static async_op* new_op(carddav_engine* engine, call_kind kind,
+		const char* URL, runtime_info* info,
+		carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(engine != NULL, NULL);
+	g_return_val_if_fail(info != NULL, NULL);
+
+	op = g_new0(async_op, 1);
+	op->engine = engine;
+	call_init(&op->call, kind, URL, info);
+	op->done = done;
+	op->user_data = user_data;
+	return op;
+}
+
+/**
+ * Give an operation its stack and run it until it waits for its first
+ * transfer.
+ * @return 0 (zero) if started, -1 otherwise
+ */
+static int start_op(async_op* op) {
+	carddav_engine* engine = op->engine;
+	gsize page = (gsize) sysconf(_SC_PAGESIZE);
+	guint64 p = (guint64) (guintptr) op;
+
+	if (engine->closing) {
+		free_op(op);
+		return -1;
+	}
+	/* A guard page is added below the usable stack */
+	op->stack_size = engine->stack_size + page;
+	op->stack = mmap(NULL, op->stack_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (op->stack == MAP_FAILED) {
+		op->stack = NULL;
+		free_op(op);
+		return -1;
+	}
+	/* The stack grows down into the guard page on overflow */
+	mprotect(op->stack, page, PROT_NONE);
+	if (getcontext(&op->context) != 0) {
+		free_op(op);
+		return -1;
+	}
+	op->context.uc_stack.ss_sp = op->stack + page;
+	op->context.uc_stack.ss_size = engine->stack_size;
+	op->context.uc_link = NULL;
+	makecontext(&op->context, (void (*)(void)) async_main, 2,
+			(unsigned int) (p >> 32), (unsigned int) p);
+	g_queue_push_tail(&engine->running, op);
+	resume_op(op);
+	if (op->finished)
+		wake_engine(engine);
+	return 0;
+}
+
+/**
+ * Start carddav_add_object_len() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_add_object_async(carddav_engine* engine,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(object != NULL || len == 0, -1);
+
+	op = new_op(engine, CALL_ADD, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	call_set_object(&op->call, object, len);
+	return start_op(op);
+}
+
+/**
+ * Start carddav_delete_object_len() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_delete_object_async(carddav_engine* engine,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(object != NULL || len == 0, -1);
+
+	op = new_op(engine, CALL_DELETE, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	call_set_object(&op->call, object, len);
+	return start_op(op);
+}
+
+/**
+ * Start carddav_delete_object_by_uri() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_delete_object_by_uri_async(carddav_engine* engine,
+				const char* object,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(object != NULL, -1);
+
+	op = new_op(engine, CALL_DELETE_BY_URI, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	call_set_object(&op->call, object, strlen(object));
+	return start_op(op);
+}
+
+/**
+ * Start carddav_modify_object_len() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_modify_object_async(carddav_engine* engine,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(object != NULL || len == 0, -1);
+
+	op = new_op(engine, CALL_MODIFY, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	call_set_object(&op->call, object, len);
+	return start_op(op);
+}
+
+/**
+ * Start carddav_modify_object_by_uri() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_modify_object_by_uri_async(carddav_engine* engine,
+				const char* object,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(object != NULL, -1);
+
+	op = new_op(engine, CALL_MODIFY_BY_URI, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	call_set_object(&op->call, object, strlen(object));
+	return start_op(op);
+}
+
+/**
+ * Start carddav_get_object() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param result Receives the cards. @see response
+ * @param start Start of the range
+ * @param end End of the range
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_get_object_async(carddav_engine* engine, response* result,
+				time_t start, time_t end,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(result != NULL, -1);
+
+	op = new_op(engine, CALL_GET, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	op->call.result = result;
+	op->call.start = start;
+	op->call.end = end;
+	return start_op(op);
+}
+
+/**
+ * Start carddav_getall_object() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_object_async(carddav_engine* engine, response* result,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(result != NULL, -1);
+
+	op = new_op(engine, CALL_GETALL, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	op->call.result = result;
+	return start_op(op);
+}
+
+/**
+ * Start carddav_getall_object_by_uri() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_object_by_uri_async(carddav_engine* engine,
+				response* result,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(result != NULL, -1);
+
+	op = new_op(engine, CALL_GETALL_BY_URI, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	op->call.result = result;
+	return start_op(op);
+}
+
+/**
+ * Start carddav_getall_foreach() on an engine. The callback is invoked
+ * from carddav_engine_socket_action() as cards arrive.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param callback_data Passed unchanged to callback
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_foreach_async(carddav_engine* engine,
+				const char* URL,
+				carddav_card_func callback, void* callback_data,
+				runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(callback != NULL, -1);
+
+	op = new_op(engine, CALL_FOREACH, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	op->call.card_func = callback;
+	op->call.func_data = callback_data;
+	return start_op(op);
+}
+
+/**
+ * Start carddav_getall_write() on an engine. The writer is invoked
+ * from carddav_engine_socket_action() as cards arrive.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param writer Function receiving the output. @see carddav_write_func
+ * @param writer_data Passed unchanged to writer
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_write_async(carddav_engine* engine,
+				const char* URL,
+				carddav_write_func writer, void* writer_data,
+				runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(writer != NULL, -1);
+
+	op = new_op(engine, CALL_WRITE, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	op->call.write_func = writer;
+	op->call.func_data = writer_data;
+	return start_op(op);
+}
+
+/**
+ * Start carddav_getall_snapshot() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param path File the snapshot is written to
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_snapshot_async(carddav_engine* engine,
+				const char* URL, const char* path,
+				runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(path != NULL, -1);
+
+	op = new_op(engine, CALL_SNAPSHOT, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	op->call.path = g_strdup(path);
+	return start_op(op);
+}
+
+/**
+ * Start carddav_get_displayname() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param result Receives the display name. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_get_displayname_async(carddav_engine* engine, response* result,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(result != NULL, -1);
+
+	op = new_op(engine, CALL_DISPLAYNAME, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	op->call.result = result;
+	return start_op(op);
+}
+
+/**
+ * Start carddav_enabled_resource() on an engine. done receives OK if the
+ * resource is CardDAV enabled and NOTIMPLEMENTED otherwise.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_enabled_resource_async(carddav_engine* engine,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	op = new_op(engine, CALL_ENABLED, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	return start_op(op);
+}
+
+/**
+ * Start carddav_get_server_options() on an engine. done receives OK if
+ * options were stored and CONFLICT otherwise.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param options Set to the list of options, or NULL, before done is
+ * invoked. Caller frees it like the result of carddav_get_server_options()
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_get_server_options_async(carddav_engine* engine,
+				const char* URL, char*** options,
+				runtime_info* info,
+				carddav_done_func done, void* user_data) {
+	async_op* op;
+
+	g_return_val_if_fail(options != NULL, -1);
+
+	op = new_op(engine, CALL_OPTIONS, URL, info, done, user_data);
+	if (!op)
+		return -1;
+	op->call.options = options;
+	*options = NULL;
+	return start_op(op);
+}
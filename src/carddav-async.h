@@ -0,0 +1,106 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_ASYNC_H__
+#define __CARDDAV_ASYNC_H__
+
+#include <glib.h>
+#include <curl/curl.h>
+#include "carddav.h"
+
+/*
+ * An asynchronous operation runs the code of its blocking variant on a
+ * stack of its own. Whenever that code performs a transfer, the transfer
+ * is handed to the engine's multi handle and the operation's stack is
+ * suspended until the engine sees the transfer complete. The event loop
+ * therefore never blocks, and every operation, however many requests it
+ * makes, is written once.
+ */
+
+/**
+ * Check whether the calling code runs inside an asynchronous operation.
+ * @return TRUE if transfers are to go through async_perform()
+ */
+gboolean async_active(void);
+
+/**
+ * Run a transfer of the current asynchronous operation. Returns when the
+ * transfer is complete, with the operation's stack having been suspended
+ * in the meantime. Only call it when async_active() is TRUE.
+ * @param curl The prepared transfer
+ * @return Result of the transfer, as from curl_easy_perform()
+ */
+CURLcode async_perform(CURL* curl);
+
+/**
+ * Suspend the current asynchronous operation until a point in time,
+ * leaving its engine free to run other operations. Only call it when
+ * async_active() is TRUE.
+ * @param until Monotonic time in microseconds
+ * @return FALSE if the engine is being freed and the operation should
+ * give up
+ */
+gboolean async_sleep(gint64 until);
+
+/**
+ * Get the current asynchronous operation, to be handed to
+ * async_unpark(). Only call it when async_active() is TRUE.
+ * @return The operation
+ */
+gpointer async_self(void);
+
+/**
+ * Suspend the current asynchronous operation until async_unpark() is
+ * called for it or a point in time, whichever comes first. It may also
+ * return early, so callers check what they wait for again. Only call it
+ * when async_active() is TRUE.
+ * @param until Monotonic time in microseconds, -1 for no limit
+ * @return FALSE if the engine is being freed and the operation should
+ * give up
+ */
+gboolean async_park(gint64 until);
+
+/**
+ * End async_park() of an operation, or make its next one return at
+ * once. May be called from any thread, as long as the operation cannot
+ * finish meanwhile: the caller typically holds the lock under which the
+ * operation takes itself off a list of waiters.
+ * @param waiter @see async_self()
+ */
+void async_unpark(gpointer waiter);
+
+/**
+ * Release the user data of an engine when the engine is freed, after
+ * the last socket and timer callback.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param free_func Called with the user data given to the engine
+ */
+void async_set_free_func(carddav_engine* engine, GDestroyNotify free_func);
+
+/**
+ * Drive an engine which has no event loop: wait for its sockets or its
+ * timer, at most timeout_ms, then advance transfers and invoke the
+ * callbacks of finished operations.
+ * @param engine An engine created without callbacks
+ * @param timeout_ms Longest wait in milliseconds
+ */
+void async_engine_wait(carddav_engine* engine, long timeout_ms);
+
+#endif
@@ -0,0 +1,397 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav.h"
+#include "carddav-async.h"
+#include <glib.h>
+
+typedef struct {
+	carddav_batch* batch;
+	int index;
+	CARDDAV_RESPONSE response;
+	gboolean done;
+} batch_item;
+
+struct _carddav_batch {
+	carddav_engine* engine;
+	GPtrArray* items;
+	GQueue completed;	/* indexes not yet returned by wait_any */
+};
+
+static void item_done(CARDDAV_RESPONSE response, void* data) {
+	batch_item* item = data;
+
+	item->response = response;
+	item->done = TRUE;
+	g_queue_push_tail(&item->batch->completed, GINT_TO_POINTER(item->index));
+}
+
+static batch_item* new_item(carddav_batch* batch) {
+	batch_item* item = g_new0(batch_item, 1);
+
+	item->batch = batch;
+	item->index = (int) batch->items->len;
+	g_ptr_array_add(batch->items, item);
+	return item;
+}
+
+/**
+ * Keep an item if its operation started.
+ * @return The index of the item or -1
+ */
+static int started(carddav_batch* batch, batch_item* item, int res) {
+	if (res == 0)
+		return item->index;
+	/* frees the item */
+	g_ptr_array_remove_index(batch->items, item->index);
+	return -1;
+}
+
+/**
+ * Milliseconds left until a deadline.
+ * @param deadline Monotonic time or -1 for none
+ */
+static long remaining_ms(gint64 deadline) {
+	gint64 remaining;
+
+	if (deadline < 0)
+		return G_MAXINT;
+	remaining = deadline - g_get_monotonic_time();
+	return (remaining > 0) ? (long) ((remaining + 999) / 1000) : 0;
+}
+
+/**
+ * Function for creating a batch. Operations added to it run at the same
+ * time on its own engine, which only advances while the batch is waited
+ * on. A batch must only be used from the thread which created it.
+ * @return A new batch or NULL if libcurl could not be initialized. Free
+ * it with carddav_batch_free().
+ */
+carddav_batch* carddav_batch_new(void) {
+	carddav_batch* batch;
+	carddav_engine* engine;
+
+	engine = carddav_engine_new(NULL, NULL, NULL);
+	if (!engine)
+		return NULL;
+	batch = g_new0(carddav_batch, 1);
+	batch->engine = engine;
+	batch->items = g_ptr_array_new_with_free_func(g_free);
+	g_queue_init(&batch->completed);
+	return batch;
+}
+
+/**
+ * Function for freeing a batch. Operations still running are aborted and
+ * finish with CANCELLED.
+ * @param batch Address to a pointer to a batch
+ */
+void carddav_batch_free(carddav_batch** batch) {
+	carddav_batch* b;
+
+	g_return_if_fail(batch != NULL);
+
+	b = *batch;
+	if (!b)
+		return;
+	carddav_engine_free(&b->engine);
+	g_queue_clear(&b->completed);
+	g_ptr_array_free(b->items, TRUE);
+	g_free(b);
+	*batch = NULL;
+}
+
+/**
+ * Add carddav_add_object_len() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_add_object(carddav_batch* batch,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_add_object_async(batch->engine,
+				object, len, URL, info, item_done, item));
+}
+
+/**
+ * Add carddav_delete_object_len() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_delete_object(carddav_batch* batch,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_delete_object_async(batch->engine,
+				object, len, URL, info, item_done, item));
+}
+
+/**
+ * Add carddav_delete_object_by_uri() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_delete_object_by_uri(carddav_batch* batch,
+				const char* object,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_delete_object_by_uri_async(
+				batch->engine, object, URL, info, item_done, item));
+}
+
+/**
+ * Add carddav_modify_object_len() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_modify_object(carddav_batch* batch,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_modify_object_async(batch->engine,
+				object, len, URL, info, item_done, item));
+}
+
+/**
+ * Add carddav_modify_object_by_uri() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_modify_object_by_uri(carddav_batch* batch,
+				const char* object,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_modify_object_by_uri_async(
+				batch->engine, object, URL, info, item_done, item));
+}
+
+/**
+ * Add carddav_get_object() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param result Receives the cards. @see response
+ * @param start Start of the range
+ * @param end End of the range
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_get_object(carddav_batch* batch, response* result,
+				time_t start, time_t end,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_get_object_async(batch->engine,
+				result, start, end, URL, info, item_done, item));
+}
+
+/**
+ * Add carddav_getall_object() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_getall_object(carddav_batch* batch, response* result,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_getall_object_async(batch->engine,
+				result, URL, info, item_done, item));
+}
+
+/**
+ * Add carddav_getall_object_by_uri() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_getall_object_by_uri(carddav_batch* batch,
+				response* result,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_getall_object_by_uri_async(
+				batch->engine, result, URL, info, item_done, item));
+}
+
+/**
+ * Add carddav_get_displayname() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param result Receives the display name. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_get_displayname(carddav_batch* batch, response* result,
+				const char* URL, runtime_info* info) {
+	batch_item* item;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	item = new_item(batch);
+	return started(batch, item, carddav_get_displayname_async(batch->engine,
+				result, URL, info, item_done, item));
+}
+
+/**
+ * Function waiting until an item of a batch finishes. Each finished item
+ * is returned once, in the order the items finished, so new items can
+ * be added as others complete.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param timeout_ms Longest wait in milliseconds, -1 for no limit, 0 (zero)
+ * to advance the items without blocking
+ * @return Index of a finished item, or -1 if the time ran out or every
+ * item has been returned already
+ */
+int carddav_batch_wait_any(carddav_batch* batch, long timeout_ms) {
+	gint64 deadline;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	deadline = (timeout_ms < 0) ?
+		-1 : g_get_monotonic_time() + (gint64) timeout_ms * 1000;
+	/* the engine advances at least once, so a zero timeout polls */
+	do {
+		if (!g_queue_is_empty(&batch->completed))
+			return GPOINTER_TO_INT(g_queue_pop_head(&batch->completed));
+		if (carddav_engine_running(batch->engine) == 0)
+			return -1;
+		async_engine_wait(batch->engine, remaining_ms(deadline));
+	} while (deadline < 0 || remaining_ms(deadline) > 0);
+	if (!g_queue_is_empty(&batch->completed))
+		return GPOINTER_TO_INT(g_queue_pop_head(&batch->completed));
+	return -1;
+}
+
+/**
+ * Function waiting until every item of a batch has finished.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param timeout_ms Longest wait in milliseconds, -1 for no limit, 0 (zero)
+ * to advance the items without blocking
+ * @return 0 (zero) if all items finished, -1 if the time ran out
+ */
+int carddav_batch_wait_all(carddav_batch* batch, long timeout_ms) {
+	gint64 deadline;
+
+	g_return_val_if_fail(batch != NULL, -1);
+
+	deadline = (timeout_ms < 0) ?
+		-1 : g_get_monotonic_time() + (gint64) timeout_ms * 1000;
+	/* the engine advances at least once, so a zero timeout polls */
+	do {
+		if (carddav_engine_running(batch->engine) == 0)
+			return 0;
+		async_engine_wait(batch->engine, remaining_ms(deadline));
+	} while (deadline < 0 || remaining_ms(deadline) > 0);
+	return (carddav_engine_running(batch->engine) == 0) ? 0 : -1;
+}
+
+/**
+ * Function for getting the result of an item.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param item Index returned when the item was added
+ * @param result Set to what the blocking variant of the operation
+ * returned, if the item has finished. @see CARDDAV_RESPONSE
+ * @return 1 if the item has finished, 0 (zero) otherwise
+ */
+int carddav_batch_result(carddav_batch* batch, int item,
+				CARDDAV_RESPONSE* result) {
+	batch_item* i;
+
+	g_return_val_if_fail(batch != NULL, 0);
+	g_return_val_if_fail(item >= 0 && (guint) item < batch->items->len, 0);
+
+	i = g_ptr_array_index(batch->items, item);
+	if (!i->done)
+		return 0;
+	if (result)
+		*result = i->response;
+	return 1;
+}
+
+/**
+ * Function for getting the number of items of a batch which have not
+ * finished.
+ * @param batch A batch. @see carddav_batch_new()
+ * @return Number of unfinished items
+ */
+int carddav_batch_running(carddav_batch* batch) {
+	g_return_val_if_fail(batch != NULL, 0);
+
+	return carddav_engine_running(batch->engine);
+}
@@ -0,0 +1,125 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-call.h"
+#include "carddav-cancel.h"
+#include <glib.h>
+#include <string.h>
+
+/**
+ * Prepare a call. Arguments beyond the URL are set by the caller.
+ * @param call @see carddav_call
+ * @param kind The operation. @see call_kind
+ * @param URL Copied
+ * @param info Used by the call, not copied
+ */
+void call_init(carddav_call* call, call_kind kind,
+		const char* URL, runtime_info* info) {
+	memset(call, 0, sizeof(*call));
+	call->kind = kind;
+	call->url = g_strdup(URL);
+	call->info = info;
+}
+
+/**
+ * Set the card of a call.
+ * @param call @see carddav_call
+ * @param object The card, need not be NUL terminated. Copied
+ * @param len Length of object
+ */
+void call_set_object(carddav_call* call, const char* object, gsize len) {
+	call->object = g_malloc(len + 1);
+	if (len)
+		memcpy(call->object, object, len);
+	call->object[len] = '\0';
+	call->object_len = len;
+}
+
+/**
+ * Run the blocking function of a call.
+ * @param call @see carddav_call
+ * @return What the function returned, mapped to a CARDDAV_RESPONSE.
+ * CALL_ENABLED gives OK or NOTIMPLEMENTED, CALL_OPTIONS gives OK or
+ * CONFLICT, unless a transfer timed out or was cancelled.
+ */
+CARDDAV_RESPONSE call_run(carddav_call* call) {
+	switch (call->kind) {
+		case CALL_ADD:
+			return carddav_add_object_len(call->object, call->object_len,
+					call->url, call->info);
+		case CALL_DELETE:
+			return carddav_delete_object_len(call->object, call->object_len,
+					call->url, call->info);
+		case CALL_DELETE_BY_URI:
+			return carddav_delete_object_by_uri(call->object,
+					call->url, call->info);
+		case CALL_MODIFY:
+			return carddav_modify_object_len(call->object, call->object_len,
+					call->url, call->info);
+		case CALL_MODIFY_BY_URI:
+			return carddav_modify_object_by_uri(call->object,
+					call->url, call->info);
+		case CALL_GET:
+			return carddav_get_object(call->result, call->start, call->end,
+					call->url, call->info);
+		case CALL_GETALL:
+			return carddav_getall_object(call->result, call->url, call->info);
+		case CALL_GETALL_BY_URI:
+			return carddav_getall_object_by_uri(call->result,
+					call->url, call->info);
+		case CALL_FOREACH:
+			return carddav_getall_foreach(call->url,
+					call->card_func, call->func_data, call->info);
+		case CALL_WRITE:
+			return carddav_getall_write(call->url,
+					call->write_func, call->func_data, call->info);
+		case CALL_SNAPSHOT:
+			return carddav_getall_snapshot(call->url, call->path, call->info);
+		case CALL_DISPLAYNAME:
+			return carddav_get_displayname(call->result, call->url, call->info);
+		case CALL_ENABLED:
+			if (carddav_enabled_resource(call->url, call->info))
+				return OK;
+			if (call->info->error->curl_code != CURLE_OK)
+				return transfer_failure_response(call->info->error);
+			return NOTIMPLEMENTED;
+		case CALL_OPTIONS:
+			*call->options = carddav_get_server_options(call->url, call->info);
+			if (*call->options)
+				return OK;
+			return transfer_failure_response(call->info->error);
+	}
+	return CONFLICT;
+}
+
+/**
+ * Free the strings of a call.
+ * @param call @see carddav_call
+ */
+void call_clear(carddav_call* call) {
+	g_free(call->object);
+	g_free(call->url);
+	g_free(call->path);
+	call->object = call->url = call->path = NULL;
+}
@@ -0,0 +1,107 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_CALL_H__
+#define __CARDDAV_CALL_H__
+
+#include <glib.h>
+#include "carddav.h"
+
+/*
+ * A call of a blocking operation captured with its arguments, so it can
+ * be run later, on another stack or on another thread.
+ */
+
+/**
+ * @enum call_kind
+ * Which blocking function a call runs
+ */
+typedef enum {
+	CALL_ADD,
+	CALL_DELETE,
+	CALL_DELETE_BY_URI,
+	CALL_MODIFY,
+	CALL_MODIFY_BY_URI,
+	CALL_GET,
+	CALL_GETALL,
+	CALL_GETALL_BY_URI,
+	CALL_FOREACH,
+	CALL_WRITE,
+	CALL_SNAPSHOT,
+	CALL_DISPLAYNAME,
+	CALL_ENABLED,
+	CALL_OPTIONS
+} call_kind;
+
+/**
+ * @typedef struct carddav_call
+ * Arguments of a call. Strings are owned by the call, everything else
+ * by the caller. Fields a kind does not use are ignored.
+ */
+typedef struct {
+	call_kind kind;
+	gchar* object;
+	gsize object_len;
+	gchar* url;
+	gchar* path;
+	time_t start;
+	time_t end;
+	response* result;
+	char*** options;
+	carddav_card_func card_func;
+	carddav_write_func write_func;
+	void* func_data;
+	runtime_info* info;
+} carddav_call;
+
+/**
+ * Prepare a call. Arguments beyond the URL are set by the caller.
+ * @param call @see carddav_call
+ * @param kind The operation. @see call_kind
+ * @param URL Copied
+ * @param info Used by the call, not copied
+ */
+void call_init(carddav_call* call, call_kind kind,
+		const char* URL, runtime_info* info);
+
+/**
+ * Set the card of a call.
+ * @param call @see carddav_call
+ * @param object The card, need not be NUL terminated. Copied
+ * @param len Length of object
+ */
+void call_set_object(carddav_call* call, const char* object, gsize len);
+
+/**
+ * Run the blocking function of a call.
+ * @param call @see carddav_call
+ * @return What the function returned, mapped to a CARDDAV_RESPONSE.
+ * CALL_ENABLED gives OK or NOTIMPLEMENTED, CALL_OPTIONS gives OK or
+ * CONFLICT, unless a transfer timed out or was cancelled.
+ */
+CARDDAV_RESPONSE call_run(carddav_call* call);
+
+/**
+ * Free the strings of a call.
+ * @param call @see carddav_call
+ */
+void call_clear(carddav_call* call);
+
+#endif
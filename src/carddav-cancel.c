@@ -0,0 +1,149 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-cancel.h"
+#include <glib.h>
+#include <curl/curl.h>
+
+struct _carddav_cancel {
+	gint requested;
+};
+
+/**
+ * Function for creating a cancellation token.
+ * @return A new token which has not been triggered. Free it with
+ * carddav_cancel_free().
+ */
+carddav_cancel* carddav_cancel_new(void) {
+	return g_new0(carddav_cancel, 1);
+}
+
+/**
+ * Function for freeing a cancellation token. No operation may use it
+ * any longer.
+ * @param cancel Address to a pointer to a token
+ */
+void carddav_cancel_free(carddav_cancel** cancel) {
+	g_return_if_fail(cancel != NULL);
+
+	g_free(*cancel);
+	*cancel = NULL;
+}
+
+/**
+ * Function for cancelling every operation using a token. May be called
+ * from any thread, including from a callback of the library.
+ * @param cancel A token. @see carddav_cancel_new()
+ */
+void carddav_cancel_trigger(carddav_cancel* cancel) {
+	g_return_if_fail(cancel != NULL);
+
+	g_atomic_int_set(&cancel->requested, 1);
+}
+
+/**
+ * Function for checking whether a token was triggered.
+ * @param cancel A token. @see carddav_cancel_new()
+ * @return 1 if triggered, 0 (zero) otherwise
+ */
+int carddav_cancel_requested(carddav_cancel* cancel) {
+	g_return_val_if_fail(cancel != NULL, 0);
+
+	return g_atomic_int_get(&cancel->requested);
+}
+
+/**
+ * Function for making a triggered token usable again. Must not be
+ * called while an operation uses it.
+ * @param cancel A token. @see carddav_cancel_new()
+ */
+void carddav_cancel_reset(carddav_cancel* cancel) {
+	g_return_if_fail(cancel != NULL);
+
+	g_atomic_int_set(&cancel->requested, 0);
+}
+
+/**
+ * Turn the time out of an operation into a deadline when it starts.
+ * @param timeout_ms Milliseconds for the whole operation, 0 (zero) or
+ * less for none
+ * @return Monotonic time in microseconds, 0 (zero) for none
+ */
+gint64 operation_deadline(long timeout_ms) {
+	if (timeout_ms <= 0)
+		return 0;
+	return g_get_monotonic_time() + (gint64) timeout_ms * 1000;
+}
+
+/*
+ * libcurl calls this while a transfer is under way, and at least once a
+ * second while it waits for the server. Non-zero aborts the transfer
+ * with CURLE_ABORTED_BY_CALLBACK.
+ */
+static int xferinfo_callback(void* data,
+		curl_off_t dltotal G_GNUC_UNUSED, curl_off_t dlnow G_GNUC_UNUSED,
+		curl_off_t ultotal G_GNUC_UNUSED, curl_off_t ulnow G_GNUC_UNUSED) {
+	return g_atomic_int_get(&((carddav_cancel *) data)->requested);
+}
+
+/**
+ * Bound a transfer by what remains of its operation's deadline and let
+ * a cancellation token abort it. Called before every request, so the
+ * requests of an operation share one deadline between them.
+ * @param curl The prepared transfer
+ * @param deadline @see operation_deadline()
+ * @param cancel Token or NULL. @see carddav_cancel
+ */
+void limit_transfer(CURL* curl, gint64 deadline, carddav_cancel* cancel) {
+	if (deadline > 0) {
+		gint64 remaining = (deadline - g_get_monotonic_time()) / 1000;
+
+		/* 0 would disable the time out, so an expired deadline still
+		 * fails the request at once */
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,
+				(long) MAX(remaining, 1));
+	}
+	if (cancel) {
+		curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo_callback);
+		curl_easy_setopt(curl, CURLOPT_XFERINFODATA, cancel);
+		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	}
+}
+
+/**
+ * Result of an operation which failed without an HTTP status.
+ * @param error The recorded error. @see carddav_error
+ * @return TIMEOUT, CANCELLED or CONFLICT
+ */
+CARDDAV_RESPONSE transfer_failure_response(const carddav_error* error) {
+	switch (error->curl_code) {
+		case CURLE_OPERATION_TIMEDOUT:
+			return TIMEOUT;
+		case CURLE_ABORTED_BY_CALLBACK:
+			return CANCELLED;
+		default:
+			/* fall-back to conflicting state */
+			return CONFLICT;
+	}
+}
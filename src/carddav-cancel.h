@@ -0,0 +1,53 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_CANCEL_H__
+#define __CARDDAV_CANCEL_H__
+
+#include <glib.h>
+#include <curl/curl.h>
+#include "carddav.h"
+
+/**
+ * Turn the time out of an operation into a deadline when it starts.
+ * @param timeout_ms Milliseconds for the whole operation, 0 (zero) or
+ * less for none
+ * @return Monotonic time in microseconds, 0 (zero) for none
+ */
+gint64 operation_deadline(long timeout_ms);
+
+/**
+ * Bound a transfer by what remains of its operation's deadline and let
+ * a cancellation token abort it. Called before every request, so the
+ * requests of an operation share one deadline between them.
+ * @param curl The prepared transfer
+ * @param deadline @see operation_deadline()
+ * @param cancel Token or NULL. @see carddav_cancel
+ */
+void limit_transfer(CURL* curl, gint64 deadline, carddav_cancel* cancel);
+
+/**
+ * Result of an operation which failed without an HTTP status.
+ * @param error The recorded error. @see carddav_error
+ * @return TIMEOUT, CANCELLED or CONFLICT
+ */
+CARDDAV_RESPONSE transfer_failure_response(const carddav_error* error);
+
+#endif
@@ -0,0 +1,606 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav.h"
+#include "carddav-call.h"
+#include "carddav-utils.h"
+#include <glib.h>
+#include <string.h>
+
+/* Tasks queued per worker when the caller does not choose */
+#define EXECUTOR_QUEUE_PER_THREAD 4
+
+struct _carddav_task {
+	carddav_call call;
+	CARDDAV_RESPONSE response;
+	gboolean done;
+	gint refs;		/* the caller's and the queue's */
+	GMutex lock;
+	GCond cond;
+};
+
+struct _carddav_executor {
+	GMutex lock;
+	GCond not_empty;
+	GCond not_full;
+	carddav_task** queue;	/* ring of size entries */
+	guint size;
+	guint head;
+	guint count;
+	gboolean closing;
+	guint submitters;	/* threads inside submit_task() */
+	GCond idle;		/* signalled when the last submitter leaves */
+	GThread** workers;
+	guint threads;
+};
+
+static void unref_task(carddav_task* task) {
+	if (!g_atomic_int_dec_and_test(&task->refs))
+		return;
+	call_clear(&task->call);
+	g_mutex_clear(&task->lock);
+	g_cond_clear(&task->cond);
+	g_free(task);
+}
+
+/**
+ * Take the next task, waiting for one. Tasks queued before the executor
+ * started closing are still handed out.
+ * @return A task or NULL when the worker is to exit
+ */
+static carddav_task* pop_task(carddav_executor* executor) {
+	carddav_task* task = NULL;
+
+	g_mutex_lock(&executor->lock);
+	while (executor->count == 0 && !executor->closing)
+		g_cond_wait(&executor->not_empty, &executor->lock);
+	if (executor->count > 0) {
+		task = executor->queue[executor->head];
+		executor->head = (executor->head + 1) % executor->size;
+		executor->count--;
+		g_cond_signal(&executor->not_full);
+	}
+	g_mutex_unlock(&executor->lock);
+	return task;
+}
+
+/**
+ * Body of a worker thread. The thread keeps its connections in a
+ * session, so consecutive tasks skip connection and TLS setup.
+ */
+static gpointer worker_main(gpointer data) {
+	carddav_executor* executor = data;
+	carddav_task* task;
+
+	session_begin();
+	while ((task = pop_task(executor))) {
+		CARDDAV_RESPONSE response = call_run(&task->call);
+
+		g_mutex_lock(&task->lock);
+		task->response = response;
+		task->done = TRUE;
+		g_cond_broadcast(&task->cond);
+		g_mutex_unlock(&task->lock);
+		unref_task(task);
+	}
+	session_end();
+	return NULL;
+}
+
+/**
+ * Function for creating a pool of worker threads running operations.
+ * Each worker keeps its own connections alive between operations.
+ * @param threads Number of workers, 0 (zero) or less for one per
+ * processor
+ * @param queue_size Operations which may wait for a worker before
+ * submitting blocks, 0 (zero) or less for four per worker
+ * @return A new executor or NULL if no worker could be started. Free it
+ * with carddav_executor_free().
+ */
+carddav_executor* carddav_executor_new(int threads, int queue_size) {
+	carddav_executor* executor;
+	guint i;
+
+	if (!init_libcurl())
+		return NULL;
+	if (threads <= 0)
+		threads = (int) g_get_num_processors();
+	if (queue_size <= 0)
+		queue_size = threads * EXECUTOR_QUEUE_PER_THREAD;
+	executor = g_new0(carddav_executor, 1);
+	g_mutex_init(&executor->lock);
+	g_cond_init(&executor->not_empty);
+	g_cond_init(&executor->not_full);
+	g_cond_init(&executor->idle);
+	executor->size = (guint) queue_size;
+	executor->queue = g_new0(carddav_task*, executor->size);
+	executor->workers = g_new0(GThread*, threads);
+	for (i = 0; i < (guint) threads; i++) {
+		executor->workers[i] = g_thread_try_new("carddav-worker",
+				worker_main, executor, NULL);
+		if (!executor->workers[i])
+			break;
+		executor->threads++;
+	}
+	if (executor->threads == 0)
+		carddav_executor_free(&executor);
+	return executor;
+}
+
+/**
+ * Function for freeing an executor. Operations already submitted run to
+ * their end, then the workers exit. Submissions waiting for room in the
+ * queue return NULL, and this function waits until they have left.
+ * Starting a submission once this has been called is undefined, as the
+ * executor may already be gone. Must not be called from a worker.
+ * @param executor Address to a pointer to an executor
+ */
+void carddav_executor_free(carddav_executor** executor) {
+	carddav_executor* e;
+	guint i;
+
+	g_return_if_fail(executor != NULL);
+
+	e = *executor;
+	if (!e)
+		return;
+	g_mutex_lock(&e->lock);
+	e->closing = TRUE;
+	g_cond_broadcast(&e->not_empty);
+	g_cond_broadcast(&e->not_full);
+	/* woken submitters still need the lock to see closing */
+	while (e->submitters > 0)
+		g_cond_wait(&e->idle, &e->lock);
+	g_mutex_unlock(&e->lock);
+	for (i = 0; i < e->threads; i++)
+		g_thread_join(e->workers[i]);
+	g_free(e->workers);
+	g_free(e->queue);
+	g_mutex_clear(&e->lock);
+	g_cond_clear(&e->not_empty);
+	g_cond_clear(&e->not_full);
+	g_cond_clear(&e->idle);
+	g_free(e);
+	*executor = NULL;
+}
+
+static carddav_task* new_task(carddav_executor* executor, call_kind kind,
+		const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(executor != NULL, NULL);
+	g_return_val_if_fail(info != NULL, NULL);
+
+	task = g_new0(carddav_task, 1);
+	call_init(&task->call, kind, URL, info);
+	task->refs = 2;
+	g_mutex_init(&task->lock);
+	g_cond_init(&task->cond);
+	return task;
+}
+
+/**
+ * Queue a task, waiting while the queue is full.
+ * @return The task or NULL if the executor is closing
+ */
+static carddav_task* submit_task(carddav_executor* executor,
+		carddav_task* task) {
+	gboolean queued = FALSE;
+
+	g_mutex_lock(&executor->lock);
+	executor->submitters++;
+	while (executor->count == executor->size && !executor->closing)
+		g_cond_wait(&executor->not_full, &executor->lock);
+	if (!executor->closing) {
+		executor->queue[(executor->head + executor->count) %
+			executor->size] = task;
+		executor->count++;
+		g_cond_signal(&executor->not_empty);
+		queued = TRUE;
+	}
+	/* the executor may be freed as soon as the lock is released */
+	if (--executor->submitters == 0 && executor->closing)
+		g_cond_signal(&executor->idle);
+	g_mutex_unlock(&executor->lock);
+	if (!queued) {
+		unref_task(task);
+		unref_task(task);
+		return NULL;
+	}
+	return task;
+}
+
+/**
+ * Submit carddav_add_object_len() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_add_object_submit(carddav_executor* executor,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(object != NULL || len == 0, NULL);
+
+	task = new_task(executor, CALL_ADD, URL, info);
+	if (!task)
+		return NULL;
+	call_set_object(&task->call, object, len);
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_delete_object_len() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_delete_object_submit(carddav_executor* executor,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(object != NULL || len == 0, NULL);
+
+	task = new_task(executor, CALL_DELETE, URL, info);
+	if (!task)
+		return NULL;
+	call_set_object(&task->call, object, len);
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_delete_object_by_uri() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_delete_object_by_uri_submit(carddav_executor* executor,
+				const char* object,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(object != NULL, NULL);
+
+	task = new_task(executor, CALL_DELETE_BY_URI, URL, info);
+	if (!task)
+		return NULL;
+	call_set_object(&task->call, object, strlen(object));
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_modify_object_len() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_modify_object_submit(carddav_executor* executor,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(object != NULL || len == 0, NULL);
+
+	task = new_task(executor, CALL_MODIFY, URL, info);
+	if (!task)
+		return NULL;
+	call_set_object(&task->call, object, len);
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_modify_object_by_uri() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_modify_object_by_uri_submit(carddav_executor* executor,
+				const char* object,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(object != NULL, NULL);
+
+	task = new_task(executor, CALL_MODIFY_BY_URI, URL, info);
+	if (!task)
+		return NULL;
+	call_set_object(&task->call, object, strlen(object));
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_get_object() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param result Receives the cards. @see response
+ * @param start Start of the range
+ * @param end End of the range
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_get_object_submit(carddav_executor* executor,
+				response* result, time_t start, time_t end,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(result != NULL, NULL);
+
+	task = new_task(executor, CALL_GET, URL, info);
+	if (!task)
+		return NULL;
+	task->call.result = result;
+	task->call.start = start;
+	task->call.end = end;
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_getall_object() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_object_submit(carddav_executor* executor,
+				response* result,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(result != NULL, NULL);
+
+	task = new_task(executor, CALL_GETALL, URL, info);
+	if (!task)
+		return NULL;
+	task->call.result = result;
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_getall_object_by_uri() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_object_by_uri_submit(carddav_executor* executor,
+				response* result,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(result != NULL, NULL);
+
+	task = new_task(executor, CALL_GETALL_BY_URI, URL, info);
+	if (!task)
+		return NULL;
+	task->call.result = result;
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_getall_foreach() to an executor. The callback is
+ * invoked from a worker thread.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param callback_data Passed unchanged to callback
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_foreach_submit(carddav_executor* executor,
+				const char* URL,
+				carddav_card_func callback, void* callback_data,
+				runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(callback != NULL, NULL);
+
+	task = new_task(executor, CALL_FOREACH, URL, info);
+	if (!task)
+		return NULL;
+	task->call.card_func = callback;
+	task->call.func_data = callback_data;
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_getall_write() to an executor. The writer is invoked
+ * from a worker thread.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param writer Function receiving the output. @see carddav_write_func
+ * @param writer_data Passed unchanged to writer
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_write_submit(carddav_executor* executor,
+				const char* URL,
+				carddav_write_func writer, void* writer_data,
+				runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(writer != NULL, NULL);
+
+	task = new_task(executor, CALL_WRITE, URL, info);
+	if (!task)
+		return NULL;
+	task->call.write_func = writer;
+	task->call.func_data = writer_data;
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_getall_snapshot() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param path File the snapshot is written to
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_snapshot_submit(carddav_executor* executor,
+				const char* URL, const char* path,
+				runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(path != NULL, NULL);
+
+	task = new_task(executor, CALL_SNAPSHOT, URL, info);
+	if (!task)
+		return NULL;
+	task->call.path = g_strdup(path);
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_get_displayname() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param result Receives the display name. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_get_displayname_submit(carddav_executor* executor,
+				response* result,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(result != NULL, NULL);
+
+	task = new_task(executor, CALL_DISPLAYNAME, URL, info);
+	if (!task)
+		return NULL;
+	task->call.result = result;
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_enabled_resource() to an executor. The task yields OK
+ * if the resource is CardDAV enabled and NOTIMPLEMENTED otherwise.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_enabled_resource_submit(carddav_executor* executor,
+				const char* URL, runtime_info* info) {
+	carddav_task* task;
+
+	task = new_task(executor, CALL_ENABLED, URL, info);
+	if (!task)
+		return NULL;
+	return submit_task(executor, task);
+}
+
+/**
+ * Submit carddav_get_server_options() to an executor. The task yields OK
+ * if options were stored and CONFLICT otherwise.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param options Set to the list of options, or NULL, before the task
+ * is done. Caller frees it like the result of carddav_get_server_options()
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_get_server_options_submit(carddav_executor* executor,
+				const char* URL, char*** options,
+				runtime_info* info) {
+	carddav_task* task;
+
+	g_return_val_if_fail(options != NULL, NULL);
+
+	task = new_task(executor, CALL_OPTIONS, URL, info);
+	if (!task)
+		return NULL;
+	task->call.options = options;
+	return submit_task(executor, task);
+}
+
+/**
+ * Function waiting for a task to finish.
+ * @param task A task. @see carddav_executor_new()
+ * @return What the blocking variant of the operation returned.
+ * @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_task_wait(carddav_task* task) {
+	CARDDAV_RESPONSE response;
+
+	g_return_val_if_fail(task != NULL, CONFLICT);
+
+	g_mutex_lock(&task->lock);
+	while (!task->done)
+		g_cond_wait(&task->cond, &task->lock);
+	response = task->response;
+	g_mutex_unlock(&task->lock);
+	return response;
+}
+
+/**
+ * Function checking whether a task has finished, without waiting.
+ * @param task A task. @see carddav_executor_new()
+ * @return 1 if finished, 0 (zero) otherwise
+ */
+int carddav_task_done(carddav_task* task) {
+	int done;
+
+	g_return_val_if_fail(task != NULL, 0);
+
+	g_mutex_lock(&task->lock);
+	done = task->done;
+	g_mutex_unlock(&task->lock);
+	return done;
+}
+
+/**
+ * Function for freeing a task. Waits for the task to finish first, since
+ * it still uses the arguments it was submitted with.
+ * @param task Address to a pointer to a task
+ */
+void carddav_task_free(carddav_task** task) {
+	g_return_if_fail(task != NULL);
+
+	if (!*task)
+		return;
+	carddav_task_wait(*task);
+	unref_task(*task);
+	*task = NULL;
+}
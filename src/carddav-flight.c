@@ -0,0 +1,234 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-flight.h"
+#include "carddav-async.h"
+#include "carddav-stats.h"
+#include <glib.h>
+#include <curl/curl.h>
+#include <string.h>
+
+/* How often an operation waiting for a flight checks its cancellation
+ * token. The landing itself wakes it. */
+#define FLIGHT_CANCEL_POLL_US (50 * 1000)
+
+typedef struct {
+	gchar* key;
+	guint waiting;		/* operations which will share the outcome */
+	GSList* parked;		/* asynchronous ones in async_park() */
+	gboolean landed;
+	gboolean failed;
+	shared_text* text;	/* held by the flight until it is freed */
+	carddav_error error;
+} flight;
+
+/* Flights in the air by key, and the condition their landings signal */
+static GMutex flights_lock;
+static GCond flights_landed;
+static GHashTable* flights = NULL;
+
+/**
+ * Name a read so identical ones can find each other. The key holds a
+ * digest of the URL and credentials, never the credentials themselves.
+ * @param settings The operation's settings
+ * @param what Kind of read
+ * @return The key. Caller must g_free it.
+ */
+gchar* flight_key(carddav_settings* settings, const gchar* what) {
+	const gchar* fields[] = {
+		settings->url, settings->username, settings->password,
+		settings->custom_cacert
+	};
+	GString* identity = g_string_new(NULL);
+	gchar* digest;
+	gchar* key;
+	guint i;
+
+	g_string_append_printf(identity, "%s %d %lu",
+			settings->usehttps ? "https" : "http",
+			settings->verify_ssl_certificate ? 1 : 0,
+			(unsigned long) settings->max_response_size);
+	/* length prefixed, so no two sets of fields give the same key */
+	for (i = 0; i < G_N_ELEMENTS(fields); i++) {
+		const gchar* field = fields[i] ? fields[i] : "";
+
+		g_string_append_printf(identity, " %lu:%s",
+				(unsigned long) strlen(field), field);
+	}
+	/* flights sit in a process-wide table, so the password is hashed
+	 * and wiped rather than kept there */
+	digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+			(const guchar *) identity->str, identity->len);
+	memset(identity->str, 0, identity->len);
+	g_string_free(identity, TRUE);
+	key = g_strconcat(what, " ", digest, NULL);
+	g_free(digest);
+	return key;
+}
+
+/**
+ * Whether the outcome of a leader is its own business: it ran out of
+ * time or was cancelled.
+ */
+static gboolean outcome_is_private(flight* f) {
+	return f->failed && f->error.code <= 0 &&
+		(f->error.curl_code == CURLE_OPERATION_TIMEDOUT ||
+		 f->error.curl_code == CURLE_ABORTED_BY_CALLBACK);
+}
+
+static void free_flight(flight* f) {
+	g_free(f->key);
+	if (f->text)
+		shared_text_unref(f->text);
+	clear_carddav_error(&f->error);
+	g_free(f);
+}
+
+/**
+ * Wait for a flight to land. Called with the lock held.
+ * @return CURLE_OK or why the operation gave up
+ */
+static CURLcode await_landing(flight* f, carddav_settings* settings) {
+	gboolean async = async_active();
+
+	while (!f->landed) {
+		gint64 now = g_get_monotonic_time();
+		gint64 wake = -1;
+
+		if (settings->cancel && carddav_cancel_requested(settings->cancel))
+			return CURLE_ABORTED_BY_CALLBACK;
+		if (settings->deadline > 0 && now >= settings->deadline)
+			return CURLE_OPERATION_TIMEDOUT;
+		if (settings->cancel)
+			wake = now + FLIGHT_CANCEL_POLL_US;
+		if (settings->deadline > 0)
+			wake = (wake < 0) ? settings->deadline :
+				MIN(wake, settings->deadline);
+		if (async) {
+			gpointer self = async_self();
+			gboolean alive;
+
+			f->parked = g_slist_prepend(f->parked, self);
+			g_mutex_unlock(&flights_lock);
+			alive = async_park(wake);
+			g_mutex_lock(&flights_lock);
+			f->parked = g_slist_remove(f->parked, self);
+			if (!alive)
+				return CURLE_ABORTED_BY_CALLBACK;
+		} else if (wake < 0) {
+			g_cond_wait(&flights_landed, &flights_lock);
+		} else {
+			g_cond_wait_until(&flights_landed, &flights_lock, wake);
+		}
+	}
+	return CURLE_OK;
+}
+
+/**
+ * Run a read, or wait for an identical one in flight and share its
+ * outcome. Outcomes of leaders which ran out of time or were cancelled
+ * are not shared; a waiting operation then runs the read itself.
+ * @param key @see flight_key()
+ * @param settings The operation's settings, for its deadline,
+ * cancellation token and counters
+ * @param func The read. @see flight_func
+ * @param data Passed unchanged to func
+ * @param text Set to the text of the read, or NULL. Caller must free it
+ * with release_text().
+ * @param owner Set to the shared text holding text when other operations
+ * share it, NULL otherwise. A shared text must not be changed.
+ * @param error Receives the reason of a failure
+ * @return Result of func
+ */
+gboolean flight_run(const gchar* key, carddav_settings* settings,
+		flight_func func, gpointer data, gchar** text, shared_text** owner,
+		carddav_error* error) {
+	gboolean failed;
+	GSList* waiter;
+	flight* f;
+
+	*text = NULL;
+	*owner = NULL;
+	g_mutex_lock(&flights_lock);
+	if (!flights)
+		flights = g_hash_table_new(g_str_hash, g_str_equal);
+	while ((f = g_hash_table_lookup(flights, key)) != NULL) {
+		CURLcode res;
+
+		f->waiting++;
+		res = await_landing(f, settings);
+		f->waiting--;
+		if (res != CURLE_OK) {
+			if (f->landed && f->waiting == 0)
+				free_flight(f);
+			g_mutex_unlock(&flights_lock);
+			set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0, res,
+					curl_easy_strerror(res));
+			return TRUE;
+		}
+		if (!outcome_is_private(f)) {
+			failed = f->failed;
+			copy_carddav_error(error, &f->error);
+			if (f->text) {
+				*owner = shared_text_ref(f->text);
+				*text = f->text->text;
+			}
+			if (f->waiting == 0)
+				free_flight(f);
+			g_mutex_unlock(&flights_lock);
+			stats_coalesced(settings);
+			return failed;
+		}
+		if (f->waiting == 0)
+			free_flight(f);
+		/* the read is run again, by this operation or another one */
+	}
+	f = g_new0(flight, 1);
+	f->key = g_strdup(key);
+	g_hash_table_insert(flights, f->key, f);
+	g_mutex_unlock(&flights_lock);
+
+	failed = func(data, text, error);
+
+	g_mutex_lock(&flights_lock);
+	g_hash_table_remove(flights, f->key);
+	if (f->waiting == 0) {
+		g_mutex_unlock(&flights_lock);
+		free_flight(f);
+		return failed;
+	}
+	f->landed = TRUE;
+	f->failed = failed;
+	/* the leader and every waiter hold the same text */
+	if (*text) {
+		f->text = shared_text_new(*text);
+		*owner = shared_text_ref(f->text);
+	}
+	copy_carddav_error(&f->error, error);
+	g_cond_broadcast(&flights_landed);
+	for (waiter = f->parked; waiter; waiter = waiter->next)
+		async_unpark(waiter->data);
+	g_mutex_unlock(&flights_lock);
+	return failed;
+}
@@ -0,0 +1,74 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_FLIGHT_H__
+#define __CARDDAV_FLIGHT_H__
+
+#include <glib.h>
+#include "carddav.h"
+#include "carddav-utils.h"
+
+/*
+ * Identical reads which run at the same time share one flight: the first
+ * one sends its requests, the others wait for it and share its outcome.
+ * Reads are identical when they go to the same URL with the same
+ * credentials and the same trust settings.
+ */
+
+/**
+ * Work run by the leader of a flight.
+ * @param data Passed unchanged from flight_run()
+ * @param text Set to the text produced, or left NULL
+ * @param error Receives the reason of a failure
+ * @return TRUE on failure, FALSE otherwise
+ */
+typedef gboolean (*flight_func)(gpointer data, gchar** text,
+		carddav_error* error);
+
+/**
+ * Name a read so identical ones can find each other. The key holds a
+ * digest of the URL and credentials, never the credentials themselves.
+ * @param settings The operation's settings
+ * @param what Kind of read
+ * @return The key. Caller must g_free it.
+ */
+gchar* flight_key(carddav_settings* settings, const gchar* what);
+
+/**
+ * Run a read, or wait for an identical one in flight and share its
+ * outcome. Outcomes of leaders which ran out of time or were cancelled
+ * are not shared; a waiting operation then runs the read itself.
+ * @param key @see flight_key()
+ * @param settings The operation's settings, for its deadline,
+ * cancellation token and counters
+ * @param func The read. @see flight_func
+ * @param data Passed unchanged to func
+ * @param text Set to the text of the read, or NULL. Caller must free it
+ * with release_text().
+ * @param owner Set to the shared text holding text when other operations
+ * share it, NULL otherwise. A shared text must not be changed.
+ * @param error Receives the reason of a failure
+ * @return Result of func
+ */
+gboolean flight_run(const gchar* key, carddav_settings* settings,
+		flight_func func, gpointer data, gchar** text, shared_text** owner,
+		carddav_error* error);
+
+#endif
@@ -0,0 +1,226 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include "carddav-intern.h"
+#include "carddav-arena.h"
+#include <glib.h>
+#include <string.h>
+
+/* Initial number of slots, a power of two */
+#define INTERN_SLOTS 64
+
+typedef struct {
+	const gchar* str;
+	guint32 len;
+	guint32 hash;
+} intern_entry;
+
+/*
+ * Open addressing with linear probing. slots holds ids, entry id - 1 of
+ * entries describes the string. Strings are packed into arena. The table
+ * is kept at most half full.
+ */
+struct _carddav_intern {
+	carddav_arena* arena;
+	GArray* entries;
+	carddav_intern_id* slots;
+	guint32 mask;
+};
+
+static guint32 intern_hash(const gchar* str, gsize len) {
+	guint32 h = 2166136261U;
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (guchar) str[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static intern_entry* entry_of(carddav_intern* table, carddav_intern_id id) {
+	if (id == 0 || id > table->entries->len)
+		return NULL;
+	return &g_array_index(table->entries, intern_entry, id - 1);
+}
+
+/**
+ * Slot holding str, or the empty slot where it belongs.
+ */
+static carddav_intern_id* find_slot(carddav_intern* table,
+		const gchar* str, gsize len, guint32 hash) {
+	guint32 i = hash & table->mask;
+	intern_entry* entry;
+
+	while (table->slots[i] != 0) {
+		entry = entry_of(table, table->slots[i]);
+		if (entry->hash == hash && entry->len == len &&
+				memcmp(entry->str, str, len) == 0)
+			break;
+		i = (i + 1) & table->mask;
+	}
+	return &table->slots[i];
+}
+
+static void grow_slots(carddav_intern* table) {
+	guint32 size = (table->mask + 1) * 2;
+	intern_entry* entry;
+	guint32 id;
+	guint32 i;
+
+	g_free(table->slots);
+	table->slots = g_new0(carddav_intern_id, size);
+	table->mask = size - 1;
+	for (id = 1; id <= table->entries->len; id++) {
+		entry = entry_of(table, id);
+		i = entry->hash & table->mask;
+		while (table->slots[i] != 0)
+			i = (i + 1) & table->mask;
+		table->slots[i] = id;
+	}
+}
+
+/**
+ * Create an empty table.
+ * @return A new table. Free with intern_free()
+ */
+carddav_intern* intern_new(void) {
+	carddav_intern* table = g_new(carddav_intern, 1);
+
+	table->arena = arena_new();
+	table->entries = g_array_new(FALSE, FALSE, sizeof(intern_entry));
+	table->slots = g_new0(carddav_intern_id, INTERN_SLOTS);
+	table->mask = INTERN_SLOTS - 1;
+	return table;
+}
+
+/**
+ * Free a table and all strings stored in it.
+ * @param table @see carddav_intern
+ */
+void intern_free(carddav_intern* table) {
+	if (!table)
+		return;
+	arena_free(table->arena);
+	g_array_free(table->entries, TRUE);
+	g_free(table->slots);
+	g_free(table);
+}
+
+/**
+ * Store a string unless an equal one is stored already.
+ * @param table @see carddav_intern
+ * @param str The string, need not be NUL terminated
+ * @param len Length of str
+ * @return The id of the stored string
+ */
+carddav_intern_id intern_add(carddav_intern* table,
+		const gchar* str, gsize len) {
+	guint32 hash;
+	carddav_intern_id* slot;
+	intern_entry entry;
+
+	g_return_val_if_fail(table != NULL && str != NULL, 0);
+	g_return_val_if_fail(len <= G_MAXUINT32, 0);
+
+	hash = intern_hash(str, len);
+	slot = find_slot(table, str, len, hash);
+	if (*slot != 0)
+		return *slot;
+	entry.str = arena_strndup(table->arena, str, len);
+	entry.len = len;
+	entry.hash = hash;
+	g_array_append_val(table->entries, entry);
+	*slot = table->entries->len;
+	if (table->entries->len * 2 > table->mask + 1)
+		grow_slots(table);
+	return table->entries->len;
+}
+
+/**
+ * Find a string without storing it.
+ * @param table @see carddav_intern
+ * @param str The string, need not be NUL terminated
+ * @param len Length of str
+ * @return The id of the stored string or 0 if it is not stored
+ */
+carddav_intern_id intern_find(carddav_intern* table,
+		const gchar* str, gsize len) {
+	g_return_val_if_fail(table != NULL && str != NULL, 0);
+
+	return *find_slot(table, str, len, intern_hash(str, len));
+}
+
+/**
+ * Store a string and return the stored copy. Strings stored this way
+ * can be compared by pointer.
+ * @param table @see carddav_intern
+ * @param str NUL terminated string
+ * @return The stored string. Owned by the table
+ */
+const gchar* intern_string(carddav_intern* table, const gchar* str) {
+	g_return_val_if_fail(str != NULL, NULL);
+
+	return intern_lookup(table, intern_add(table, str, strlen(str)));
+}
+
+/**
+ * The string an id names.
+ * @param table @see carddav_intern
+ * @param id An id returned by this table
+ * @return NUL terminated string owned by the table, NULL for unknown ids
+ */
+const gchar* intern_lookup(carddav_intern* table, carddav_intern_id id) {
+	intern_entry* entry;
+
+	g_return_val_if_fail(table != NULL, NULL);
+
+	entry = entry_of(table, id);
+	return (entry) ? entry->str : NULL;
+}
+
+/**
+ * Length of the string an id names.
+ * @param table @see carddav_intern
+ * @param id An id returned by this table
+ * @return Length in bytes, 0 for unknown ids
+ */
+gsize intern_length(carddav_intern* table, carddav_intern_id id) {
+	intern_entry* entry;
+
+	g_return_val_if_fail(table != NULL, 0);
+
+	entry = entry_of(table, id);
+	return (entry) ? entry->len : 0;
+}
+
+/**
+ * Number of strings stored.
+ * @param table @see carddav_intern
+ * @return number of strings
+ */
+guint intern_size(carddav_intern* table) {
+	g_return_val_if_fail(table != NULL, 0);
+
+	return table->entries->len;
+}
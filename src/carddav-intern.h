@@ -0,0 +1,104 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_INTERN_H__
+#define __CARDDAV_INTERN_H__
+
+#include <glib.h>
+
+/**
+ * @typedef carddav_intern_id
+ * Compact name of an interned string. Equal strings of one table have
+ * equal ids. 0 (zero) never names a string.
+ */
+typedef guint32 carddav_intern_id;
+
+/**
+ * @typedef struct _carddav_intern carddav_intern
+ * A table storing every distinct string once, like hosts, collection
+ * paths and hrefs. Strings stay valid until the table is freed.
+ */
+typedef struct _carddav_intern carddav_intern;
+
+/**
+ * Create an empty table.
+ * @return A new table. Free with intern_free()
+ */
+carddav_intern* intern_new(void);
+
+/**
+ * Free a table and all strings stored in it.
+ * @param table @see carddav_intern
+ */
+void intern_free(carddav_intern* table);
+
+/**
+ * Store a string unless an equal one is stored already.
+ * @param table @see carddav_intern
+ * @param str The string, need not be NUL terminated
+ * @param len Length of str
+ * @return The id of the stored string
+ */
+carddav_intern_id intern_add(carddav_intern* table,
+		const gchar* str, gsize len);
+
+/**
+ * Find a string without storing it.
+ * @param table @see carddav_intern
+ * @param str The string, need not be NUL terminated
+ * @param len Length of str
+ * @return The id of the stored string or 0 if it is not stored
+ */
+carddav_intern_id intern_find(carddav_intern* table,
+		const gchar* str, gsize len);
+
+/**
+ * Store a string and return the stored copy. Strings stored this way
+ * can be compared by pointer.
+ * @param table @see carddav_intern
+ * @param str NUL terminated string
+ * @return The stored string. Owned by the table
+ */
+const gchar* intern_string(carddav_intern* table, const gchar* str);
+
+/**
+ * The string an id names.
+ * @param table @see carddav_intern
+ * @param id An id returned by this table
+ * @return NUL terminated string owned by the table, NULL for unknown ids
+ */
+const gchar* intern_lookup(carddav_intern* table, carddav_intern_id id);
+
+/**
+ * Length of the string an id names.
+ * @param table @see carddav_intern
+ * @param id An id returned by this table
+ * @return Length in bytes, 0 for unknown ids
+ */
+gsize intern_length(carddav_intern* table, carddav_intern_id id);
+
+/**
+ * Number of strings stored.
+ * @param table @see carddav_intern
+ * @return number of strings
+ */
+guint intern_size(carddav_intern* table);
+
+#endif
@@ -0,0 +1,290 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-limit.h"
+#include "carddav-async.h"
+#include <glib.h>
+#include <curl/curl.h>
+#include <string.h>
+
+/* How often a request waiting for a place checks its cancellation
+ * token. A finished request or new limits wake it otherwise. */
+#define LIMIT_CANCEL_POLL_US (50 * 1000)
+
+struct _carddav_limiter {
+	GMutex lock;
+	GCond released;
+	GSList* parked;		/* asynchronous requests in async_park() */
+	gint active;		/* any limit set, read without the lock */
+	gdouble rate;		/* tokens per second, 0 for none */
+	gdouble burst;
+	guint max_in_flight;	/* 0 for none */
+	GHashTable* hosts;	/* scheme://host[:port] -> limit_host */
+};
+
+struct _limit_host {
+	carddav_limiter* limiter;
+	gdouble tokens;
+	gint64 refilled;
+	guint in_flight;
+};
+
+/* Used by operations without limits of their own */
+static carddav_limiter limits_global;
+
+static void configure(carddav_limiter* limiter, double rate, unsigned burst,
+		unsigned max_in_flight) {
+	limiter->rate = (rate > 0) ? rate : 0;
+	limiter->burst = MAX(burst, 1);
+	limiter->max_in_flight = max_in_flight;
+	g_atomic_int_set(&limiter->active,
+			limiter->rate > 0 || limiter->max_in_flight > 0);
+}
+
+/**
+ * Find the state of the host of an operation, creating it with a full
+ * bucket. Called with the lock held.
+ */
+static limit_host* lookup_host(carddav_limiter* limiter,
+		carddav_settings* settings) {
+	const gchar* url = settings->url ? settings->url : "";
+	const gchar* end = strchr(url, '/');
+	gchar* key;
+	limit_host* host;
+
+	key = g_strdup_printf("%s%.*s", settings->usehttps ? "https://" : "http://",
+			(int) (end ? (gsize) (end - url) : strlen(url)), url);
+	if (!limiter->hosts)
+		limiter->hosts = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+	host = g_hash_table_lookup(limiter->hosts, key);
+	if (host) {
+		g_free(key);
+		return host;
+	}
+	host = g_new0(limit_host, 1);
+	host->limiter = limiter;
+	host->tokens = limiter->burst;
+	host->refilled = g_get_monotonic_time();
+	g_hash_table_insert(limiter->hosts, key, host);
+	return host;
+}
+
+/**
+ * Take a token and a place if both are available. Otherwise return when
+ * to look again, -1 if only a finished request can help.
+ */
+static gboolean try_take(limit_host* host, gint64 now, gint64* retry) {
+	carddav_limiter* limiter = host->limiter;
+	gboolean placed;
+
+	if (limiter->rate > 0) {
+		host->tokens = MIN(limiter->burst, host->tokens +
+				(now - host->refilled) * limiter->rate / G_USEC_PER_SEC);
+	} else {
+		host->tokens = limiter->burst;
+	}
+	host->refilled = now;
+	placed = limiter->max_in_flight == 0 ||
+		host->in_flight < limiter->max_in_flight;
+	if (placed && host->tokens >= 1) {
+		if (limiter->rate > 0)
+			host->tokens -= 1;
+		host->in_flight++;
+		return TRUE;
+	}
+	if (!placed)
+		*retry = -1;
+	else
+		*retry = now + (gint64) ((1 - host->tokens) * G_USEC_PER_SEC /
+				limiter->rate) + 1;
+	return FALSE;
+}
+
+/**
+ * Wake every request waiting for a place. Called with the lock held.
+ */
+static void wake_waiters(carddav_limiter* limiter) {
+	GSList* waiter;
+
+	g_cond_broadcast(&limiter->released);
+	for (waiter = limiter->parked; waiter; waiter = waiter->next)
+		async_unpark(waiter->data);
+}
+
+/**
+ * Wait until the limits of an operation let it send another request to
+ * its host. Inside an asynchronous operation only the operation waits,
+ * not its engine.
+ * @param settings The operation's settings
+ * @param host Set to the host to pass to limit_release(), NULL if the
+ * request is not limited
+ * @return CURLE_OK, CURLE_OPERATION_TIMEDOUT if the operation's deadline
+ * passed or CURLE_ABORTED_BY_CALLBACK if it was cancelled while waiting
+ */
+CURLcode limit_acquire(carddav_settings* settings, limit_host** host) {
+	carddav_limiter* limiter = settings->limiter ?
+		settings->limiter : &limits_global;
+	gboolean async = async_active();
+	CURLcode res = CURLE_OK;
+	limit_host* h;
+
+	*host = NULL;
+	if (!g_atomic_int_get(&limiter->active))
+		return CURLE_OK;
+	g_mutex_lock(&limiter->lock);
+	h = lookup_host(limiter, settings);
+	for (;;) {
+		gint64 now = g_get_monotonic_time();
+		gint64 retry;
+
+		if (try_take(h, now, &retry)) {
+			*host = h;
+			break;
+		}
+		if (settings->cancel && carddav_cancel_requested(settings->cancel)) {
+			res = CURLE_ABORTED_BY_CALLBACK;
+			break;
+		}
+		if (settings->deadline > 0 && now >= settings->deadline) {
+			res = CURLE_OPERATION_TIMEDOUT;
+			break;
+		}
+		if (settings->cancel)
+			retry = (retry < 0) ? now + LIMIT_CANCEL_POLL_US :
+				MIN(retry, now + LIMIT_CANCEL_POLL_US);
+		if (settings->deadline > 0)
+			retry = (retry < 0) ? settings->deadline :
+				MIN(retry, settings->deadline);
+		if (async) {
+			gpointer self = async_self();
+			gboolean alive;
+
+			/* until the next token is due, or a release wakes it */
+			limiter->parked = g_slist_prepend(limiter->parked, self);
+			g_mutex_unlock(&limiter->lock);
+			alive = async_park(retry);
+			g_mutex_lock(&limiter->lock);
+			limiter->parked = g_slist_remove(limiter->parked, self);
+			if (!alive) {
+				res = CURLE_ABORTED_BY_CALLBACK;
+				break;
+			}
+		} else if (retry < 0) {
+			g_cond_wait(&limiter->released, &limiter->lock);
+		} else {
+			g_cond_wait_until(&limiter->released, &limiter->lock, retry);
+		}
+	}
+	g_mutex_unlock(&limiter->lock);
+	return res;
+}
+
+/**
+ * Give back the place of a finished request.
+ * @param host @see limit_acquire()
+ */
+void limit_release(limit_host* host) {
+	carddav_limiter* limiter;
+
+	if (!host)
+		return;
+	limiter = host->limiter;
+	g_mutex_lock(&limiter->lock);
+	host->in_flight--;
+	wake_waiters(limiter);
+	g_mutex_unlock(&limiter->lock);
+}
+
+/**
+ * Function for creating limits which sessions may share. Each host gets
+ * a token bucket of burst requests, refilled at rate requests per
+ * second, and at most max_in_flight of its requests run at a time. A
+ * request waits until both allow it, or until its operation times out
+ * or is cancelled.
+ * @param rate Requests per second, 0 (zero) for no rate limit
+ * @param burst Requests which may be sent at once after an idle period.
+ * Less than 1 is taken as 1
+ * @param max_in_flight Concurrent requests, 0 (zero) for no limit
+ * @return New limits. Free them with carddav_limiter_free() once no
+ * operation uses them.
+ */
+carddav_limiter* carddav_limiter_new(double rate, unsigned burst,
+		unsigned max_in_flight) {
+	carddav_limiter* limiter = g_new0(carddav_limiter, 1);
+
+	g_mutex_init(&limiter->lock);
+	g_cond_init(&limiter->released);
+	configure(limiter, rate, burst, max_in_flight);
+	return limiter;
+}
+
+/**
+ * Function for freeing limits.
+ * @param limiter Address to a pointer to limits
+ */
+void carddav_limiter_free(carddav_limiter** limiter) {
+	carddav_limiter* l;
+
+	g_return_if_fail(limiter != NULL);
+
+	l = *limiter;
+	if (!l)
+		return;
+	if (l->hosts)
+		g_hash_table_destroy(l->hosts);
+	g_cond_clear(&l->released);
+	g_mutex_clear(&l->lock);
+	g_free(l);
+	*limiter = NULL;
+}
+
+/**
+ * Function for changing limits while operations use them. Requests
+ * waiting are re-evaluated under the new limits.
+ * @param limiter Limits. @see carddav_limiter_new()
+ * @param rate @see carddav_limiter_new()
+ * @param burst @see carddav_limiter_new()
+ * @param max_in_flight @see carddav_limiter_new()
+ */
+void carddav_limiter_set(carddav_limiter* limiter, double rate,
+		unsigned burst, unsigned max_in_flight) {
+	g_return_if_fail(limiter != NULL);
+
+	g_mutex_lock(&limiter->lock);
+	configure(limiter, rate, burst, max_in_flight);
+	wake_waiters(limiter);
+	g_mutex_unlock(&limiter->lock);
+}
+
+/**
+ * Function for setting the limits applied to every host by operations
+ * whose debug_curl.limiter is NULL. There are none by default.
+ * @param rate @see carddav_limiter_new()
+ * @param burst @see carddav_limiter_new()
+ * @param max_in_flight @see carddav_limiter_new()
+ */
+void carddav_set_limits(double rate, unsigned burst, unsigned max_in_flight) {
+	carddav_limiter_set(&limits_global, rate, burst, max_in_flight);
+}
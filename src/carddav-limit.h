@@ -0,0 +1,53 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_LIMIT_H__
+#define __CARDDAV_LIMIT_H__
+
+#include <glib.h>
+#include <curl/curl.h>
+#include "carddav.h"
+#include "carddav-utils.h"
+
+/**
+ * @typedef struct _limit_host limit_host
+ * Token bucket and requests in flight of one host under some limits
+ */
+typedef struct _limit_host limit_host;
+
+/**
+ * Wait until the limits of an operation let it send another request to
+ * its host. Inside an asynchronous operation only the operation waits,
+ * not its engine.
+ * @param settings The operation's settings
+ * @param host Set to the host to pass to limit_release(), NULL if the
+ * request is not limited
+ * @return CURLE_OK, CURLE_OPERATION_TIMEDOUT if the operation's deadline
+ * passed or CURLE_ABORTED_BY_CALLBACK if it was cancelled while waiting
+ */
+CURLcode limit_acquire(carddav_settings* settings, limit_host** host);
+
+/**
+ * Give back the place of a finished request.
+ * @param host @see limit_acquire()
+ */
+void limit_release(limit_host* host);
+
+#endif
@@ -0,0 +1,195 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-retry.h"
+#include "carddav-async.h"
+#include <glib.h>
+#include <curl/curl.h>
+#include <time.h>
+
+#define RETRY_DEFAULT_COUNT 3
+#define RETRY_DEFAULT_BASE_MS 100
+#define RETRY_DEFAULT_MAX_MS 10000
+
+/* How often a wait checks the cancellation token */
+#define RETRY_CANCEL_POLL_US (50 * 1000)
+
+/**
+ * Requests which neither change the collection nor take a lock
+ */
+static gboolean method_is_safe(CARDDAV_METHOD method) {
+	switch (method) {
+		case CARDDAV_METHOD_OPTIONS:
+		case CARDDAV_METHOD_GET:
+		case CARDDAV_METHOD_PROPFIND:
+		case CARDDAV_METHOD_REPORT:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Whether an attempt failed in a way a repetition may cure, and whether
+ * repeating it is harmless for its method.
+ */
+static gboolean attempt_is_retryable(CURL* curl, CARDDAV_METHOD method,
+		CURLcode res, gboolean rewindable) {
+	gboolean safe = method_is_safe(method);
+	long status = 0;
+
+	switch (res) {
+		case CURLE_OK:
+			break;
+		/* nothing reached the server */
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+			return TRUE;
+		/* the server may have acted on the request */
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_PARTIAL_FILE:
+			return safe && rewindable;
+		/* deadlines, cancellation and everything else are final */
+		default:
+			return FALSE;
+	}
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	switch (status) {
+		/* refused before being acted on */
+		case 408:	/* request timeout */
+		case 423:	/* locked */
+		case 429:	/* too many requests */
+		case 503:	/* service unavailable */
+			return TRUE;
+		/* a gateway or the server failed somewhere in between */
+		case 500:
+		case 502:
+		case 504:
+			return safe;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Wait demanded by a Retry-After header, in seconds or as an HTTP date.
+ * @return Microseconds, -1 if there is no usable header
+ */
+static gint64 retry_after(struct MemoryStruct* headers) {
+	const gchar* value = get_response_header(headers, "Retry-After");
+	gchar* end;
+	gint64 seconds;
+
+	if (!value)
+		return -1;
+	seconds = g_ascii_strtoll(value, &end, 10);
+	if (end == value || *end) {
+		time_t date = curl_getdate(value, NULL);
+
+		if (date < 0)
+			return -1;
+		seconds = date - time(NULL);
+	}
+	return MAX(seconds, 0) * G_USEC_PER_SEC;
+}
+
+/**
+ * Decide whether a failed attempt of a request is repeated and when.
+ * Requests which may change the collection are only repeated when the
+ * server cannot have acted on them. Retry-After is honored; otherwise
+ * the wait grows exponentially with full jitter.
+ * @param curl The transfer
+ * @param settings The operation's settings, for its retry policy,
+ * method and deadline
+ * @param res Result of the attempt
+ * @param attempt Number of attempts made so far, 1 after the first
+ * @param headers Headers of the response, for Retry-After
+ * @param rewindable FALSE if the body went to a consumer which cannot
+ * take it back
+ * @return Monotonic time to repeat the request at, 0 (zero) not to
+ */
+gint64 retry_time(CURL* curl, carddav_settings* settings, CURLcode res,
+		guint attempt, struct MemoryStruct* headers, gboolean rewindable) {
+	int retries = settings->max_retries ?
+		settings->max_retries : RETRY_DEFAULT_COUNT;
+	gint64 base = (settings->retry_base_ms > 0 ?
+		settings->retry_base_ms : RETRY_DEFAULT_BASE_MS) * 1000;
+	gint64 cap = (settings->retry_max_ms > 0 ?
+		settings->retry_max_ms : RETRY_DEFAULT_MAX_MS) * 1000;
+	gint64 delay;
+	gint64 until;
+
+	if (retries < 0 || attempt > (guint) retries)
+		return 0;
+	if (!attempt_is_retryable(curl, settings->method, res, rewindable))
+		return 0;
+	delay = (res == CURLE_OK) ? retry_after(headers) : -1;
+	if (delay > cap)
+		return 0;
+	if (delay < 0) {
+		/* full jitter: anywhere between nothing and the backoff */
+		gint64 backoff = cap;
+
+		if (attempt - 1 < 32)
+			backoff = MIN(cap, base << (attempt - 1));
+		delay = (gint64) (g_random_double() * backoff);
+	}
+	until = g_get_monotonic_time() + delay;
+	if (settings->deadline > 0 && until >= settings->deadline)
+		return 0;
+	return MAX(until, 1);
+}
+
+/**
+ * Wait for the next attempt of a request. Inside an asynchronous
+ * operation only the operation waits, not its engine.
+ * @param settings The operation's settings, for its cancellation token
+ * @param until @see retry_time()
+ * @return CURLE_OK or CURLE_ABORTED_BY_CALLBACK if the operation was
+ * cancelled while waiting
+ */
+CURLcode retry_wait(carddav_settings* settings, gint64 until) {
+	gint64 now;
+
+	while ((now = g_get_monotonic_time()) < until) {
+		gint64 wake = until;
+
+		if (settings->cancel) {
+			if (carddav_cancel_requested(settings->cancel))
+				return CURLE_ABORTED_BY_CALLBACK;
+			wake = MIN(wake, now + RETRY_CANCEL_POLL_US);
+		}
+		if (async_active()) {
+			if (!async_sleep(wake))
+				return CURLE_ABORTED_BY_CALLBACK;
+		} else {
+			g_usleep((gulong) (wake - now));
+		}
+	}
+	if (settings->cancel && carddav_cancel_requested(settings->cancel))
+		return CURLE_ABORTED_BY_CALLBACK;
+	return CURLE_OK;
+}
@@ -0,0 +1,57 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_RETRY_H__
+#define __CARDDAV_RETRY_H__
+
+#include <glib.h>
+#include <curl/curl.h>
+#include "carddav.h"
+#include "carddav-utils.h"
+
+/**
+ * Decide whether a failed attempt of a request is repeated and when.
+ * Requests which may change the collection are only repeated when the
+ * server cannot have acted on them. Retry-After is honored; otherwise
+ * the wait grows exponentially with full jitter.
+ * @param curl The transfer
+ * @param settings The operation's settings, for its retry policy,
+ * method and deadline
+ * @param res Result of the attempt
+ * @param attempt Number of attempts made so far, 1 after the first
+ * @param headers Headers of the response, for Retry-After
+ * @param rewindable FALSE if the body went to a consumer which cannot
+ * take it back
+ * @return Monotonic time to repeat the request at, 0 (zero) not to
+ */
+gint64 retry_time(CURL* curl, carddav_settings* settings, CURLcode res,
+		guint attempt, struct MemoryStruct* headers, gboolean rewindable);
+
+/**
+ * Wait for the next attempt of a request. Inside an asynchronous
+ * operation only the operation waits, not its engine.
+ * @param settings The operation's settings, for its cancellation token
+ * @param until @see retry_time()
+ * @return CURLE_OK or CURLE_ABORTED_BY_CALLBACK if the operation was
+ * cancelled while waiting
+ */
+CURLcode retry_wait(carddav_settings* settings, gint64 until);
+
+#endif
@@ -0,0 +1,562 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-snapshot.h"
+#include "carddav-intern.h"
+#include "carddav.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/**
+ * @struct snapshot_entry
+ * A card added to a writer. The body is already on disk
+ */
+typedef struct {
+	carddav_intern_id href;
+	carddav_intern_id etag;
+	carddav_intern_id uid;
+	guint64 data;
+} snapshot_entry;
+
+/**
+ * @struct _carddav_snapshot_writer
+ * A snapshot being written to a temporary file next to its final path
+ */
+struct _carddav_snapshot_writer {
+	gchar* path;
+	gchar* tmp;
+	int fd;
+	guint64 offset;		/* end of the data written so far */
+	gboolean failed;
+	carddav_intern* names;	/* hrefs, etags and UIDs */
+	GArray* entries;
+};
+
+/**
+ * @struct _carddav_snapshot
+ * A snapshot mapped read only
+ */
+struct _carddav_snapshot {
+	const gchar* map;
+	gsize size;
+	const snapshot_header* header;
+	const snapshot_record* records;
+	const guint32* uids;
+};
+
+static const gchar padding[SNAPSHOT_ALIGN];
+
+/**
+ * Append a snapshot string to the file of a writer.
+ * @param writer @see carddav_snapshot_writer
+ * @param str The bytes, need not be NUL terminated
+ * @param len Length of str
+ * @return The offset of the string or 0 (zero) on a write error
+ */
+static guint64 write_string(carddav_snapshot_writer* writer,
+		const gchar* str, gsize len) {
+	guint64 offset = writer->offset;
+	guint32 length = (guint32) len;
+	gsize pad = SNAPSHOT_ALIGN - (sizeof(length) + len) % SNAPSHOT_ALIGN;
+
+	/* pad is at least 1, the terminating NUL */
+	if (writer->failed || len > G_MAXUINT32 ||
+			carddav_write_fd((const char *) &length, sizeof(length),
+				&writer->fd) ||
+			carddav_write_fd(str, len, &writer->fd) ||
+			carddav_write_fd(padding, pad, &writer->fd)) {
+		writer->failed = TRUE;
+		return 0;
+	}
+	writer->offset += sizeof(length) + len + pad;
+	return offset;
+}
+
+/**
+ * Append a snapshot string unless it is missing or written already.
+ * @param writer @see carddav_snapshot_writer
+ * @param offsets Offsets of the names written so far, by id
+ * @param id Name of the string or 0 (zero)
+ * @return The offset of the string or 0 (zero)
+ */
+static guint64 write_optional_string(carddav_snapshot_writer* writer,
+		guint64* offsets, carddav_intern_id id) {
+	if (id == 0)
+		return 0;
+	if (offsets[id] == 0)
+		offsets[id] = write_string(writer,
+				intern_lookup(writer->names, id),
+				intern_length(writer->names, id));
+	return offsets[id];
+}
+
+/**
+ * Order two strings which may be NULL, missing strings first.
+ */
+static int compare_optional(const gchar* a, const gchar* b) {
+	if (!a || !b)
+		return (a != NULL) - (b != NULL);
+	return strcmp(a, b);
+}
+
+/**
+ * Order two names of a writer like compare_optional(). Equal names have
+ * equal ids, so only different ones are compared as strings.
+ */
+static int compare_names(carddav_intern* names,
+		carddav_intern_id a, carddav_intern_id b) {
+	if (a == b)
+		return 0;
+	return compare_optional(intern_lookup(names, a), intern_lookup(names, b));
+}
+
+static gint compare_href(gconstpointer a, gconstpointer b, gpointer data) {
+	return compare_names(data, ((const snapshot_entry *) a)->href,
+			((const snapshot_entry *) b)->href);
+}
+
+static gint compare_uid(gconstpointer a, gconstpointer b, gpointer data) {
+	carddav_snapshot_writer* w = data;
+
+	return compare_names(w->names,
+			g_array_index(w->entries, snapshot_entry, *(const guint32 *) a).uid,
+			g_array_index(w->entries, snapshot_entry, *(const guint32 *) b).uid);
+}
+
+/**
+ * Function for starting a new snapshot. Cards are written to a
+ * temporary file in the same directory as they are added, so memory use
+ * does not grow with the size of the cards.
+ * @param path Where the snapshot is to be stored. An existing snapshot
+ * is only replaced by carddav_snapshot_writer_commit().
+ * @return A writer or NULL if the temporary file could not be created.
+ */
+carddav_snapshot_writer* carddav_snapshot_writer_new(const char* path) {
+	carddav_snapshot_writer* writer;
+	snapshot_header header;
+
+	g_return_val_if_fail(path != NULL, NULL);
+
+	writer = g_new0(carddav_snapshot_writer, 1);
+	writer->path = g_strdup(path);
+	writer->tmp = g_strdup_printf("%s.XXXXXX", path);
+	writer->fd = g_mkstemp(writer->tmp);
+	if (writer->fd < 0) {
+		g_free(writer->tmp);
+		g_free(writer->path);
+		g_free(writer);
+		return NULL;
+	}
+	/* the real header is written on commit */
+	memset(&header, 0, sizeof(header));
+	if (carddav_write_fd((const char *) &header, sizeof(header), &writer->fd))
+		writer->failed = TRUE;
+	writer->offset = sizeof(header);
+	writer->names = intern_new();
+	writer->entries = g_array_new(FALSE, FALSE, sizeof(snapshot_entry));
+	return writer;
+}
+
+/**
+ * Function for adding a card to a snapshot. Has the signature of
+ * carddav_card_func, so a writer can be handed directly to
+ * carddav_getall_foreach().
+ * @param href The href of the card or NULL
+ * @param etag The entity tag of the card or NULL
+ * @param data The card
+ * @param len Length of data
+ * @param writer A carddav_snapshot_writer
+ * @return 0 (zero) on success, -1 on a write error
+ */
+int carddav_snapshot_add(const char* href, const char* etag,
+		const char* data, size_t len, void* writer) {
+	carddav_snapshot_writer* w = writer;
+	snapshot_entry entry;
+	carddav_vcard* card;
+	const char* uid;
+
+	g_return_val_if_fail(w != NULL, -1);
+	g_return_val_if_fail(data != NULL || len == 0, -1);
+
+	if (w->entries->len >= G_MAXUINT32)
+		w->failed = TRUE;
+	entry.data = write_string(w, data, len);
+	if (w->failed)
+		return -1;
+	card = carddav_vcard_parse(data, len);
+	uid = (card) ? carddav_vcard_get(card, "UID") : NULL;
+	entry.uid = (uid) ? intern_add(w->names, uid, strlen(uid)) : 0;
+	carddav_vcard_free(&card);
+	entry.href = (href) ? intern_add(w->names, href, strlen(href)) : 0;
+	entry.etag = (etag) ? intern_add(w->names, etag, strlen(etag)) : 0;
+	g_array_append_val(w->entries, entry);
+	return 0;
+}
+
+/**
+ * Function for finishing a snapshot. The indexes are written, the file
+ * is synced to disk and renamed over the path given to
+ * carddav_snapshot_writer_new(), so readers see either the old or the new
+ * snapshot. The writer is freed in any case.
+ * @param writer Address to a pointer to a writer
+ * @return 0 (zero) on success, -1 if the snapshot could not be written
+ */
+int carddav_snapshot_writer_commit(carddav_snapshot_writer** writer) {
+	carddav_snapshot_writer* w;
+	snapshot_header header;
+	snapshot_record* records;
+	guint32* uids;
+	guint64* offsets;
+	guint i, count;
+	int result = -1;
+
+	g_return_val_if_fail(writer != NULL && *writer != NULL, -1);
+
+	w = *writer;
+	count = w->entries->len;
+	g_array_sort_with_data(w->entries, compare_href, w->names);
+	records = g_new0(snapshot_record, count);
+	uids = g_new(guint32, count);
+	offsets = g_new0(guint64, intern_size(w->names) + 1);
+	memset(&header, 0, sizeof(header));
+	header.strings = w->offset;
+	for (i = 0; i < count; i++) {
+		snapshot_entry* entry = &g_array_index(w->entries, snapshot_entry, i);
+
+		records[i].href = write_optional_string(w, offsets, entry->href);
+		records[i].etag = write_optional_string(w, offsets, entry->etag);
+		records[i].uid = write_optional_string(w, offsets, entry->uid);
+		records[i].data = entry->data;
+		uids[i] = i;
+	}
+	g_free(offsets);
+	g_qsort_with_data(uids, count, sizeof(guint32), compare_uid, w);
+	header.records = w->offset;
+	if (carddav_write_fd((const char *) records,
+				count * sizeof(snapshot_record), &w->fd))
+		w->failed = TRUE;
+	w->offset += count * sizeof(snapshot_record);
+	header.uids = w->offset;
+	if (carddav_write_fd((const char *) uids, count * sizeof(guint32), &w->fd))
+		w->failed = TRUE;
+	w->offset += count * sizeof(guint32);
+	g_free(records);
+	g_free(uids);
+
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.size = w->offset;
+	header.count = count;
+	if (!w->failed && lseek(w->fd, 0, SEEK_SET) == 0 &&
+			carddav_write_fd((const char *) &header, sizeof(header),
+				&w->fd) == 0 &&
+			fsync(w->fd) == 0 && close(w->fd) == 0) {
+		w->fd = -1;
+		if (rename(w->tmp, w->path) == 0) {
+			g_free(w->tmp);
+			w->tmp = NULL;
+			result = 0;
+		}
+	}
+	carddav_snapshot_writer_free(writer);
+	return result;
+}
+
+/**
+ * Function for abandoning a snapshot. The temporary file is removed and
+ * an existing snapshot is left alone.
+ * @param writer Address to a pointer to a writer
+ */
+void carddav_snapshot_writer_free(carddav_snapshot_writer** writer) {
+	carddav_snapshot_writer* w;
+
+	g_return_if_fail(writer != NULL);
+
+	w = *writer;
+	if (!w)
+		return;
+	if (w->fd >= 0)
+		close(w->fd);
+	if (w->tmp)
+		unlink(w->tmp);
+	intern_free(w->names);
+	g_array_free(w->entries, TRUE);
+	g_free(w->tmp);
+	g_free(w->path);
+	g_free(w);
+	*writer = NULL;
+}
+
+/**
+ * Find a snapshot string in the mapping.
+ * @param snapshot @see carddav_snapshot
+ * @param offset Offset of the string or 0 (zero)
+ * @param len Set to the length of the string if not NULL
+ * @return The NUL terminated string or NULL if it is missing or does not
+ * fit into the file
+ */
+static const gchar* snapshot_string(carddav_snapshot* snapshot,
+		guint64 offset, gsize* len) {
+	guint32 length;
+
+	if (len)
+		*len = 0;
+	if (offset == 0 || offset % SNAPSHOT_ALIGN ||
+			offset > snapshot->size - sizeof(length) - 1)
+		return NULL;
+	length = *(const guint32 *) (snapshot->map + offset);
+	if (length > snapshot->size - offset - sizeof(length) - 1 ||
+			snapshot->map[offset + sizeof(length) + length] != '\0')
+		return NULL;
+	if (len)
+		*len = length;
+	return snapshot->map + offset + sizeof(length);
+}
+
+/**
+ * Function for opening a snapshot. The file is mapped and only its
+ * header is checked; nothing is parsed or copied.
+ * @param path A file written by carddav_snapshot_writer_commit()
+ * @return A snapshot or NULL if the file is missing, damaged or was
+ * written by an incompatible version or host.
+ * @see carddav_snapshot_close()
+ */
+carddav_snapshot* carddav_snapshot_open(const char* path) {
+	carddav_snapshot* snapshot;
+	const snapshot_header* header;
+	struct stat st;
+	void* map;
+	int fd;
+
+	g_return_val_if_fail(path != NULL, NULL);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(snapshot_header) ||
+			(guint64) st.st_size > G_MAXSIZE) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	header = map;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+			header->version != SNAPSHOT_VERSION ||
+			header->byte_order != SNAPSHOT_BYTE_ORDER ||
+			header->size != (guint64) st.st_size ||
+			header->records % SNAPSHOT_ALIGN ||
+			header->count > G_MAXUINT32 ||
+			header->records > header->size ||
+			header->count > (header->size - header->records) /
+				sizeof(snapshot_record) ||
+			header->uids != header->records +
+				header->count * sizeof(snapshot_record) ||
+			header->count * sizeof(guint32) > header->size - header->uids) {
+		munmap(map, (size_t) st.st_size);
+		return NULL;
+	}
+	snapshot = g_new0(carddav_snapshot, 1);
+	snapshot->map = map;
+	snapshot->size = (gsize) st.st_size;
+	snapshot->header = header;
+	snapshot->records = (const snapshot_record *) (snapshot->map +
+			header->records);
+	snapshot->uids = (const guint32 *) (snapshot->map + header->uids);
+	return snapshot;
+}
+
+/**
+ * Function for closing a snapshot. Strings returned from it become
+ * invalid.
+ * @param snapshot Address to a pointer to a snapshot
+ */
+void carddav_snapshot_close(carddav_snapshot** snapshot) {
+	g_return_if_fail(snapshot != NULL);
+
+	if (*snapshot) {
+		munmap((void *) (*snapshot)->map, (*snapshot)->size);
+		g_free(*snapshot);
+		*snapshot = NULL;
+	}
+}
+
+/**
+ * Function for counting the cards in a snapshot.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @return Number of cards
+ */
+size_t carddav_snapshot_count(carddav_snapshot* snapshot) {
+	g_return_val_if_fail(snapshot != NULL, 0);
+
+	return (size_t) snapshot->header->count;
+}
+
+/**
+ * Function for getting a card of a snapshot. Cards are numbered in
+ * href order.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @param n Zero based number of the card
+ * @param href Set to the href or NULL if not NULL
+ * @param etag Set to the entity tag or NULL if not NULL
+ * @param len Set to the length of the card if not NULL
+ * @return The NUL terminated card or NULL if n is out of range. The
+ * strings stay valid until the snapshot is closed.
+ */
+const char* carddav_snapshot_get(carddav_snapshot* snapshot, size_t n,
+		const char** href, const char** etag, size_t* len) {
+	const snapshot_record* record;
+	gsize length;
+	const gchar* data;
+
+	g_return_val_if_fail(snapshot != NULL, NULL);
+
+	if (href)
+		*href = NULL;
+	if (etag)
+		*etag = NULL;
+	if (len)
+		*len = 0;
+	if (n >= snapshot->header->count)
+		return NULL;
+	record = &snapshot->records[n];
+	data = snapshot_string(snapshot, record->data, &length);
+	if (href)
+		*href = snapshot_string(snapshot, record->href, NULL);
+	if (etag)
+		*etag = snapshot_string(snapshot, record->etag, NULL);
+	if (len)
+		*len = length;
+	return data;
+}
+
+/**
+ * Function for finding a card by its href.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @param href The href of the card
+ * @param n Set to the number of the card if found
+ * @return 1 if the card was found, 0 (zero) otherwise
+ */
+int carddav_snapshot_find_href(carddav_snapshot* snapshot,
+		const char* href, size_t* n) {
+	gsize low = 0;
+	gsize high;
+
+	g_return_val_if_fail(snapshot != NULL && href != NULL && n != NULL, 0);
+
+	high = (gsize) snapshot->header->count;
+	while (low < high) {
+		gsize mid = low + (high - low) / 2;
+		int cmp = compare_optional(href, snapshot_string(snapshot,
+					snapshot->records[mid].href, NULL));
+
+		if (cmp == 0) {
+			*n = mid;
+			return 1;
+		}
+		if (cmp < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	return 0;
+}
+
+/**
+ * Function for finding a card by its UID.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @param uid The UID of the card
+ * @param n Set to the number of the card if found
+ * @return 1 if the card was found, 0 (zero) otherwise
+ */
+int carddav_snapshot_find_uid(carddav_snapshot* snapshot,
+		const char* uid, size_t* n) {
+	gsize count;
+	gsize low = 0;
+	gsize high;
+
+	g_return_val_if_fail(snapshot != NULL && uid != NULL && n != NULL, 0);
+
+	count = (gsize) snapshot->header->count;
+	high = count;
+	while (low < high) {
+		gsize mid = low + (high - low) / 2;
+		guint32 record = snapshot->uids[mid];
+		int cmp;
+
+		if (record >= count)
+			return 0;
+		cmp = compare_optional(uid, snapshot_string(snapshot,
+					snapshot->records[record].uid, NULL));
+		if (cmp == 0) {
+			*n = record;
+			return 1;
+		}
+		if (cmp < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	return 0;
+}
+
+/**
+ * Function for visiting every card of a snapshot in href order.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param user_data Passed unchanged to callback
+ * @return 0 (zero) if all cards were visited, otherwise the value which
+ * stopped the callback
+ */
+int carddav_snapshot_foreach(carddav_snapshot* snapshot,
+		carddav_card_func callback, void* user_data) {
+	size_t i;
+
+	g_return_val_if_fail(snapshot != NULL && callback != NULL, -1);
+
+	for (i = 0; i < snapshot->header->count; i++) {
+		const char* href;
+		const char* etag;
+		size_t len;
+		const char* data = carddav_snapshot_get(snapshot, i,
+				&href, &etag, &len);
+		int stop;
+
+		if (!data)
+			continue;
+		stop = callback(href, etag, data, len, user_data);
+		if (stop)
+			return stop;
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_SNAPSHOT_H__
+#define __CARDDAV_SNAPSHOT_H__
+
+#include <glib.h>
+
+/*
+ * Layout of a snapshot file, all numbers in the byte order of the host
+ * which wrote it:
+ *
+ *   snapshot_header
+ *   card bodies         snapshot strings, in the order they were added
+ *   string table        snapshot strings holding hrefs, etags and UIDs
+ *   href index          snapshot_record[count], sorted by href
+ *   UID index           guint32[count] record numbers, sorted by UID
+ *
+ * A snapshot string is a guint32 length followed by the bytes, a NUL
+ * and padding up to the next multiple of 8. Offsets are counted from
+ * the start of the file, offset 0 (zero) means the string is missing.
+ */
+
+#define SNAPSHOT_MAGIC "CDAVSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_ALIGN 8
+
+/**
+ * @struct snapshot_header
+ * Start of every snapshot file
+ */
+typedef struct {
+	gchar magic[8];		/* SNAPSHOT_MAGIC, not NUL terminated */
+	guint32 version;	/* SNAPSHOT_VERSION */
+	guint32 byte_order;	/* SNAPSHOT_BYTE_ORDER as written by the host */
+	guint64 size;		/* size of the file */
+	guint64 count;		/* number of cards */
+	guint64 records;	/* offset of the href index */
+	guint64 uids;		/* offset of the UID index */
+	guint64 strings;	/* offset of the string table */
+	guint64 reserved;
+} snapshot_header;
+
+/**
+ * @struct snapshot_record
+ * One card in the href index. All members are offsets of snapshot strings
+ */
+typedef struct {
+	guint64 href;
+	guint64 etag;
+	guint64 uid;
+	guint64 data;
+} snapshot_record;
+
+#endif
@@ -0,0 +1,166 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav.h"
+#include "carddav-async.h"
+#include <glib.h>
+
+/*
+ * A GSource feeding socket activity and timer expiry of one engine back
+ * into it. Operations on the engine are started from the thread which
+ * iterates the context, so completion callbacks run on the context.
+ */
+typedef struct {
+	GSource source;
+	carddav_engine* engine;
+	GHashTable* fds;	/* socket -> tag from g_source_add_unix_fd() */
+	gint64 deadline;	/* monotonic time the timer expires, -1 if unset */
+} engine_source;
+
+static void source_socket(int fd, CARDDAV_POLL what, void* data) {
+	engine_source* s = (engine_source *) data;
+	gpointer tag = g_hash_table_lookup(s->fds, GINT_TO_POINTER(fd));
+	GIOCondition condition = 0;
+
+	if (what == CARDDAV_POLL_REMOVE) {
+		if (tag) {
+			g_source_remove_unix_fd(&s->source, tag);
+			g_hash_table_remove(s->fds, GINT_TO_POINTER(fd));
+		}
+		return;
+	}
+	if (what & CARDDAV_POLL_IN)
+		condition |= G_IO_IN;
+	if (what & CARDDAV_POLL_OUT)
+		condition |= G_IO_OUT;
+	if (tag)
+		g_source_modify_unix_fd(&s->source, tag, condition);
+	else
+		g_hash_table_insert(s->fds, GINT_TO_POINTER(fd),
+				g_source_add_unix_fd(&s->source, fd, condition));
+}
+
+static void source_timer(long timeout_ms, void* data) {
+	engine_source* s = (engine_source *) data;
+
+	s->deadline = (timeout_ms < 0) ?
+		-1 : g_get_monotonic_time() + (gint64) timeout_ms * 1000;
+	g_source_set_ready_time(&s->source, s->deadline);
+}
+
+/* Collect the sockets with activity; the table changes while acting */
+static void collect_ready(gpointer key, gpointer value, gpointer data) {
+	engine_source* s = ((gpointer *) data)[0];
+	GSList** ready = ((gpointer *) data)[1];
+	GIOCondition condition = g_source_query_unix_fd(&s->source, value);
+	int events = 0;
+
+	if (condition & G_IO_IN)
+		events |= CARDDAV_POLL_IN;
+	if (condition & G_IO_OUT)
+		events |= CARDDAV_POLL_OUT;
+	if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+		events |= CARDDAV_POLL_ERR;
+	if (events) {
+		*ready = g_slist_prepend(*ready, GINT_TO_POINTER(events));
+		*ready = g_slist_prepend(*ready, key);
+	}
+}
+
+static gboolean source_dispatch(GSource* source, GSourceFunc callback,
+		gpointer user_data) {
+	engine_source* s = (engine_source *) source;
+	GSList* ready = NULL;
+	GSList* item;
+	gpointer data[2];
+	gboolean expired = FALSE;
+
+	if (s->deadline >= 0 && g_source_get_time(source) >= s->deadline) {
+		/* The engine may arm the timer again while acting on it */
+		s->deadline = -1;
+		g_source_set_ready_time(source, -1);
+		expired = TRUE;
+	}
+	data[0] = s;
+	data[1] = &ready;
+	g_hash_table_foreach(s->fds, collect_ready, data);
+	for (item = ready; item && item->next; item = item->next->next)
+		carddav_engine_socket_action(s->engine,
+				GPOINTER_TO_INT(item->data),
+				GPOINTER_TO_INT(item->next->data));
+	g_slist_free(ready);
+	if (expired)
+		carddav_engine_socket_action(s->engine, CARDDAV_SOCKET_TIMEOUT, 0);
+	return G_SOURCE_CONTINUE;
+}
+
+static void source_finalize(GSource* source) {
+	engine_source* s = (engine_source *) source;
+
+	g_hash_table_destroy(s->fds);
+}
+
+static GSourceFuncs source_funcs = {
+	NULL,
+	NULL,
+	source_dispatch,
+	source_finalize,
+	NULL,
+	NULL
+};
+
+/* Called by carddav_engine_free() after the last callback */
+static void source_free(gpointer data) {
+	engine_source* s = (engine_source *) data;
+
+	g_source_destroy(&s->source);
+	g_source_unref(&s->source);
+}
+
+/**
+ * Function for creating an engine driven by a GMainContext. The engine
+ * attaches a source to the context which watches its sockets and
+ * timer, so operations advance and their callbacks are invoked while
+ * the context is iterated. Use the engine from the thread iterating the
+ * context only.
+ * @param context A GMainContext or NULL for the default context
+ * @return A new engine or NULL if libcurl could not be initialized. Free
+ * it with carddav_engine_free(), which also removes the source.
+ */
+carddav_engine* carddav_engine_new_with_context(GMainContext* context) {
+	engine_source* s;
+
+	s = (engine_source *) g_source_new(&source_funcs, sizeof(engine_source));
+	s->fds = g_hash_table_new(g_direct_hash, g_direct_equal);
+	s->deadline = -1;
+	s->engine = carddav_engine_new(source_socket, source_timer, s);
+	if (!s->engine) {
+		g_source_unref(&s->source);
+		return NULL;
+	}
+	async_set_free_func(s->engine, source_free);
+	g_source_set_name(&s->source, "carddav");
+	g_source_attach(&s->source, context);
+	return s->engine;
+}
@@ -0,0 +1,234 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-stats.h"
+#include <glib.h>
+#include <curl/curl.h>
+
+/* Position of each counter in a carddav_counters */
+enum {
+	STAT_REQUESTS,
+	STAT_RESPONSES = STAT_REQUESTS + CARDDAV_METHODS,
+	STAT_BYTES_SENT = STAT_RESPONSES + CARDDAV_STATUS_CLASSES,
+	STAT_BYTES_RECEIVED,
+	STAT_RETRIES,
+	STAT_LOCKS,
+	STAT_CONNECTIONS_NEW,
+	STAT_CONNECTIONS_REUSED,
+	STAT_PARSED,
+	STAT_PARSE_TIME,
+	STAT_COALESCED,
+	STAT_VALUES
+};
+
+/*
+ * Counters are machine words updated with atomic adds, so threads never
+ * wait for each other to count.
+ */
+struct _carddav_counters {
+	gsize values[STAT_VALUES];
+};
+
+static carddav_counters stats_global;
+
+static const gchar* const method_names[CARDDAV_METHODS] = {
+	"OPTIONS", "GET", "PUT", "DELETE", "PROPFIND", "REPORT", "LOCK", "UNLOCK"
+};
+
+static void stats_add(carddav_settings* settings, guint index, gsize n) {
+	if (n == 0)
+		return;
+	g_atomic_pointer_add(&stats_global.values[index], (gssize) n);
+	if (settings->counters)
+		g_atomic_pointer_add(&settings->counters->values[index], (gssize) n);
+}
+
+static void read_counters(carddav_counters* counters, carddav_stats* stats) {
+	unsigned long long v[STAT_VALUES];
+	int i;
+
+	for (i = 0; i < STAT_VALUES; i++)
+		v[i] = (gsize) g_atomic_pointer_get(&counters->values[i]);
+	for (i = 0; i < CARDDAV_METHODS; i++)
+		stats->requests[i] = v[STAT_REQUESTS + i];
+	for (i = 0; i < CARDDAV_STATUS_CLASSES; i++)
+		stats->responses[i] = v[STAT_RESPONSES + i];
+	stats->bytes_sent = v[STAT_BYTES_SENT];
+	stats->bytes_received = v[STAT_BYTES_RECEIVED];
+	stats->retries = v[STAT_RETRIES];
+	stats->locks = v[STAT_LOCKS];
+	stats->connections_new = v[STAT_CONNECTIONS_NEW];
+	stats->connections_reused = v[STAT_CONNECTIONS_REUSED];
+	stats->parsed = v[STAT_PARSED];
+	stats->parse_time_us = v[STAT_PARSE_TIME];
+	stats->coalesced = v[STAT_COALESCED];
+}
+
+/**
+ * Set the method of a request and remember it for the counters.
+ * @param curl The transfer
+ * @param settings @see carddav_settings
+ * @param method @see CARDDAV_METHOD
+ */
+void set_request_method(CURL* curl, carddav_settings* settings,
+		CARDDAV_METHOD method) {
+	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method_names[method]);
+	settings->method = method;
+}
+
+/**
+ * Count a finished transfer: its method, outcome, bytes and whether it
+ * needed a new connection.
+ * @param curl The transfer
+ * @param settings @see carddav_settings
+ * @param res Result of the transfer
+ */
+void stats_transfer(CURL* curl, carddav_settings* settings, CURLcode res) {
+	long code = 0;
+	long connects = 0;
+	long request_size = 0;
+	long header_size = 0;
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t uploaded = 0;
+	curl_off_t downloaded = 0;
+
+	curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+#else
+	double uploaded = 0;
+	double downloaded = 0;
+
+	curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &uploaded);
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &downloaded);
+#endif
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+	curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &request_size);
+	curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &header_size);
+
+	stats_add(settings, STAT_REQUESTS + settings->method, 1);
+	if (res != CURLE_OK && code == 0)
+		stats_add(settings, STAT_RESPONSES, 1);
+	else if (code >= 100 && code < 600)
+		stats_add(settings, STAT_RESPONSES + code / 100, 1);
+	stats_add(settings, STAT_BYTES_SENT, (gsize) request_size + (gsize) uploaded);
+	stats_add(settings, STAT_BYTES_RECEIVED,
+			(gsize) header_size + (gsize) downloaded);
+	if (connects > 0)
+		stats_add(settings, STAT_CONNECTIONS_NEW, (gsize) connects);
+	else if (code != 0)
+		stats_add(settings, STAT_CONNECTIONS_REUSED, 1);
+}
+
+/**
+ * Count a request which is repeated.
+ * @param settings @see carddav_settings
+ */
+void stats_retry(carddav_settings* settings) {
+	stats_add(settings, STAT_RETRIES, 1);
+}
+
+/**
+ * Count a lock acquired on a card.
+ * @param settings @see carddav_settings
+ */
+void stats_lock(carddav_settings* settings) {
+	stats_add(settings, STAT_LOCKS, 1);
+}
+
+/**
+ * Count parsed multistatus response elements.
+ * @param settings @see carddav_settings
+ * @param parsed Number of elements
+ * @param time_us Microseconds spent
+ */
+void stats_parse(carddav_settings* settings, guint parsed, gint64 time_us) {
+	stats_add(settings, STAT_PARSED, parsed);
+	if (time_us > 0)
+		stats_add(settings, STAT_PARSE_TIME, (gsize) time_us);
+}
+
+/**
+ * Count an operation which shared the outcome of an identical one.
+ * @param settings @see carddav_settings
+ */
+void stats_coalesced(carddav_settings* settings) {
+	stats_add(settings, STAT_COALESCED, 1);
+}
+
+/**
+ * Function for getting the request counters of the whole process,
+ * counted since it started or since carddav_reset_stats().
+ * @param stats Filled with the counters. @see carddav_stats
+ */
+void carddav_get_stats(carddav_stats* stats) {
+	g_return_if_fail(stats != NULL);
+
+	read_counters(&stats_global, stats);
+}
+
+/**
+ * Function for clearing the request counters of the whole process.
+ */
+void carddav_reset_stats(void) {
+	int i;
+
+	for (i = 0; i < STAT_VALUES; i++)
+		g_atomic_pointer_and(&stats_global.values[i], 0);
+}
+
+/**
+ * Function for creating a set of counters for a session. Operations
+ * whose runtime_info options point to it count their requests there as
+ * well as in the process wide counters. It may be shared by any number
+ * of threads.
+ * @return New counters, all zero. Free them with carddav_counters_free().
+ */
+carddav_counters* carddav_counters_new(void) {
+	return g_new0(carddav_counters, 1);
+}
+
+/**
+ * Function for freeing a set of counters. No operation may use it any
+ * longer.
+ * @param counters Address to a pointer to counters
+ */
+void carddav_counters_free(carddav_counters** counters) {
+	g_return_if_fail(counters != NULL);
+
+	g_free(*counters);
+	*counters = NULL;
+}
+
+/**
+ * Function for reading a set of counters.
+ * @param counters Counters. @see carddav_counters_new()
+ * @param stats Filled with the counters. @see carddav_stats
+ */
+void carddav_counters_get(carddav_counters* counters, carddav_stats* stats) {
+	g_return_if_fail(counters != NULL);
+	g_return_if_fail(stats != NULL);
+
+	read_counters(counters, stats);
+}
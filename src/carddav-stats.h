@@ -0,0 +1,73 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_STATS_H__
+#define __CARDDAV_STATS_H__
+
+#include <glib.h>
+#include <curl/curl.h>
+#include "carddav.h"
+#include "carddav-utils.h"
+
+/**
+ * Set the method of a request and remember it for the counters.
+ * @param curl The transfer
+ * @param settings @see carddav_settings
+ * @param method @see CARDDAV_METHOD
+ */
+void set_request_method(CURL* curl, carddav_settings* settings,
+		CARDDAV_METHOD method);
+
+/**
+ * Count a finished transfer: its method, outcome, bytes and whether it
+ * needed a new connection.
+ * @param curl The transfer
+ * @param settings @see carddav_settings
+ * @param res Result of the transfer
+ */
+void stats_transfer(CURL* curl, carddav_settings* settings, CURLcode res);
+
+/**
+ * Count a request which is repeated.
+ * @param settings @see carddav_settings
+ */
+void stats_retry(carddav_settings* settings);
+
+/**
+ * Count a lock acquired on a card.
+ * @param settings @see carddav_settings
+ */
+void stats_lock(carddav_settings* settings);
+
+/**
+ * Count parsed multistatus response elements.
+ * @param settings @see carddav_settings
+ * @param parsed Number of elements
+ * @param time_us Microseconds spent
+ */
+void stats_parse(carddav_settings* settings, guint parsed, gint64 time_us);
+
+/**
+ * Count an operation which shared the outcome of an identical one.
+ * @param settings @see carddav_settings
+ */
+void stats_coalesced(carddav_settings* settings);
+
+#endif
@@ -23,6 +23,14 @@
 #endif
 
 #include "carddav-utils.h"
+#include "carddav-alloc.h"
+#include "carddav-async.h"
+#include "carddav-cancel.h"
+#include "carddav-stats.h"
+#include "carddav-limit.h"
+#include "carddav-retry.h"
+#include "dav-keywords.h"
+#include "carddav-vcard.h"
 #include "md5.h"
 #include <glib.h>
 #include <stdio.h>
@@ -30,6 +38,8 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
 #include <curl/curl.h>
 #include <ctype.h>
 
@@ -122,20 +132,235 @@ int my_trace(CURL* handle, curl_infotype type, char* data, size_t size, void* us
 	return 0;
 }
 
+/* Smallest buffer allocated for a MemoryStruct */
+#define MEMORY_STRUCT_MIN 256
+
+/* Receive buffers kept per thread, enough for nested lock requests */
+#define BUFFER_POOL_SIZE 8
+
+/* Buffers larger than this are freed rather than kept */
+#define BUFFER_POOL_MAX (256 * 1024)
+
+/* Total bytes of buffers kept per thread */
+#define BUFFER_POOL_RETAIN (1024 * 1024)
+
+/*
+ * Receive buffers released by free_memory_struct() are kept here,
+ * already grown, for the next MemoryStruct of the same thread.
+ */
+typedef struct {
+	char* memory[BUFFER_POOL_SIZE];
+	size_t alloc[BUFFER_POOL_SIZE];
+	guint count;
+	size_t retained;
+} buffer_pool;
+
+static void free_buffer_pool(gpointer data) {
+	buffer_pool* pool = (buffer_pool *) data;
+
+	while (pool->count > 0) {
+		pool->count--;
+		alloc_free(CARDDAV_MEM_RECEIVE,
+				pool->memory[pool->count], pool->alloc[pool->count]);
+	}
+	g_free(pool);
+}
+
+static GPrivate buffer_pool_key = G_PRIVATE_INIT(free_buffer_pool);
+
 /**
- * This function is burrowed from the libcurl documentation
- * @param ptr
- * @param size
- * @return void* to memory region
- */
-static void* myrealloc(void* ptr, size_t size) {
-/* There might be a realloc() out there that doesn't like reallocing
- * NULL pointers, so we take care of it here
- * */
-	if(ptr)
-		return realloc(ptr, size);
+ * Give an empty MemoryStruct the most recently pooled buffer.
+ * @param mem @see MemoryStruct
+ */
+static void take_pooled_buffer(struct MemoryStruct* mem) {
+	buffer_pool* pool = g_private_get(&buffer_pool_key);
+
+	if (!pool || pool->count == 0)
+		return;
+	pool->count--;
+	mem->memory = pool->memory[pool->count];
+	mem->alloc = pool->alloc[pool->count];
+	mem->memory[0] = 0;
+	pool->retained -= mem->alloc;
+}
+
+/**
+ * Keep the buffer of a MemoryStruct for reuse, or free it if the pool
+ * of this thread is full.
+ * @param mem @see MemoryStruct
+ */
+static void release_pooled_buffer(struct MemoryStruct* mem) {
+	buffer_pool* pool = g_private_get(&buffer_pool_key);
+
+	if (!pool) {
+		pool = g_new0(buffer_pool, 1);
+		g_private_set(&buffer_pool_key, pool);
+	}
+	if (pool->count < BUFFER_POOL_SIZE && mem->alloc <= BUFFER_POOL_MAX &&
+			pool->retained + mem->alloc <= BUFFER_POOL_RETAIN) {
+		pool->memory[pool->count] = mem->memory;
+		pool->alloc[pool->count] = mem->alloc;
+		pool->count++;
+		pool->retained += mem->alloc;
+	}
 	else
-		return malloc(size);
+		alloc_free(CARDDAV_MEM_RECEIVE, mem->memory, mem->alloc);
+}
+
+/**
+ * Make room for at least needed bytes in a MemoryStruct. The buffer is
+ * doubled so appending n bytes costs O(n) copies in total.
+ * @param mem @see MemoryStruct
+ * @param needed Number of bytes required, including the terminating NUL
+ * @param exact Allocate exactly needed bytes instead of doubling
+ * @return FALSE if the limit of mem would be exceeded or out of memory
+ */
+static gboolean grow_memory_struct(
+		struct MemoryStruct* mem, size_t needed, gboolean exact) {
+	size_t alloc;
+	char* memory;
+
+	if (!mem->memory)
+		take_pooled_buffer(mem);
+	if (needed <= mem->alloc)
+		return TRUE;
+	if (mem->max_size && needed > mem->max_size + 1)
+		return FALSE;
+	alloc = (mem->alloc) ? mem->alloc : MEMORY_STRUCT_MIN;
+	if (exact)
+		alloc = needed;
+	while (alloc < needed)
+		alloc = (alloc > G_MAXSIZE / 2) ? needed : alloc * 2;
+	if (mem->max_size && alloc > mem->max_size + 1)
+		alloc = mem->max_size + 1;
+	memory = alloc_realloc(CARDDAV_MEM_RECEIVE, mem->memory, mem->alloc, alloc);
+	if (!memory)
+		return FALSE;
+	mem->memory = memory;
+	mem->alloc = alloc;
+	return TRUE;
+}
+
+/**
+ * Write all of a buffer to a file descriptor.
+ * @param fd The file
+ * @param ptr The data
+ * @param len Number of bytes in ptr
+ * @return TRUE on success, FALSE on a write error
+ */
+static gboolean write_all(int fd, const void* ptr, size_t len) {
+	const char* data = ptr;
+
+	while (len > 0) {
+		ssize_t written = write(fd, data, len);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		data += written;
+		len -= (size_t) written;
+	}
+	return TRUE;
+}
+
+/**
+ * Move the body received so far to an unlinked temporary file. The file
+ * disappears by itself when it is closed, even if the process dies.
+ * @param mem @see MemoryStruct
+ * @return TRUE on success, FALSE if no file could be created
+ */
+static gboolean spill_memory_struct(struct MemoryStruct* mem) {
+	gchar* name = NULL;
+	int fd = g_file_open_tmp("libcarddav-XXXXXX", &name, NULL);
+
+	if (fd < 0)
+		return FALSE;
+	unlink(name);
+	g_free(name);
+	if (mem->size > 0 && !write_all(fd, mem->memory, mem->size)) {
+		close(fd);
+		return FALSE;
+	}
+	if (mem->memory)
+		release_pooled_buffer(mem);
+	mem->memory = NULL;
+	mem->alloc = 0;
+	mem->fd = fd;
+	return TRUE;
+}
+
+/**
+ * Drop the mapping of a spilled body so more data can be appended
+ * to its file.
+ * @param mem @see MemoryStruct
+ */
+static void unmap_memory_struct(struct MemoryStruct* mem) {
+	if (mem->mapped) {
+		munmap(mem->memory, mem->size + 1);
+		mem->memory = NULL;
+		mem->mapped = FALSE;
+	}
+}
+
+/**
+ * Append bytes to a MemoryStruct and keep it NUL terminated.
+ * @param mem @see MemoryStruct
+ * @param ptr Bytes to append
+ * @param len Number of bytes
+ * @return len, or 0 if the bytes could not be stored
+ */
+static size_t append_memory_struct(
+		struct MemoryStruct* mem, const void* ptr, size_t len) {
+	if (len > G_MAXSIZE - mem->size - 1)
+		return 0;
+	if (mem->fd < 0 && mem->spill_size && mem->size + len > mem->spill_size) {
+		if (mem->max_size && mem->size + len > mem->max_size)
+			return 0;
+		if (!spill_memory_struct(mem))
+			return 0;
+	}
+	if (mem->fd >= 0) {
+		if (mem->max_size && mem->size + len > mem->max_size)
+			return 0;
+		unmap_memory_struct(mem);
+		/* overwrite the terminating NUL of an earlier mapping */
+		if (lseek(mem->fd, (off_t) mem->size, SEEK_SET) < 0 ||
+				!write_all(mem->fd, ptr, len))
+			return 0;
+		mem->size += len;
+		return len;
+	}
+	if (!grow_memory_struct(mem, mem->size + len + 1, FALSE))
+		return 0;
+	memcpy(&(mem->memory[mem->size]), ptr, len);
+	mem->size += len;
+	mem->memory[mem->size] = 0;
+	return len;
+}
+
+/**
+ * Content-Length of the response being received.
+ * @param curl The handle performing the request
+ * @return The length or -1 if it is unknown
+ */
+static gint64 content_length(CURL* curl) {
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t length = -1;
+
+	if (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+				&length) != CURLE_OK)
+		return -1;
+	return (gint64) length;
+#else
+	double length = -1;
+
+	if (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD,
+				&length) != CURLE_OK)
+		return -1;
+	return (gint64) length;
+#endif
 }
 
 /**
@@ -149,14 +374,100 @@ static void* myrealloc(void* ptr, size_t size) {
 size_t WriteMemoryCallback(void* ptr, size_t size, size_t nmemb, void* data) {
 	size_t realsize = size * nmemb;
 	struct MemoryStruct* mem = (struct MemoryStruct *)data;
-	mem->memory = (char *)myrealloc(mem->memory, mem->size + realsize + 1);
 
-	if (mem->memory) {
-		memcpy(&(mem->memory[mem->size]), ptr, realsize);
-		mem->size += realsize;
-		mem->memory[mem->size] = 0;
+	if (mem->size == 0 && mem->curl) {
+		/* first bytes of a response, make room for all of it at once */
+		gint64 length = content_length(mem->curl);
+
+		if (length > 0 &&
+				(!mem->spill_size || (guint64) length <= mem->spill_size) &&
+				!grow_memory_struct(mem, (size_t) length + 1, TRUE))
+			return 0;
+	}
+	return append_memory_struct(mem, ptr, realsize);
+}
+
+static void free_header_value(gpointer value) {
+	g_string_free((GString *) value, TRUE);
+}
+
+/**
+ * Add one header line to the header index. libcurl hands over complete
+ * lines, one per call. A status line starts a new response, which happens
+ * on redirects and authentication retries, so the index is cleared and
+ * only the headers of the final response remain. Lines starting with
+ * white space continue the previous header.
+ * @param mem @see MemoryStruct
+ * @param line Header line including line terminator
+ * @param len Length of line
+ */
+static void index_header_line(
+		struct MemoryStruct* mem, const gchar* line, gsize len) {
+	const gchar* colon;
+	const gchar* value;
+	const gchar* end = line + len;
+	gchar* name;
+	GString* entry;
+
+	while (end > line && (end[-1] == '\r' || end[-1] == '\n'))
+		end--;
+	if (end == line)
+		return;
+	if (end - line >= 5 && strncmp(line, "HTTP/", 5) == 0) {
+		if (mem->index)
+			g_hash_table_destroy(mem->index);
+		mem->index = NULL;
+		mem->last = NULL;
+		return;
+	}
+	if (! mem->index)
+		mem->index = g_hash_table_new_full(ascii_case_hash,
+				ascii_case_equal, g_free, free_header_value);
+	if (*line == ' ' || *line == '\t') {
+		if (! mem->last)
+			return;
+		while (line < end && (*line == ' ' || *line == '\t'))
+			line++;
+		while (end > line && (end[-1] == ' ' || end[-1] == '\t'))
+			end--;
+		entry = g_hash_table_lookup(mem->index, mem->last);
+		if (entry && line < end) {
+			if (entry->len > 0)
+				g_string_append_c(entry, ' ');
+			g_string_append_len(entry, line, end - line);
+		}
+		return;
+	}
+
+	colon = memchr(line, ':', end - line);
+	if (! colon)
+		return;
+	value = colon + 1;
+	while (colon > line && (colon[-1] == ' ' || colon[-1] == '\t'))
+		colon--;
+	if (colon == line)
+		return;
+	while (value < end && (*value == ' ' || *value == '\t'))
+		value++;
+	while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+
+	name = g_strndup(line, colon - line);
+	if (g_hash_table_lookup_extended(mem->index, name,
+				(gpointer *) &mem->last, (gpointer *) &entry)) {
+		/* Repeated header fields combine into a comma separated list */
+		g_free(name);
+		if (value < end) {
+			if (entry->len > 0)
+				g_string_append(entry, ", ");
+			g_string_append_len(entry, value, end - value);
+		}
+	}
+	else {
+		entry = g_string_new_len(value, end - value);
+		g_hash_table_insert(mem->index, name, entry);
+		mem->last = name;
 	}
-	return realsize;
 }
 
 /**
@@ -170,13 +481,10 @@ size_t WriteMemoryCallback(void* ptr, size_t size, size_t nmemb, void* data) {
 size_t WriteHeaderCallback(void* ptr, size_t size, size_t nmemb, void* data) {
 	size_t realsize = size * nmemb;
 	struct MemoryStruct* mem = (struct MemoryStruct *)data;
-	mem->memory = (char *)myrealloc(mem->memory, mem->size + realsize + 1);
 
-	if (mem->memory) {
-		memcpy(&(mem->memory[mem->size]), ptr, realsize);
-		mem->size += realsize;
-		mem->memory[mem->size] = 0;
-	}
+	if (append_memory_struct(mem, ptr, realsize) != realsize)
+		return 0;
+	index_header_line(mem, (const gchar *) ptr, realsize);
 	return realsize;
 }
 
@@ -194,10 +502,12 @@ size_t ReadMemoryCallback(void* ptr, size_t size, size_t nmemb, void* data){
  * @param settings @see carddav_settings
  */
 void init_carddav_settings(carddav_settings* settings) {
+	alloc_begin();
 	settings->username = NULL;
 	settings->password = NULL;
 	settings->url = NULL;
 	settings->file = NULL;
+	settings->file_owner = NULL;
 	settings->usehttps = FALSE;
 	settings->custom_cacert = NULL;
 	settings->verify_ssl_certificate = TRUE;
@@ -206,6 +516,24 @@ void init_carddav_settings(carddav_settings* settings) {
 	settings->ACTION = UNKNOWN;
 	settings->start = 0;
 	settings->end = 0;
+	settings->use_uri = 0;
+	settings->card_func = NULL;
+	settings->card_data = NULL;
+	settings->object = NULL;
+	settings->object_len = 0;
+	settings->write_func = NULL;
+	settings->write_data = NULL;
+	settings->max_response_size = 0;
+	settings->max_memory_size = 0;
+	settings->deadline = 0;
+	settings->cancel = NULL;
+	settings->counters = NULL;
+	settings->limiter = NULL;
+	settings->max_retries = 0;
+	settings->retry_base_ms = 0;
+	settings->retry_max_ms = 0;
+	settings->method = CARDDAV_METHOD_GET;
+	settings->arena = arena_acquire();
 }
 
 /**
@@ -213,6 +541,8 @@ void init_carddav_settings(carddav_settings* settings) {
  * @param settings @see carddav_settings
  */
 void free_carddav_settings(carddav_settings* settings) {
+	CARDDAV_ACTION action = settings->ACTION;
+
 	if (settings->username) {
 		g_free(settings->username);
 		settings->username = NULL;
@@ -225,10 +555,9 @@ void free_carddav_settings(carddav_settings* settings) {
 		g_free(settings->url);
 		settings->url = NULL;
 	}
-	if (settings->file) {
-		g_free(settings->file);
-		settings->file = NULL;
-	}
+	release_text(settings->file, settings->file_owner);
+	settings->file = NULL;
+	settings->file_owner = NULL;
 	if (settings->custom_cacert) {
 		g_free(settings->custom_cacert);
 		settings->custom_cacert = NULL;
@@ -240,6 +569,18 @@ void free_carddav_settings(carddav_settings* settings) {
 	settings->ACTION = UNKNOWN;
 	settings->start = 0;
 	settings->end = 0;
+	settings->use_uri = 0;
+	settings->card_func = NULL;
+	settings->card_data = NULL;
+	settings->object = NULL;
+	settings->object_len = 0;
+	settings->write_func = NULL;
+	settings->write_data = NULL;
+	settings->max_response_size = 0;
+	settings->max_memory_size = 0;
+	arena_release(settings->arena);
+	settings->arena = NULL;
+	alloc_end(action);
 }
 
 static gchar* place_after_hostname(const gchar* start, const gchar* stop) {
@@ -338,365 +679,879 @@ void parse_url(carddav_settings* settings, const char* url) {
 }
 
 /**
- * Find a specific HTTP header from last request
- * @param header HTTP header to search for
- * @param headers String of HTTP headers from last request
- * @param lowcase Should string be returned in all lower case.
- * @return The header found or NULL
- */
-#define MAX_TOKENS 2
-gchar* get_response_header(
-		const char* header, gchar* headers, gboolean lowcase) {
-	gchar* line;
-	gchar* head = NULL;
-	gchar* oldhead = NULL;
-	gchar** buf;
-	gchar* header_list;
-	gchar* saveptr;
-
-	header_list = g_strdup(headers);
-	line = strtok_r(header_list, "\r\n", &saveptr);
-	if (line != NULL) {
-		do  {
-			buf = g_strsplit(line, ":", MAX_TOKENS);
-			if (buf[1] != NULL) {
-				if (g_ascii_strcasecmp(buf[0], header) == 0) {
-					if (head) {
-						oldhead = head;
-						head = g_strconcat(head, buf[1], NULL);
-						g_free(oldhead);
-					}
-					else
-						head = g_strdup(buf[1]);
-					if (head)
-						g_strstrip(head);
-				}
-			}
-			g_strfreev(buf);
-		} while ((line = strtok_r(NULL, "\r\n", &saveptr)) != NULL);
+ * Initialize a MemoryStruct before handing it to libcurl.
+ * @param mem @see MemoryStruct
+ */
+void init_memory_struct(struct MemoryStruct* mem) {
+	mem->memory = NULL; /* we expect realloc(NULL, size) to work */
+	mem->size = 0;    /* no data at this point */
+	mem->alloc = 0;
+	mem->max_size = 0;
+	mem->spill_size = 0;
+	mem->fd = -1;
+	mem->mapped = FALSE;
+	mem->curl = NULL;
+	mem->index = NULL;
+	mem->last = NULL;
+}
+
+/**
+ * Free memory assigned to a MemoryStruct. The buffer is kept for the
+ * next MemoryStruct of the calling thread when the pool has room.
+ * @param mem @see MemoryStruct
+ */
+void free_memory_struct(struct MemoryStruct* mem) {
+	if (mem->fd >= 0) {
+		unmap_memory_struct(mem);
+		close(mem->fd);
 	}
-	g_free(header_list);
-	if (head)
-		return (lowcase) ? g_ascii_strdown(head, -1) : head;
-	else
+	else if (mem->memory)
+		release_pooled_buffer(mem);
+	if (mem->index)
+		g_hash_table_destroy(mem->index);
+	init_memory_struct(mem);
+}
+
+/**
+ * Drop data appended to a MemoryStruct after it held size bytes, so a
+ * repeated request leaves only its own response behind.
+ * @param mem @see MemoryStruct
+ * @param size Earlier size of mem
+ * @return FALSE if the data could not be dropped
+ */
+gboolean truncate_memory_struct(struct MemoryStruct* mem, size_t size) {
+	if (mem->size == size)
+		return TRUE;
+	if (mem->fd >= 0) {
+		unmap_memory_struct(mem);
+		if (ftruncate(mem->fd, (off_t) size) < 0)
+			return FALSE;
+	} else if (mem->memory) {
+		mem->memory[size] = 0;
+	}
+	mem->size = size;
+	return TRUE;
+}
+
+/**
+ * Make the body of a MemoryStruct which was spilled to disk available
+ * as a NUL terminated string in memory by mapping its file. Does nothing
+ * if the body never left the heap. Call it after perform_curl()
+ * before looking at mem->memory.
+ * @param mem @see MemoryStruct
+ * @param error_buf Receives a message on failure, CURL_ERROR_SIZE bytes
+ * @return FALSE if the file could not be mapped. mem->memory is NULL then
+ */
+gboolean map_memory_struct(struct MemoryStruct* mem, char* error_buf) {
+	static const char nul = 0;
+	void* map;
+
+	if (mem->fd < 0 || mem->mapped)
+		return TRUE;
+	if (lseek(mem->fd, (off_t) mem->size, SEEK_SET) < 0 ||
+			!write_all(mem->fd, &nul, 1)) {
+		g_strlcpy(error_buf, "Could not write spilled response",
+				CURL_ERROR_SIZE);
+		return FALSE;
+	}
+	/* private and writable, parsers may terminate strings in place */
+	map = mmap(NULL, mem->size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			mem->fd, 0);
+	if (map == MAP_FAILED) {
+		g_strlcpy(error_buf, "Could not map spilled response",
+				CURL_ERROR_SIZE);
+		return FALSE;
+	}
+	mem->memory = map;
+	mem->mapped = TRUE;
+	return TRUE;
+}
+
+/**
+ * Let libcurl store the body and the headers of responses in MemoryStructs.
+ * The body is presized from Content-Length when the server sends one and
+ * both are limited to settings->max_response_size bytes if it is set.
+ * Bodies beyond settings->max_memory_size bytes are spilled to disk.
+ * @param curl The handle performing the request
+ * @param settings @see carddav_settings
+ * @param chunk Receives the body. If NULL the write function is left alone
+ * @param headers Receives the headers
+ */
+void set_memory_callbacks(CURL* curl, carddav_settings* settings,
+		struct MemoryStruct* chunk, struct MemoryStruct* headers) {
+	if (chunk) {
+		chunk->curl = curl;
+		chunk->max_size = settings->max_response_size;
+		chunk->spill_size = settings->max_memory_size;
+		/* send all data to this function  */
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+		/* we pass our 'chunk' struct to the callback function */
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
+	}
+	headers->max_size = settings->max_response_size;
+	/* send all data to this function  */
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
+	/* we pass our 'headers' struct to the callback function */
+	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)headers);
+}
+
+/**
+ * Find a specific HTTP header from last request. Repeated headers are
+ * returned as one comma separated value and folded lines are joined.
+ * @param headers Headers collected by WriteHeaderCallback
+ * @param header HTTP header to search for, case insensitive
+ * @return The header value or NULL. Owned by headers, do not free.
+ */
+const gchar* get_response_header(
+		struct MemoryStruct* headers, const char* header) {
+	GString* value;
+
+	if (! headers->index)
 		return NULL;
+	value = g_hash_table_lookup(headers->index, header);
+	return (value) ? value->str : NULL;
 }
 
-// static const char* VCAL_HEAD =
-// "BEGIN:VCALENDAR\r\n"
-// "PRODID:-//CardDAV Calendar//NONSGML libcarddav//EN\r\n"
-// "VERSION:2.0\r\n";
-// static const char* VCAL_FOOT = "END:VCALENDAR";
+/**
+ * Case insensitive string hash for ASCII keys. Use with ascii_case_equal.
+ * @param key NUL terminated string
+ * @return hash value
+ */
+guint ascii_case_hash(gconstpointer key) {
+	const gchar* p = key;
+	guint32 h = 5381;
+
+	for (; *p; p++)
+		h = (h << 5) + h + g_ascii_tolower(*p);
+	return h;
+}
 
-static const char* VCAL_HEAD = "";
-static const char* VCAL_FOOT = "";
+/**
+ * Case insensitive string comparison for ASCII keys.
+ * @param a NUL terminated string
+ * @param b NUL terminated string
+ * @return TRUE if the strings are equal ignoring case
+ */
+gboolean ascii_case_equal(gconstpointer a, gconstpointer b) {
+	return g_ascii_strcasecmp(a, b) == 0;
+}
 
 /**
- * Parse response from CardDAV server. Internal function.
- * @param report Response from server
- * @param element XML element to find
- * @param type VCalendar element to find
- * @param wrap Is this the final parsing or just a part
- * @param recursive Stop after first match or not
- * @return the parsed result
+ * Decode XML character data in place. Entity and character references
+ * are replaced by the characters they stand for and CDATA sections are
+ * unwrapped. Decoded text is never longer than its encoding, so the
+ * transformation is done in one pass without allocating.
+ * @param text Start of the character data
+ * @param len Length of the character data
+ * @return Length of the decoded text
  */
-static gchar* parse_carddav_report_wrap(
-		char* report, const char* element, const char* type,
-			gboolean wrap, gboolean recursive) {
-	char* pos;
-	char* start;
-	char* object;
-	char* tmp_report;
-	char* tmp;
-	gchar* response;
-	gchar* begin_type;
-	gchar* end_type;
-	gboolean keep_going = TRUE;
-
-	begin_type = g_strdup_printf("BEGIN:%s", type);
-	end_type = g_strdup_printf("END:%s", type);
-	pos = start = object = response = NULL;
-	tmp_report = g_strdup(report);
-	while ((pos = strstr(tmp_report, element)) != NULL && keep_going) {
-		gchar* url = NULL;
-		url = get_url(tmp_report);
-		if (!url) {
-			url = g_strdup_printf("none");
-		}
-		pos = strchr(pos, '>');
-		if (!pos) {
-			break;
-		}
-		pos = &(*(pos + 1));
-		pos = strstr(pos, begin_type);
-		if (!pos) {
-			break;
+gsize decode_xml_text(gchar* text, gsize len) {
+	gchar* in = text;
+	gchar* out = text;
+	gchar* end = text + len;
+	gchar* stop;
+
+	while (in < end) {
+		if (*in == '<' && end - in >= 12 && strncmp(in, "<![CDATA[", 9) == 0) {
+			in += 9;
+			stop = g_strstr_len(in, end - in, "]]>");
+			if (!stop)
+				stop = end;
+			memmove(out, in, stop - in);
+			out += stop - in;
+			in = (stop < end) ? stop + 3 : end;
+			continue;
 		}
-		object = &(*(pos + strlen(begin_type)));
-		object = g_strchug(object);
-		start = g_strdup(object);
-		if ((pos = strstr(start, end_type)) == NULL) {
-			g_free(start);
-			break;
+		if (*in != '&' || (stop = memchr(in, ';', MIN(end - in, 12))) == NULL) {
+			*out++ = *in++;
+			continue;
 		}
-		object = g_strndup(start, strlen(start) - strlen(pos));
-		if (response) {
-			tmp = g_strdup(response);
-			g_free(response);
-			response = g_strdup_printf("%s%s\r\n%sURI:%s\r\n%s\r\n",
-				tmp, begin_type, object, url, end_type);
-			g_free(tmp);
+		if (in[1] == '#') {
+			gunichar c = 0;
+			gchar* p = in + 2;
+			gboolean hex = (*p == 'x' || *p == 'X');
+
+			if (hex)
+				p++;
+			for (; p < stop; p++) {
+				if (hex && g_ascii_isxdigit(*p))
+					c = c * 16 + g_ascii_xdigit_value(*p);
+				else if (!hex && g_ascii_isdigit(*p))
+					c = c * 10 + g_ascii_digit_value(*p);
+				else
+					break;
+			}
+			if (p == stop && c > 0 && c <= 0x10FFFF) {
+				out += g_unichar_to_utf8(c, out);
+				in = stop + 1;
+				continue;
+			}
 		}
-		else {
-			if (wrap)
-				response = g_strdup_printf("%s%s\r\n%sURI:%s\r\n%s\r\n",
-					VCAL_HEAD, begin_type, object, url, end_type);
-			else
-				response = g_strdup_printf("%s\r\n%sURI:%s\r\n%s\r\n",
-					begin_type, object, url, end_type);
+		else if (stop - in == 3 && strncmp(in, "&lt", 3) == 0) {
+			*out++ = '<';
+			in = stop + 1;
+			continue;
 		}
-		if (url) {
-			g_free(url);
+		else if (stop - in == 3 && strncmp(in, "&gt", 3) == 0) {
+			*out++ = '>';
+			in = stop + 1;
+			continue;
 		}
-		if (recursive) {
-			pos = strchr(pos, '>');
-			g_free(tmp_report);
-			tmp_report = g_strdup(&(*(pos + 1)));
+		else if (stop - in == 4 && strncmp(in, "&amp", 4) == 0) {
+			*out++ = '&';
+			in = stop + 1;
+			continue;
 		}
-		else {
-			keep_going = FALSE;
+		else if (stop - in == 5 && strncmp(in, "&quot", 5) == 0) {
+			*out++ = '"';
+			in = stop + 1;
+			continue;
 		}
-		g_free(start);
-		g_free(object);
-	}
-	g_free(tmp_report);
-	g_free(begin_type);
-	g_free(end_type);
-	if (wrap)
-		if (response) {
-			object = g_strdup(response);
-			g_free(response);
-			response = g_strdup_printf("%s%s", object, VCAL_FOOT);
-			g_free(object);
+		else if (stop - in == 5 && strncmp(in, "&apos", 5) == 0) {
+			*out++ = '\'';
+			in = stop + 1;
+			continue;
 		}
-	return response;
+		/* unknown reference, keep it as it is */
+		*out++ = *in++;
+	}
+	return out - text;
 }
 
 /**
- * Parse response from CardDAV server
- * @param report Response from server
- * @param element XML element to find
- * @param type VCalendar element to find
- * @return the parsed result
+ * Find the end tag of an element in text which may still grow. CDATA
+ * sections are skipped, so the content may contain anything.
+ * @param content Where to start searching, at the top level of the
+ * element's content or, when in_cdata is set, inside a CDATA section
+ * @param element Local name of the element
+ * @param resume When the end tag is not found, set to where a search of
+ * the same text with more appended may start
+ * @param in_cdata Whether content, and when the end tag is not found
+ * resume, lies inside a CDATA section
+ * @return Start of the end tag or NULL
  */
-gchar* parse_carddav_report(char* report, const char* element, const char* type) {
-	gchar* response = NULL;
-	gchar* timezone = NULL;
-	gchar* temp = NULL;
+static gchar* scan_end_tag(gchar* content, const char* element,
+		gchar** resume, gboolean* in_cdata) {
+	gsize len = strlen(element);
+	gchar* pos = content;
+	gchar* name;
+	gchar* end;
+	gsize left;
 
-	if (!report || !element || !type)
-		return NULL;
-	/* test for VTIMEZONE.
-	 * Only the first found will be used and this will then
-	 * be the time zone for the entire report
-	 */
-	timezone = parse_carddav_report_wrap(
-			report, element, "VTIMEZONE", FALSE, FALSE);
-	if (timezone) {
-			response = g_strdup_printf("%s%s", VCAL_HEAD, timezone);
-			g_free(timezone);
-			temp = parse_carddav_report_wrap(report, element, type, FALSE, TRUE);
-			if (temp) {
-				gchar* tmp = g_strdup(response);
-				g_free(response);
-				response = g_strdup_printf("%s%s%s", tmp, temp, VCAL_FOOT);
-				g_free(tmp);
-				g_free(temp);
+	if (*in_cdata) {
+		if ((end = strstr(pos, "]]>")) == NULL) {
+			/* the terminator may be split when more arrives */
+			left = strlen(pos);
+			*resume = pos + (left > 2 ? left - 2 : 0);
+			return NULL;
+		}
+		*in_cdata = FALSE;
+		pos = end + 3;
+	}
+	while ((pos = strchr(pos, '<')) != NULL) {
+		left = strnlen(pos, 9);
+		if (strncmp(pos, "<![CDATA[", left) == 0) {
+			if (left < 9) {
+				/* too short to tell yet */
+				*resume = pos;
+				return NULL;
 			}
-			else {
-				g_free(response);
+			if ((end = strstr(pos + 9, "]]>")) == NULL) {
+				*in_cdata = TRUE;
+				return scan_end_tag(pos + 9, element, resume, in_cdata);
+			}
+			pos = end + 3;
+			continue;
+		}
+		if (pos[1] == '/') {
+			name = pos + 2;
+			end = name + strcspn(name, " \t\r\n>");
+			if (*end == '\0') {
+				*resume = pos;
 				return NULL;
 			}
+			gchar* colon = memchr(name, ':', end - name);
+			if (colon)
+				name = colon + 1;
+			if ((gsize) (end - name) == len && strncmp(name, element, len) == 0)
+				return pos;
+		}
+		pos++;
 	}
-	else {
-		temp = parse_carddav_report_wrap(report, element, type, FALSE, TRUE);
-		if (temp) {
-			g_free(response);
-			response = g_strdup_printf("%s%s%s", VCAL_HEAD, temp, VCAL_FOOT);
-			g_free(temp);
+	*resume = content + strlen(content);
+	return NULL;
+}
+
+/**
+ * Find the end tag of an element. CDATA sections are skipped, so the
+ * content may contain anything.
+ * @param content First byte after the start tag
+ * @param element Local name of the element
+ * @return Start of the end tag or NULL
+ */
+static gchar* find_end_tag(gchar* content, const char* element) {
+	gchar* resume;
+	gboolean in_cdata = FALSE;
+
+	return scan_end_tag(content, element, &resume, &in_cdata);
+}
+
+/**
+ * Initialize a ReportStream.
+ * @param stream @see ReportStream
+ * @param curl The handle performing the request. Bodies of responses
+ * other than 207 Multi-Status are ignored.
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param user_data Passed unchanged to callback
+ */
+void init_report_stream(struct ReportStream* stream, CURL* curl,
+		carddav_card_func callback, void* user_data) {
+	stream->buffer = g_string_new(NULL);
+	alloc_account(CARDDAV_MEM_RECEIVE, 0, stream->buffer->allocated_len);
+	stream->consumed = 0;
+	stream->scanned = 0;
+	stream->in_cdata = FALSE;
+	stream->curl = curl;
+	stream->stopped = FALSE;
+	stream->delivered = FALSE;
+	stream->callback = callback;
+	stream->user_data = user_data;
+	stream->parsed = 0;
+	stream->parse_time = 0;
+}
+
+/**
+ * Free memory assigned to a ReportStream.
+ * @param stream @see ReportStream
+ */
+void free_report_stream(struct ReportStream* stream) {
+	if (stream->buffer) {
+		alloc_account(CARDDAV_MEM_RECEIVE, stream->buffer->allocated_len, 0);
+		g_string_free(stream->buffer, TRUE);
+	}
+	stream->buffer = NULL;
+}
+
+/**
+ * Hand the card in one response element to the callback. The element is
+ * tokenized once; element names are recognized through dav_keyword_lookup()
+ * and their content is decoded in place.
+ * @param stream @see ReportStream
+ * @param text The response element, NUL terminated before its end tag
+ */
+static void report_stream_response(struct ReportStream* stream, gchar* text) {
+	gchar* href = NULL;
+	gchar* etag = NULL;
+	gchar* card = NULL;
+	gchar* href_end = NULL;
+	gchar* etag_end = NULL;
+	gchar* close = NULL;
+	gchar* pos = text;
+	gchar* name;
+	gchar* end;
+	gchar* colon;
+	gsize len;
+
+	while ((pos = strchr(pos, '<')) != NULL) {
+		name = pos + 1;
+		if (*name == '/' || *name == '?' || *name == '!') {
+			pos = name;
+			continue;
 		}
-		else {
-			g_free(response);
-			return NULL;
+		end = name + strcspn(name, " \t\r\n/>");
+		if ((colon = memchr(name, ':', end - name)) != NULL)
+			name = colon + 1;
+		if ((pos = strchr(end, '>')) == NULL)
+			break;
+		if (*(pos - 1) == '/')
+			continue;
+		pos++;
+		switch (dav_keyword_lookup(name, end - name)) {
+			case DAV_HREF:
+				if (!href) {
+					href = pos;
+					href_end = strchr(pos, '<');
+				}
+				break;
+			case DAV_GETETAG:
+				if (!etag) {
+					etag = pos;
+					etag_end = strchr(pos, '<');
+				}
+				break;
+			case DAV_ADDRESS_DATA:
+				/* the content may hide markup in CDATA, skip past it */
+				if (!card && (close = find_end_tag(pos, "address-data")) != NULL) {
+					card = pos;
+					pos = close;
+				}
+				break;
+			default: break;
 		}
 	}
-	return response;
+	if (!card)
+		return;
+
+	/* every end is found before anything is terminated */
+	if (href_end)
+		href[decode_xml_text(href, href_end - href)] = '\0';
+	else
+		href = NULL;
+	if (etag_end)
+		etag[decode_xml_text(etag, etag_end - etag)] = '\0';
+	else
+		etag = NULL;
+	len = decode_xml_text(card, close - card);
+	while (len > 0 && g_ascii_isspace(*card)) {
+		card++;
+		len--;
+	}
+	while (len > 0 && g_ascii_isspace(card[len - 1]))
+		len--;
+	card[len] = '\0';
+	if (len == 0)
+		return;
+	/* the callback's time is not parse time */
+	stream->parse_time += g_get_monotonic_time() - stream->parse_start;
+	if (stream->callback(href, etag, card, len, stream->user_data))
+		stream->stopped = TRUE;
+	stream->parse_start = g_get_monotonic_time();
+}
+
+/**
+ * libcurl write function feeding a ReportStream. Returns 0 when the
+ * callback asked to stop, which makes libcurl abort the transfer.
+ * @param ptr
+ * @param size
+ * @param nmemb
+ * @param data A pointer to a ReportStream
+ * @return number of consumed bytes
+ */
+size_t WriteReportCallback(void* ptr, size_t size, size_t nmemb, void* data) {
+	size_t realsize = size * nmemb;
+	struct ReportStream* stream = (struct ReportStream *)data;
+	gsize allocated = stream->buffer->allocated_len;
+	gchar* text;
+	gchar* close;
+	gchar* end;
+	gchar* resume;
+
+	if (stream->stopped)
+		return 0;
+	if (stream->curl) {
+		long code = 0;
+		curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &code);
+		if (code != 207)
+			return realsize;
+	}
+
+	stream->delivered = TRUE;
+	g_string_append_len(stream->buffer, ptr, realsize);
+	alloc_account(CARDDAV_MEM_RECEIVE, allocated, stream->buffer->allocated_len);
+	stream->parse_start = g_get_monotonic_time();
+	for (;;) {
+		/* only the new bytes are searched, not the whole response */
+		text = stream->buffer->str + stream->consumed;
+		close = scan_end_tag(stream->buffer->str + stream->scanned,
+				"response", &resume, &stream->in_cdata);
+		if (close == NULL) {
+			stream->scanned = resume - stream->buffer->str;
+			break;
+		}
+		if ((end = strchr(close, '>')) == NULL) {
+			stream->scanned = close - stream->buffer->str;
+			break;
+		}
+		*close = '\0';
+		report_stream_response(stream, text);
+		stream->parsed++;
+		stream->consumed = end + 1 - stream->buffer->str;
+		stream->scanned = stream->consumed;
+		if (stream->stopped)
+			break;
+	}
+	stream->parse_time += g_get_monotonic_time() - stream->parse_start;
+	if (stream->stopped)
+		return 0;
+	/* drop what has been handed out once it dominates the buffer */
+	if (stream->consumed > stream->buffer->len / 2) {
+		g_string_erase(stream->buffer, 0, stream->consumed);
+		stream->scanned -= stream->consumed;
+		stream->consumed = 0;
+	}
+	return realsize;
 }
 
 /**
  * Convert a time_t variable to CardDAV DateTime
  * @param time a specific date and time
- * @return the CardDAV DateTime
+ * @return the CardDAV DateTime in UTC
  */
 gchar* get_carddav_datetime(time_t* time) {
-	struct tm *current;
+	struct tm current;
 	gchar* datetime;
 
-	current = localtime(time);
+	gmtime_r(time, &current);
 	datetime = g_strdup_printf("%d%.2d%.2dT%.2d%.2d%.2dZ",
-		current->tm_year + 1900, current->tm_mon + 1, current->tm_mday,
-		current->tm_hour, current->tm_min, current->tm_sec);
+		current.tm_year + 1900, current.tm_mon + 1, current.tm_mday,
+		current.tm_hour, current.tm_min, current.tm_sec);
 	return datetime;
 }
 
 /**
  * Create a random text string, using MD5. @see carddav_md5_hex_digest()
- * @param text some text to randomize
+ * @param arena Arena the result is allocated from
+ * @param text some text to randomize, need not be NUL terminated
+ * @param len Length of text
  * @return MD5 hash of text
  */
-gchar* random_file_name(gchar* text) {
-	unsigned char* name;
-	gchar md5sum[33];
+gchar* random_file_name(carddav_arena* arena, const gchar* text, gsize len) {
+	gchar* md5sum = arena_alloc(arena, 33);
 
-	name = (unsigned char *) g_strdup(text);
-	carddav_md5_hex_digest(md5sum, name);
-	g_free(name);
-	return g_strdup(md5sum);
+	carddav_md5_hex_digest_len(md5sum, (const unsigned char *) text, len);
+	return md5sum;
 }
 
+#define UID_HEAD "\r\nUID:libcarddav-"
+#define UID_TAIL "@tempuri.org\r\n"
+
 /**
- * Does the event contain a UID element or not. If not add it.
- * @param object A specific event
- * @return event, eventually added UID
+ * Does the card contain a UID element or not. If not add it in front
+ * of END:VCARD. The card is only copied when a UID has to be added.
+ * @param arena Arena the new card is allocated from
+ * @param object A specific card, need not be NUL terminated
+ * @param len Length of object. Set to the length of the new card if a
+ * UID was added
+ * @return NULL if the card has a UID, otherwise the card with a UID added
  */
-gchar* verify_uid(gchar* object) {
-	gchar* uid;
-	gchar* newobj;
+gchar* verify_uid(carddav_arena* arena, const gchar* object, gsize* len) {
+	carddav_vcard* card;
+	const gchar* value;
+	gsize value_len;
+	gchar* newobj = NULL;
 	gchar* pos;
+	gchar* uid;
+	gsize head;
+	gsize end;
+	gsize tail;
 
-	newobj = g_strdup(object);
-	uid = get_response_header("uid", object, TRUE);
-	if (!uid) {
-		object = g_strdup(newobj);
-		g_free(newobj);
-		pos = strstr(object, "END:VEVENT");
-		newobj = g_strndup(object, strlen(object) - strlen(pos));
-		newobj = g_strchomp(newobj);
-		uid = random_file_name(object);
-		gchar*tmp = g_strdup(newobj);
-		g_free(newobj);
-		newobj = g_strdup_printf("%s\r\nUID:libcarddav-%s@tempuri.org\r\n%s",
-					tmp, uid, pos);
-		g_free(uid);
-		g_free(tmp);
-		g_free(object);
+	card = carddav_vcard_parse(object, *len);
+	if (!vcard_get_raw(card, "UID", &value, &value_len)) {
+		/* strip the whitespace before END:VCARD and at the end */
+		end = vcard_end_offset(card);
+		head = end;
+		while (head > 0 && g_ascii_isspace(object[head - 1]))
+			head--;
+		tail = *len - end;
+		while (tail > 0 && g_ascii_isspace(object[end + tail - 1]))
+			tail--;
+		uid = random_file_name(arena, object, *len);
+		*len = head + strlen(UID_HEAD) + strlen(uid) + strlen(UID_TAIL) + tail;
+		pos = newobj = arena_alloc(arena, *len + 1);
+		memcpy(pos, object, head);
+		pos += head;
+		pos = g_stpcpy(pos, UID_HEAD);
+		pos = g_stpcpy(pos, uid);
+		pos = g_stpcpy(pos, UID_TAIL);
+		memcpy(pos, &object[end], tail);
+		pos[tail] = '\0';
 	}
-	else
-		g_free(uid);
-	/*uid = g_strdup(newobj);
-	g_free(newobj);*/
-	g_strchomp(newobj);
-	/*g_free(uid);*/
+	carddav_vcard_free(&card);
 	return newobj;
 }
 
 /**
  * Fetch a URL from a XML element
+ * @param arena Arena the result is allocated from
  * @param text String
  * @return URL
  */
 #define ELEM_HREF "href>"
-gchar* get_url(gchar* text) {
+gchar* get_url(carddav_arena* arena, gchar* text) {
 	gchar* pos;
-	gchar* url = NULL;
+	gchar* end;
 
 	if ((pos = strstr(text, ELEM_HREF)) == NULL)
-		return url;
-	pos = &(*(pos + strlen(ELEM_HREF)));
-	url = g_strndup(pos, strlen(pos) - strlen(strchr(pos, '<')));
-	return url;
+		return NULL;
+	pos += strlen(ELEM_HREF);
+	if ((end = strchr(pos, '<')) == NULL)
+		return NULL;
+	return arena_strndup(arena, pos, end - pos);
 }
 
 /**
  * Fetch any element from XML
- * @param text String
+ * @param arena Arena the result is allocated from
  * @param tag The element to look for
+ * @param text String
  * @return element
  */
-gchar* get_tag(const gchar* tag, gchar* text) {
-	gchar *pos;
-	gchar* res = NULL;
-	gchar* the_tag = NULL;
+gchar* get_tag(carddav_arena* arena, const gchar* tag, gchar* text) {
+	gchar* pos = text;
+	gchar* end;
+	gsize len = strlen(tag);
 
 	/*printf("%s\n", text);*/
-	the_tag = g_strdup_printf("<%s>", tag);
-	if ((pos = strstr(text, the_tag)) == NULL) {
-		g_free(the_tag);
-		return res;
+	while ((pos = strstr(pos, tag)) != NULL) {
+		if (pos > text && pos[-1] == '<' && pos[len] == '>')
+			break;
+		pos += len;
 	}
-	pos = &(*(pos + strlen(the_tag)));
-	res = g_strndup(pos, strlen(pos) - strlen(strchr(pos, '<')));
-	g_free(the_tag);
-	return res;
+	if (pos == NULL)
+		return NULL;
+	pos += len + 1;
+	if ((end = strchr(pos, '<')) == NULL)
+		return NULL;
+	return arena_strndup(arena, pos, end - pos);
 }
 
 /**
  * Fetch the etag element from XML
+ * @param arena Arena the result is allocated from
  * @param text String
  * @return etag
  */
 #define ELEM_ETAG "getetag"
-gchar* get_etag(gchar* text) {
+gchar* get_etag(carddav_arena* arena, gchar* text) {
 	gchar* etag = NULL;
 
-	etag = get_tag(ELEM_ETAG, text);
+	etag = get_tag(arena, ELEM_ETAG, text);
 	/* Maybe namespace prefixed */
 	if (!etag) {
-		etag = get_tag("D:getetag", text);
+		etag = get_tag(arena, "D:getetag", text);
 	}
 	return etag;
 }
 
 /**
- * Fetch host from URL
- * @param url URL
- * @return host
+ * Fetch host from the URL of the settings
+ * @param settings carddav_settings
+ * @return host, allocated in the arena of settings
  */
-gchar* get_host(gchar* url) {
-	gchar** buf;
-	gchar* result = NULL;
+const gchar* get_host(carddav_settings* settings) {
+	gchar* end;
 
-	buf = g_strsplit(url, "/", 2);
-	if (buf[0]) {
-		result = g_strdup(buf[0]);
-	}
-	g_strfreev(buf);
-	return result;
+	if (!settings->url)
+		return NULL;
+	end = strchr(settings->url, '/');
+	if (end == NULL)
+		return arena_strdup(settings->arena, settings->url);
+	return arena_strndup(settings->arena, settings->url,
+			end - settings->url);
 }
 
 /**
  * rebuild a raw URL with https if needed from the settings
  * @param settings carddav_settings
  * @param uri URI to use instead of base
- * @return URL
+ * @return URL, allocated in the arena of settings
  */
+const gchar* rebuild_url(carddav_settings* settings, const gchar* uri){
+	const gchar* mystr = NULL;
 
-gchar* rebuild_url(carddav_settings* settings, gchar* uri){
-    gchar* url = NULL;
-    gchar* mystr = NULL;
 	if (settings->usehttps) {
 		mystr = "https://";
 	} else {
 		mystr = "http://";
 	}
-	if (uri)
-		url = g_strdup_printf("%s%s", mystr, uri);
+	return arena_strdup_printf(settings->arena, "%s%s", mystr,
+			(uri) ? uri : settings->url);
+}
+
+/**
+ * Whether an error is likely to go away by itself.
+ * @param http_status HTTP status or 0 (zero)
+ * @param curl_code Result of the transfer
+ * @return TRUE if repeating the call may succeed
+ */
+static gboolean error_is_retryable(long http_status, CURLcode curl_code) {
+	switch (curl_code) {
+		case CURLE_OK:
+			break;
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_OPERATION_TIMEDOUT:
+		case CURLE_PARTIAL_FILE:
+		case CURLE_GOT_NOTHING:
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+	switch (http_status) {
+		case 408:	/* request timeout */
+		case 423:	/* locked */
+		case 429:	/* too many requests */
+		case 500:
+		case 502:
+		case 503:
+		case 504:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Take over a text so it can be shared.
+ * @param text Text allocated with g_malloc()
+ * @return A shared text with one reference
+ */
+shared_text* shared_text_new(gchar* text) {
+	shared_text* shared = g_new(shared_text, 1);
+
+	shared->refs = 1;
+	shared->text = text;
+	return shared;
+}
+
+/**
+ * Add a reference to a shared text.
+ * @param shared @see shared_text
+ * @return shared
+ */
+shared_text* shared_text_ref(shared_text* shared) {
+	g_atomic_int_inc(&shared->refs);
+	return shared;
+}
+
+/**
+ * Drop a reference to a shared text, freeing it with the last one.
+ * @param shared @see shared_text
+ */
+void shared_text_unref(shared_text* shared) {
+	if (!g_atomic_int_dec_and_test(&shared->refs))
+		return;
+	g_free(shared->text);
+	g_free(shared);
+}
+
+/**
+ * Free a text which is either owned alone or part of a shared text.
+ * @param text The text, may be NULL
+ * @param owner The shared text holding text, or NULL if text is owned
+ * alone
+ */
+void release_text(gchar* text, shared_text* owner) {
+	if (owner)
+		shared_text_unref(owner);
 	else
-    	url = g_strdup_printf("%s%s", mystr,settings->url);
+		g_free(text);
+}
+
+/**
+ * Reset an error to "no error".
+ * @param error @see carddav_error
+ */
+void clear_carddav_error(carddav_error* error) {
+	/* str may still be an allocated message set by older code */
+	if (error->str && error->str != error->excerpt)
+		g_free(error->str);
+	error->code = 0;
+	error->http_status = 0;
+	error->curl_code = CURLE_OK;
+	error->phase = CARDDAV_PHASE_NONE;
+	error->retryable = FALSE;
+	error->excerpt[0] = '\0';
+	error->str = NULL;
+}
+
+/**
+ * Record an error. Nothing is allocated: text is truncated to fit
+ * error->excerpt and error->str points to it.
+ * @param error @see carddav_error
+ * @param phase The step which failed. @see CARDDAV_PHASE
+ * @param code Value for error->code
+ * @param http_status HTTP status of the response or 0 (zero)
+ * @param curl_code Result of the transfer
+ * @param text Message, need not be NUL terminated within the excerpt
+ * size. NULL gives an empty message
+ */
+void set_carddav_error(carddav_error* error, CARDDAV_PHASE phase,
+		long code, long http_status, CURLcode curl_code, const gchar* text) {
+	gsize len = 0;
+
+	clear_carddav_error(error);
+	error->code = code;
+	error->http_status = http_status;
+	error->curl_code = curl_code;
+	error->phase = phase;
+	error->retryable = error_is_retryable(http_status, curl_code);
+	if (text) {
+		while (len < sizeof(error->excerpt) - 1 && text[len])
+			len++;
+		/* do not cut a UTF-8 sequence in half */
+		if (text[len])
+			while (len > 0 && ((guchar) text[len] & 0xc0) == 0x80)
+				len--;
+		memcpy(error->excerpt, text, len);
+	}
+	error->excerpt[len] = '\0';
+	error->str = error->excerpt;
+}
+
+/**
+ * Record a failed transfer. error->code is -1.
+ * @param error @see carddav_error
+ * @param phase The step which failed. @see CARDDAV_PHASE
+ * @param res Result of perform_curl()
+ * @param error_buf The CURLOPT_ERRORBUFFER of the transfer
+ */
+void set_curl_error(carddav_error* error, CARDDAV_PHASE phase,
+		CURLcode res, const char* error_buf) {
+	set_carddav_error(error, phase, -1, 0, res,
+			(error_buf && *error_buf) ? error_buf : curl_easy_strerror(res));
+}
+
+/**
+ * Record an unexpected HTTP status. error->code is the status.
+ * @param error @see carddav_error
+ * @param phase The step which failed. @see CARDDAV_PHASE
+ * @param status HTTP status of the response
+ * @param text Response body or headers to excerpt, may be NULL
+ */
+void set_http_error(carddav_error* error, CARDDAV_PHASE phase,
+		long status, const gchar* text) {
+	set_carddav_error(error, phase, status, status, CURLE_OK, text);
+}
 
-	return url;
+/**
+ * Copy an error. to->str points to the excerpt of to afterwards, or is
+ * NULL like from->str.
+ * @param to @see carddav_error
+ * @param from @see carddav_error
+ */
+void copy_carddav_error(carddav_error* to, const carddav_error* from) {
+	if (to == from)
+		return;
+	set_carddav_error(to, from->phase, from->code, from->http_status,
+			(CURLcode) from->curl_code, from->str);
+	to->retryable = from->retryable;
+	if (!from->str)
+		to->str = NULL;
 }
 
+/**
+ * Initialize libcurl once for the process. curl_global_init() is not
+ * thread safe in all versions, and curl_easy_init() would otherwise
+ * call it from whichever thread comes first.
+ * @return TRUE if libcurl is usable
+ */
+gboolean init_libcurl(void) {
+	static gsize initialized = 0;
+	static CURLcode result = CURLE_OK;
+
+	if (g_once_init_enter(&initialized)) {
+		result = curl_global_init(CURL_GLOBAL_ALL);
+		g_once_init_leave(&initialized, 1);
+	}
+	return result == CURLE_OK;
+}
+
+/* The share of the calling thread's session. @see session_begin() */
+static GPrivate session_share = G_PRIVATE_INIT(NULL);
+
 /**
  * Prepare a curl connection
  * @param settings carddav_settings
@@ -704,19 +1559,20 @@ gchar* rebuild_url(carddav_settings* settings, gchar* uri){
  */
 CURL* get_curl(carddav_settings* setting) {
 	CURL* curl;
+	CURLSH* share;
 	gchar* userpwd = NULL;
-	gchar* url = NULL;
 
+	if (!init_libcurl())
+		return NULL;
 	curl = curl_easy_init();
 	if (curl) {
 		if (setting->username) {
 			if (setting->password)
-				userpwd = g_strdup_printf("%s:%s",
+				userpwd = arena_strdup_printf(setting->arena, "%s:%s",
 					setting->username, setting->password);
 			else
-				userpwd = g_strdup_printf("%s",	setting->username);
+				userpwd = setting->username;
 			curl_easy_setopt(curl, CURLOPT_USERPWD, userpwd);
-			g_free(userpwd);
 		}
 		if (setting->verify_ssl_certificate)
 			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2);
@@ -727,9 +1583,135 @@ CURL* get_curl(carddav_settings* setting) {
 		if (setting->custom_cacert)
 			curl_easy_setopt(curl, CURLOPT_CAINFO, setting->custom_cacert);
 		curl_easy_setopt(curl, CURLOPT_USERAGENT, __CARDDAV_USERAGENT);
-		url = rebuild_url(setting, NULL);
-		curl_easy_setopt(curl, CURLOPT_URL, url);
-		g_free(url);
+		curl_easy_setopt(curl, CURLOPT_URL, rebuild_url(setting, NULL));
+		share = g_private_get(&session_share);
+		if (share)
+			curl_easy_setopt(curl, CURLOPT_SHARE, share);
 	}
 	return (curl) ? curl : NULL;
 }
+
+/**
+ * Keep connections, DNS lookups and TLS sessions of the calling thread
+ * alive between operations until session_end(). Only one thread uses
+ * a session, so the share needs no locking.
+ * @return TRUE if the session is active
+ */
+gboolean session_begin(void) {
+	CURLSH* share;
+
+	if (g_private_get(&session_share))
+		return TRUE;
+	if (!init_libcurl())
+		return FALSE;
+	share = curl_share_init();
+	if (!share)
+		return FALSE;
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+	g_private_set(&session_share, share);
+	return TRUE;
+}
+
+/**
+ * Close the session of the calling thread and its connections.
+ * @see session_begin()
+ */
+void session_end(void) {
+	CURLSH* share = g_private_get(&session_share);
+
+	if (share) {
+		g_private_set(&session_share, NULL);
+		curl_share_cleanup(share);
+	}
+}
+
+/**
+ * Ask the server to close the connection after the request, unless the
+ * calling thread keeps its connections in a session.
+ * @param list Request headers
+ * @return The new list. @see curl_slist_append()
+ */
+struct curl_slist* append_connection_header(struct curl_slist* list) {
+	if (g_private_get(&session_share))
+		return list;
+	return curl_slist_append(list, "Connection: close");
+}
+
+/**
+ * Run a transfer for perform_curl() or perform_report(), with exactly
+ * one of body and stream set.
+ */
+static CURLcode perform_attempts(CURL* curl, carddav_settings* settings,
+		struct MemoryStruct* body, struct ReportStream* stream,
+		struct MemoryStruct* headers) {
+	size_t body_size = body ? body->size : 0;
+	size_t headers_size = headers->size;
+	guint attempt = 0;
+	limit_host* host;
+	CURLcode res;
+
+	for (;;) {
+		gint64 until;
+
+		res = limit_acquire(settings, &host);
+		if (res != CURLE_OK)
+			return res;
+		limit_transfer(curl, settings->deadline, settings->cancel);
+		if (async_active())
+			res = async_perform(curl);
+		else
+			res = curl_easy_perform(curl);
+		limit_release(host);
+		stats_transfer(curl, settings, res);
+		attempt++;
+		/* a body is truncated before the next attempt, but cards
+		 * already handed out by a stream cannot be taken back */
+		until = retry_time(curl, settings, res, attempt, headers,
+				stream == NULL || !stream->delivered);
+		if (!until)
+			return res;
+		if ((body && !truncate_memory_struct(body, body_size)) ||
+				!truncate_memory_struct(headers, headers_size))
+			return res;
+		stats_retry(settings);
+		res = retry_wait(settings, until);
+		if (res != CURLE_OK)
+			return res;
+	}
+}
+
+/**
+ * Run a prepared transfer once the rate and concurrency limits for its
+ * host allow it, repeating it after transient failures. Inside an
+ * asynchronous operation the transfer is handed to its engine instead
+ * of blocking.
+ * @param curl The prepared transfer
+ * @param settings The operation's settings, for its deadline,
+ * cancellation token, limits and retry policy
+ * @param body Receives the response body
+ * @param headers Receives the response headers
+ * @return Result of the last attempt. @see curl_easy_perform()
+ */
+CURLcode perform_curl(CURL* curl, carddav_settings* settings,
+		struct MemoryStruct* body, struct MemoryStruct* headers) {
+	return perform_attempts(curl, settings, body, NULL, headers);
+}
+
+/**
+ * Run a prepared transfer whose body is parsed by WriteReportCallback()
+ * while it is received, like perform_curl(). A failed attempt is only
+ * repeated if the stream has not taken any of a 207 Multi-Status yet.
+ * @param curl The prepared transfer
+ * @param settings @see perform_curl()
+ * @param stream The ReportStream fed by the transfer
+ * @param headers Receives the response headers
+ * @return Result of the last attempt. @see curl_easy_perform()
+ */
+CURLcode perform_report(CURL* curl, carddav_settings* settings,
+		struct ReportStream* stream, struct MemoryStruct* headers) {
+	return perform_attempts(curl, settings, NULL, stream, headers);
+}
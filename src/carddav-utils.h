@@ -25,6 +25,16 @@
 #include <stdlib.h>
 #include <curl/curl.h>
 #include "carddav.h"
+#include "carddav-arena.h"
+
+/**
+ * A text owned by several results at once. It is freed with the last
+ * reference. @see flight_run()
+ */
+typedef struct {
+	gint refs;
+	gchar* text;
+} shared_text;
 
 /**
  * @typedef struct _CARDDAV_SETTINGS carddav_settings
@@ -42,6 +52,9 @@ struct _CARDDAV_SETTINGS {
 	gchar* password;
 	gchar* url;
 	gchar* file;
+	shared_text* file_owner;	/* set when file is shared */
+	const gchar* object;
+	gsize object_len;
 	gboolean usehttps;
 	gboolean verify_ssl_certificate;
 	gchar* custom_cacert;
@@ -52,6 +65,21 @@ struct _CARDDAV_SETTINGS {
 	time_t start;
 	time_t end;
 	char use_uri;
+	carddav_card_func card_func;
+	void* card_data;
+	carddav_write_func write_func;
+	void* write_data;
+	size_t max_response_size;
+	size_t max_memory_size;
+	gint64 deadline;
+	carddav_cancel* cancel;
+	carddav_counters* counters;
+	carddav_limiter* limiter;
+	int max_retries;
+	long retry_base_ms;
+	long retry_max_ms;
+	CARDDAV_METHOD method;
+	carddav_arena* arena;
 };
 
 /**
@@ -62,11 +90,26 @@ typedef struct MemoryStruct memory_ptr;
 
 /**
  * @struct MemoryStruct
- * Used to hold messages between the CardDAV server and the library
+ * Used to hold messages between the CardDAV server and the library.
+ * The buffer grows geometrically up to max_size bytes (0 means no
+ * limit). When curl is set the buffer is presized from Content-Length.
+ * A body growing beyond spill_size bytes (0 means never) moves to the
+ * unlinked temporary file fd and is only mapped back into memory by
+ * map_memory_struct() once the transfer is done.
+ * When used for response headers, index maps header names (case
+ * insensitive) to their values for the last response received.
  */
 struct MemoryStruct {
 	char *memory;
 	size_t size;
+	size_t alloc;
+	size_t max_size;
+	size_t spill_size;
+	int fd;
+	gboolean mapped;
+	CURL* curl;
+	GHashTable* index;
+	gchar* last;
 };
 
 /** @struct config_data
@@ -118,13 +161,15 @@ size_t WriteHeaderCallback(void* ptr, size_t size, size_t nmemb, void* data);
 /*size_t ReadMemoryCallback(void* ptr, size_t size, size_t nmemb, void* data);*/
 
 /**
- * Initialize carddav settings structure.
+ * Initialize carddav settings structure. Takes an arena for the
+ * transient strings of the operation from the cache of the thread.
  * @param settings @see carddav_settings
  */
 void init_carddav_settings(carddav_settings* settings);
 
 /**
- * Free momory assigned to carddav settings structure.
+ * Free momory assigned to carddav settings structure. Everything
+ * allocated from its arena is released.
  * @param settings @see carddav_settings
  */
 void free_carddav_settings(carddav_settings* settings);
@@ -137,81 +182,272 @@ void free_carddav_settings(carddav_settings* settings);
 void parse_url(carddav_settings* settings, const char* url);
 
 /**
- * Find a specific HTTP header from last request
- * @param header HTTP header to search for
- * @param headers String of HTTP headers from last request
- * @param lowcase Should string be returned in all lower case.
- * @return The header found or NULL
+ * Initialize a MemoryStruct before handing it to libcurl.
+ * @param mem @see MemoryStruct
+ */
+void init_memory_struct(struct MemoryStruct* mem);
+
+/**
+ * Free memory assigned to a MemoryStruct. The buffer is kept for the
+ * next MemoryStruct of the calling thread when the pool has room.
+ * @param mem @see MemoryStruct
+ */
+void free_memory_struct(struct MemoryStruct* mem);
+
+/**
+ * Drop data appended to a MemoryStruct after it held size bytes, so a
+ * repeated request leaves only its own response behind.
+ * @param mem @see MemoryStruct
+ * @param size Earlier size of mem
+ * @return FALSE if the data could not be dropped
+ */
+gboolean truncate_memory_struct(struct MemoryStruct* mem, size_t size);
+
+/**
+ * Make the body of a MemoryStruct which was spilled to disk available
+ * as a NUL terminated string in memory by mapping its file. Does nothing
+ * if the body never left the heap. Call it after perform_curl()
+ * before looking at mem->memory.
+ * @param mem @see MemoryStruct
+ * @param error_buf Receives a message on failure, CURL_ERROR_SIZE bytes
+ * @return FALSE if the file could not be mapped. mem->memory is NULL then
  */
-gchar* get_response_header(
-		const char* header, gchar* headers, gboolean lowcase);
+gboolean map_memory_struct(struct MemoryStruct* mem, char* error_buf);
 
 /**
- * Parse response from CardDAV server
- * @param report Response from server
- * @param element XML element to find
- * @param type VCalendar element to find
- * @return the parsed result
+ * Let libcurl store the body and the headers of responses in MemoryStructs.
+ * @param curl The handle performing the request
+ * @param settings @see carddav_settings. Supplies max_response_size and
+ * max_memory_size
+ * @param chunk Receives the body. If NULL the write function is left alone
+ * @param headers Receives the headers
  */
-gchar* parse_carddav_report(char* report, const char* element, const char* type);
+void set_memory_callbacks(CURL* curl, carddav_settings* settings,
+		struct MemoryStruct* chunk, struct MemoryStruct* headers);
+
+/**
+ * Find a specific HTTP header from last request. Repeated headers are
+ * returned as one comma separated value and folded lines are joined.
+ * @param headers Headers collected by WriteHeaderCallback
+ * @param header HTTP header to search for, case insensitive
+ * @return The header value or NULL. Owned by headers, do not free.
+ */
+const gchar* get_response_header(
+		struct MemoryStruct* headers, const char* header);
+
+/**
+ * Case insensitive string hash for ASCII keys. Use with ascii_case_equal.
+ * @param key NUL terminated string
+ * @return hash value
+ */
+guint ascii_case_hash(gconstpointer key);
+
+/**
+ * Case insensitive string comparison for ASCII keys.
+ * @param a NUL terminated string
+ * @param b NUL terminated string
+ * @return TRUE if the strings are equal ignoring case
+ */
+gboolean ascii_case_equal(gconstpointer a, gconstpointer b);
+
+/**
+ * Decode XML character data in place. Entity and character references
+ * are replaced and CDATA sections are unwrapped.
+ * @param text Start of the character data
+ * @param len Length of the character data
+ * @return Length of the decoded text, never more than len
+ */
+gsize decode_xml_text(gchar* text, gsize len);
+
+/**
+ * @struct ReportStream
+ * Used to parse a multistatus response while it is received. Every
+ * complete response element carrying address-data is handed to callback.
+ */
+struct ReportStream {
+	GString* buffer;
+	gsize consumed;
+	gsize scanned;		/* where the search for the next end resumes */
+	gboolean in_cdata;	/* whether scanned is inside a CDATA section */
+	CURL* curl;
+	gboolean stopped;
+	gboolean delivered;	/* bytes of a 207 were taken, so no retry */
+	carddav_card_func callback;
+	void* user_data;
+	guint parsed;		/* response elements taken apart */
+	gint64 parse_time;	/* microseconds spent on them */
+	gint64 parse_start;
+};
+
+/**
+ * Initialize a ReportStream.
+ * @param stream @see ReportStream
+ * @param curl The handle performing the request. Bodies of responses
+ * other than 207 Multi-Status are ignored.
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param user_data Passed unchanged to callback
+ */
+void init_report_stream(struct ReportStream* stream, CURL* curl,
+		carddav_card_func callback, void* user_data);
+
+/**
+ * Free memory assigned to a ReportStream.
+ * @param stream @see ReportStream
+ */
+void free_report_stream(struct ReportStream* stream);
+
+/**
+ * libcurl write function feeding a ReportStream. Returns 0 when the
+ * callback asked to stop, which makes libcurl abort the transfer.
+ * @param ptr
+ * @param size
+ * @param nmemb
+ * @param data A pointer to a ReportStream
+ * @return number of consumed bytes
+ */
+size_t WriteReportCallback(void* ptr, size_t size, size_t nmemb, void* data);
 
 /**
  * Convert a time_t variable to CardDAV DateTime
  * @param time a specific date and time
- * @return the CardDAV DateTime
+ * @return the CardDAV DateTime in UTC
  */
 gchar* get_carddav_datetime(time_t* time);
 
 /**
  * Create a random text string, using MD5. @see carddav_md5_hex_digest()
- * @param text some text to randomize
+ * @param arena Arena the result is allocated from
+ * @param text some text to randomize, need not be NUL terminated
+ * @param len Length of text
  * @return MD5 hash of text
  */
-gchar* random_file_name(gchar* text);
+gchar* random_file_name(carddav_arena* arena, const gchar* text, gsize len);
 
 /**
  * Does the card contain a UID element or not. If not add it.
- * @param object A specific card
- * @return card, eventually added UID
+ * @param arena Arena the new card is allocated from
+ * @param object A specific card, need not be NUL terminated
+ * @param len Length of object. Set to the length of the new card if a
+ * UID was added
+ * @return NULL if the card has a UID, otherwise the card with a UID added
  */
-gchar* verify_uid(gchar* object);
+gchar* verify_uid(carddav_arena* arena, const gchar* object, gsize* len);
 
 /**
  * Fetch a URL from a XML element
+ * @param arena Arena the result is allocated from
  * @param text String
  * @return URL
  */
-gchar* get_url(gchar* text);
+gchar* get_url(carddav_arena* arena, gchar* text);
 
 /**
- * Fetch host from URL
- * @param url URL
- * @return host
+ * Fetch host from the URL of the settings
+ * @param settings carddav_settings
+ * @return host, allocated in the arena of settings
  */
-gchar* get_host(gchar* url);
+const gchar* get_host(carddav_settings* settings);
 
 /**
  * Fetch the etag element from XML
+ * @param arena Arena the result is allocated from
  * @param text String
  * @return etag
  */
-gchar* get_etag(gchar* text);
+gchar* get_etag(carddav_arena* arena, gchar* text);
 
 /**
  * Fetch any element from XML
+ * @param arena Arena the result is allocated from
+ * @param tag The element to look for
  * @param text String
  * @return element
  */
-gchar* get_tag(const gchar* tag, gchar* text);
-
-
+gchar* get_tag(carddav_arena* arena, const gchar* tag, gchar* text);
 
 /**
  * rebuild a raw URL with https if needed from the settings
  * @param settings carddav_settings
- * @return URL
+ * @param uri URI to use instead of base
+ * @return URL, allocated in the arena of settings
  */
-gchar* rebuild_url(carddav_settings* setting, gchar* uri);
+const gchar* rebuild_url(carddav_settings* setting, const gchar* uri);
+
+/**
+ * Take over a text so it can be shared.
+ * @param text Text allocated with g_malloc()
+ * @return A shared text with one reference
+ */
+shared_text* shared_text_new(gchar* text);
+
+/**
+ * Add a reference to a shared text.
+ * @param shared @see shared_text
+ * @return shared
+ */
+shared_text* shared_text_ref(shared_text* shared);
+
+/**
+ * Drop a reference to a shared text, freeing it with the last one.
+ * @param shared @see shared_text
+ */
+void shared_text_unref(shared_text* shared);
+
+/**
+ * Free a text which is either owned alone or part of a shared text.
+ * @param text The text, may be NULL
+ * @param owner The shared text holding text, or NULL if text is owned
+ * alone
+ */
+void release_text(gchar* text, shared_text* owner);
+
+/**
+ * Reset an error to "no error".
+ * @param error @see carddav_error
+ */
+void clear_carddav_error(carddav_error* error);
+
+/**
+ * Record an error. Nothing is allocated: text is truncated to fit
+ * error->excerpt and error->str points to it.
+ * @param error @see carddav_error
+ * @param phase The step which failed. @see CARDDAV_PHASE
+ * @param code Value for error->code
+ * @param http_status HTTP status of the response or 0 (zero)
+ * @param curl_code Result of the transfer
+ * @param text Message, need not be NUL terminated within the excerpt
+ * size. NULL gives an empty message
+ */
+void set_carddav_error(carddav_error* error, CARDDAV_PHASE phase,
+		long code, long http_status, CURLcode curl_code, const gchar* text);
+
+/**
+ * Record a failed transfer. error->code is -1.
+ * @param error @see carddav_error
+ * @param phase The step which failed. @see CARDDAV_PHASE
+ * @param res Result of perform_curl()
+ * @param error_buf The CURLOPT_ERRORBUFFER of the transfer
+ */
+void set_curl_error(carddav_error* error, CARDDAV_PHASE phase,
+		CURLcode res, const char* error_buf);
+
+/**
+ * Record an unexpected HTTP status. error->code is the status.
+ * @param error @see carddav_error
+ * @param phase The step which failed. @see CARDDAV_PHASE
+ * @param status HTTP status of the response
+ * @param text Response body or headers to excerpt, may be NULL
+ */
+void set_http_error(carddav_error* error, CARDDAV_PHASE phase,
+		long status, const gchar* text);
+
+/**
+ * Copy an error. to->str points to the excerpt of to afterwards, or is
+ * NULL like from->str.
+ * @param to @see carddav_error
+ * @param from @see carddav_error
+ */
+void copy_carddav_error(carddav_error* to, const carddav_error* from);
 
 /**
  * Prepare a curl connection
@@ -220,4 +456,61 @@ gchar* rebuild_url(carddav_settings* setting, gchar* uri);
  */
 CURL* get_curl(carddav_settings* setting);
 
+/**
+ * Initialize libcurl once for the process. curl_global_init() is not
+ * thread safe in all versions, and curl_easy_init() would otherwise
+ * call it from whichever thread comes first.
+ * @return TRUE if libcurl is usable
+ */
+gboolean init_libcurl(void);
+
+/**
+ * Run a prepared transfer once the rate and concurrency limits for its
+ * host allow it, repeating it after transient failures. Inside an
+ * asynchronous operation the transfer is handed to its engine instead
+ * of blocking.
+ * @param curl The prepared transfer
+ * @param settings The operation's settings, for its deadline,
+ * cancellation token, limits and retry policy
+ * @param body Receives the response body
+ * @param headers Receives the response headers
+ * @return Result of the last attempt. @see curl_easy_perform()
+ */
+CURLcode perform_curl(CURL* curl, carddav_settings* settings,
+		struct MemoryStruct* body, struct MemoryStruct* headers);
+
+/**
+ * Run a prepared transfer whose body is parsed by WriteReportCallback()
+ * while it is received, like perform_curl(). A failed attempt is only
+ * repeated if the stream has not taken any of a 207 Multi-Status yet.
+ * @param curl The prepared transfer
+ * @param settings @see perform_curl()
+ * @param stream The ReportStream fed by the transfer
+ * @param headers Receives the response headers
+ * @return Result of the last attempt. @see curl_easy_perform()
+ */
+CURLcode perform_report(CURL* curl, carddav_settings* settings,
+		struct ReportStream* stream, struct MemoryStruct* headers);
+
+/**
+ * Keep connections, DNS lookups and TLS sessions of the calling thread
+ * alive between operations until session_end().
+ * @return TRUE if the session is active
+ */
+gboolean session_begin(void);
+
+/**
+ * Close the session of the calling thread and its connections.
+ * @see session_begin()
+ */
+void session_end(void);
+
+/**
+ * Ask the server to close the connection after the request, unless the
+ * calling thread keeps its connections in a session.
+ * @param list Request headers
+ * @return The new list. @see curl_slist_append()
+ */
+struct curl_slist* append_connection_header(struct curl_slist* list);
+
 #endif
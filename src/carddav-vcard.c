@@ -0,0 +1,475 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "carddav-vcard.h"
+#include "carddav-utils.h"
+#include "vcard-keywords.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @struct vcard_property
+ * One logical (unfolded) content line of a card. Offsets point into the
+ * data handed to carddav_vcard_parse(). Value and parameters are only
+ * decoded when asked for.
+ */
+typedef struct {
+	gsize start;		/* first byte of the content line */
+	gsize name_start;	/* first byte of the name, after any group */
+	gsize name_len;
+	gsize params_start;	/* first byte after the name */
+	gsize value_start;	/* first byte after the ':' */
+	gsize value_end;	/* last byte of the value + 1, CRLF excluded */
+	vcard_keyword id;	/* VCARD_UNKNOWN for extensions */
+	gboolean folded;
+	gchar* value;
+	gchar** params;
+} vcard_property;
+
+/**
+ * @struct _carddav_vcard
+ * A card which is indexed line by line as properties are looked up.
+ */
+struct _carddav_vcard {
+	const gchar* data;
+	gsize len;
+	gsize scan_pos;		/* where the next content line starts */
+	gboolean complete;	/* END:VCARD or end of data seen */
+	gsize end_offset;
+	GArray* props;		/* vcard_property */
+	GArray* known[VCARD_KEYWORDS];	/* keyword -> positions in props */
+	GHashTable* index;	/* other names -> GArray of positions in props */
+};
+
+static void free_index_entry(gpointer data) {
+	g_array_free((GArray *) data, TRUE);
+}
+
+/**
+ * Find the positions of all properties with a given name scanned so far.
+ * @param card The card
+ * @param id The keyword for name or VCARD_UNKNOWN
+ * @param name Property name, needed when id is VCARD_UNKNOWN
+ * @return Array of positions in props or NULL
+ */
+static GArray* vcard_positions(
+		carddav_vcard* card, vcard_keyword id, const gchar* name) {
+	if (id != VCARD_UNKNOWN)
+		return card->known[id];
+	return (card->index) ? g_hash_table_lookup(card->index, name) : NULL;
+}
+
+/**
+ * Scan the next content line and add it to the index.
+ * @param card The card
+ * @return Position of the new property in props or -1 if the card is
+ * completely scanned.
+ */
+static gint vcard_scan_line(carddav_vcard* card) {
+	const gchar* data = card->data;
+	const gchar* eol;
+	gsize len = card->len;
+	gsize pos = card->scan_pos;
+	gboolean quoted = FALSE;
+	vcard_property prop;
+	GArray* found;
+	gchar* name;
+	guint n;
+
+	if (card->complete)
+		return -1;
+	while (pos < len && (data[pos] == '\r' || data[pos] == '\n'))
+		pos++;
+	if (pos >= len) {
+		card->complete = TRUE;
+		card->end_offset = card->scan_pos = len;
+		return -1;
+	}
+	memset(&prop, 0, sizeof(prop));
+	prop.start = prop.name_start = pos;
+	/* name, optionally prefixed with a group: item1.EMAIL */
+	while (pos < len && data[pos] != ';' && data[pos] != ':' &&
+			data[pos] != '\r' && data[pos] != '\n') {
+		if (data[pos] == '.')
+			prop.name_start = pos + 1;
+		pos++;
+	}
+	prop.name_len = pos - prop.name_start;
+	prop.id = vcard_keyword_lookup(&data[prop.name_start], prop.name_len);
+	prop.params_start = pos;
+	/* parameters. A quoted parameter value may contain ':' and ';' */
+	while (pos < len && (quoted || data[pos] != ':')) {
+		if (data[pos] == '"')
+			quoted = !quoted;
+		else if (data[pos] == '\n') {
+			if (pos + 1 < len && (data[pos + 1] == ' ' || data[pos + 1] == '\t'))
+				prop.folded = TRUE;
+			else
+				break;
+		}
+		pos++;
+	}
+	if (pos < len && data[pos] == ':')
+		pos++;
+	prop.value_start = prop.value_end = pos;
+	/* the value runs until a line break not followed by white space */
+	while (pos < len) {
+		eol = memchr(&data[pos], '\n', len - pos);
+		if (!eol) {
+			prop.value_end = pos = len;
+			break;
+		}
+		pos = eol - data;
+		prop.value_end = (pos > prop.value_start && data[pos - 1] == '\r') ?
+			pos - 1 : pos;
+		pos++;
+		if (pos < len && (data[pos] == ' ' || data[pos] == '\t'))
+			prop.folded = TRUE;
+		else
+			break;
+	}
+	card->scan_pos = pos;
+	n = card->props->len;
+	g_array_append_val(card->props, prop);
+
+	if (prop.id != VCARD_UNKNOWN) {
+		if (!card->known[prop.id])
+			card->known[prop.id] = g_array_new(FALSE, FALSE, sizeof(guint));
+		found = card->known[prop.id];
+	}
+	else {
+		if (!card->index)
+			card->index = g_hash_table_new_full(ascii_case_hash,
+						ascii_case_equal, g_free, free_index_entry);
+		name = g_strndup(&data[prop.name_start], prop.name_len);
+		found = g_hash_table_lookup(card->index, name);
+		if (found) {
+			g_free(name);
+		}
+		else {
+			found = g_array_new(FALSE, FALSE, sizeof(guint));
+			g_hash_table_insert(card->index, name, found);
+		}
+	}
+	g_array_append_val(found, n);
+
+	if (prop.id == VCARD_END &&
+			prop.value_end - prop.value_start == 5 &&
+			g_ascii_strncasecmp(&data[prop.value_start], "VCARD", 5) == 0) {
+		card->complete = TRUE;
+		card->end_offset = prop.start;
+	}
+	return n;
+}
+
+/**
+ * Find the n'th property with a given name, scanning no further into the
+ * card than needed.
+ * @param card The card
+ * @param name Property name, case insensitive
+ * @param n Zero based occurrence
+ * @return The property or NULL
+ */
+static vcard_property* vcard_find(
+		carddav_vcard* card, const gchar* name, guint n) {
+	GArray* found;
+	vcard_property* prop;
+	vcard_keyword id;
+	gsize name_len;
+	guint seen;
+	gint pos;
+
+	name_len = strlen(name);
+	id = vcard_keyword_lookup(name, name_len);
+	found = vcard_positions(card, id, name);
+	seen = (found) ? found->len : 0;
+	if (seen > n)
+		return &g_array_index(card->props, vcard_property,
+					g_array_index(found, guint, n));
+	while ((pos = vcard_scan_line(card)) >= 0) {
+		prop = &g_array_index(card->props, vcard_property, pos);
+		if (prop->id != id)
+			continue;
+		if (id == VCARD_UNKNOWN && (prop->name_len != name_len ||
+				g_ascii_strncasecmp(
+					&card->data[prop->name_start], name, name_len) != 0))
+			continue;
+		if (++seen > n)
+			return prop;
+	}
+	return NULL;
+}
+
+/**
+ * Remove line folding from a piece of a card.
+ * @param text Start of the folded text
+ * @param len Length of the folded text
+ * @return newly allocated, unfolded text
+ */
+static gchar* vcard_unfold(const gchar* text, gsize len) {
+	gchar* result;
+	gsize i, j, k;
+
+	result = g_malloc(len + 1);
+	for (i = j = 0; i < len; i++) {
+		if (text[i] == '\r' || text[i] == '\n') {
+			k = i;
+			if (text[k] == '\r' && k + 1 < len && text[k + 1] == '\n')
+				k++;
+			if (text[k] == '\n' && k + 1 < len &&
+					(text[k + 1] == ' ' || text[k + 1] == '\t')) {
+				/* skip line break and the leading white space */
+				i = k + 1;
+				continue;
+			}
+		}
+		result[j++] = text[i];
+	}
+	result[j] = '\0';
+	return result;
+}
+
+static const gchar* vcard_value(carddav_vcard* card, vcard_property* prop) {
+	if (!prop->value) {
+		if (prop->folded)
+			prop->value = vcard_unfold(&card->data[prop->value_start],
+						prop->value_end - prop->value_start);
+		else
+			prop->value = g_strndup(&card->data[prop->value_start],
+						prop->value_end - prop->value_start);
+	}
+	return prop->value;
+}
+
+/**
+ * Split the parameter part of a content line into KEY=VALUE strings.
+ * Bare parameters (vCard 2.1: EMAIL;WORK) are turned into TYPE=WORK.
+ */
+static gchar** vcard_params(carddav_vcard* card, vcard_property* prop) {
+	GPtrArray* list;
+	gchar* text;
+	gchar* pos;
+	gchar* start;
+	gsize len;
+	gboolean quoted = FALSE;
+
+	if (prop->params)
+		return prop->params;
+	len = prop->value_start - prop->params_start;
+	/* drop the ':' in front of the value */
+	if (len > 0 && card->data[prop->value_start - 1] == ':')
+		len--;
+	text = vcard_unfold(&card->data[prop->params_start], len);
+	list = g_ptr_array_new();
+	start = NULL;
+	for (pos = text; ; pos++) {
+		if (*pos == '"') {
+			quoted = !quoted;
+			continue;
+		}
+		if (*pos != '\0' && (*pos != ';' || quoted))
+			continue;
+		if (start && pos > start) {
+			gchar* param = g_strndup(start, pos - start);
+			if (strchr(param, '=') == NULL) {
+				gchar* tmp = param;
+				param = g_strdup_printf("TYPE=%s", tmp);
+				g_free(tmp);
+			}
+			g_ptr_array_add(list, param);
+		}
+		if (*pos == '\0')
+			break;
+		start = pos + 1;
+	}
+	g_ptr_array_add(list, NULL);
+	g_free(text);
+	prop->params = (gchar **) g_ptr_array_free(list, FALSE);
+	return prop->params;
+}
+
+/**
+ * Function for parsing a card. No copy of the data is made.
+ * @param data The card. Must stay valid until the card is freed.
+ * @param len Length of data
+ * @return A card handle. @see carddav_vcard_free()
+ */
+carddav_vcard* carddav_vcard_parse(const char* data, size_t len) {
+	carddav_vcard* card;
+
+	card = g_new0(carddav_vcard, 1);
+	card->data = (data) ? data : "";
+	card->len = (data) ? len : 0;
+	card->props = g_array_new(FALSE, FALSE, sizeof(vcard_property));
+	return card;
+}
+
+/**
+ * Function for getting the first value of a property.
+ * @param card A parsed card
+ * @param name Property name, case insensitive
+ * @return The unfolded value or NULL. Owned by the card.
+ */
+const char* carddav_vcard_get(carddav_vcard* card, const char* name) {
+	return carddav_vcard_get_nth(card, name, 0);
+}
+
+/**
+ * Function for getting the n'th value of a property.
+ * @param card A parsed card
+ * @param name Property name, case insensitive
+ * @param n Zero based occurrence
+ * @return The unfolded value or NULL. Owned by the card.
+ */
+const char* carddav_vcard_get_nth(carddav_vcard* card, const char* name, int n) {
+	vcard_property* prop;
+
+	g_return_val_if_fail(card != NULL && name != NULL, NULL);
+
+	if (n < 0 || (prop = vcard_find(card, name, n)) == NULL)
+		return NULL;
+	return vcard_value(card, prop);
+}
+
+/**
+ * Function for counting the occurrences of a property.
+ * @param card A parsed card
+ * @param name Property name, case insensitive
+ * @return Number of properties with this name
+ */
+int carddav_vcard_count(carddav_vcard* card, const char* name) {
+	GArray* found;
+
+	g_return_val_if_fail(card != NULL && name != NULL, 0);
+
+	while (vcard_scan_line(card) >= 0)
+		;
+	found = vcard_positions(card,
+				vcard_keyword_lookup(name, strlen(name)), name);
+	return (found) ? found->len : 0;
+}
+
+/**
+ * Function for getting a parameter of a property.
+ * @param card A parsed card
+ * @param name Property name, case insensitive
+ * @param n Zero based occurrence of the property
+ * @param param Parameter name, case insensitive
+ * @return The parameter value without quotes or NULL. Owned by the card.
+ */
+const char* carddav_vcard_get_param(carddav_vcard* card,
+		const char* name, int n, const char* param) {
+	vcard_property* prop;
+	gchar** params;
+	gsize len;
+
+	g_return_val_if_fail(card != NULL && name != NULL && param != NULL, NULL);
+
+	if (n < 0 || (prop = vcard_find(card, name, n)) == NULL)
+		return NULL;
+	len = strlen(param);
+	for (params = vcard_params(card, prop); *params; params++) {
+		if (g_ascii_strncasecmp(*params, param, len) == 0 &&
+				(*params)[len] == '=') {
+			gchar* value = &(*params)[len + 1];
+			gsize vlen = strlen(value);
+			if (vlen >= 2 && value[0] == '"' && value[vlen - 1] == '"') {
+				/* unquote in place, the string is ours */
+				memmove(value, value + 1, vlen - 2);
+				value[vlen - 2] = '\0';
+			}
+			return value;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Function for freeing a card handle.
+ * @param card Address of a pointer to a card. Set to NULL.
+ */
+void carddav_vcard_free(carddav_vcard** card) {
+	carddav_vcard* c;
+	guint i;
+
+	if (card && *card) {
+		c = *card;
+		for (i = 0; i < c->props->len; i++) {
+			vcard_property* prop = &g_array_index(c->props, vcard_property, i);
+			g_free(prop->value);
+			g_strfreev(prop->params);
+		}
+		g_array_free(c->props, TRUE);
+		for (i = 0; i < VCARD_KEYWORDS; i++) {
+			if (c->known[i])
+				g_array_free(c->known[i], TRUE);
+		}
+		if (c->index)
+			g_hash_table_destroy(c->index);
+		g_free(c);
+		*card = NULL;
+	}
+}
+
+/**
+ * Find the raw value of a property without decoding it.
+ * @param card A parsed card. @see carddav_vcard_parse()
+ * @param name Property name, case insensitive
+ * @param start Set to the first byte of the value
+ * @param len Set to the length of the value
+ * @return TRUE if the property exists, FALSE otherwise
+ */
+gboolean vcard_get_raw(carddav_vcard* card, const gchar* name,
+		const gchar** start, gsize* len) {
+	vcard_property* prop;
+
+	if ((prop = vcard_find(card, name, 0)) == NULL)
+		return FALSE;
+	*start = &card->data[prop->value_start];
+	*len = prop->value_end - prop->value_start;
+	return TRUE;
+}
+
+/**
+ * Return a newly allocated copy of the first value of a property.
+ * @param card A parsed card. @see carddav_vcard_parse()
+ * @param name Property name, case insensitive
+ * @return The unfolded value or NULL. Caller must g_free it.
+ */
+gchar* vcard_dup_value(carddav_vcard* card, const gchar* name) {
+	return g_strdup(carddav_vcard_get(card, name));
+}
+
+/**
+ * Offset of the END:VCARD line, or the length of the data if the card
+ * is not terminated.
+ * @param card A parsed card. @see carddav_vcard_parse()
+ * @return offset into the parsed data
+ */
+gsize vcard_end_offset(carddav_vcard* card) {
+	while (vcard_scan_line(card) >= 0)
+		;
+	return card->end_offset;
+}
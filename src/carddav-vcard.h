@@ -0,0 +1,55 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CARDDAV_VCARD_H__
+#define __CARDDAV_VCARD_H__
+
+#include <glib.h>
+#include "carddav.h"
+
+/**
+ * Find the raw value of a property without decoding it. The span points
+ * into the parsed data and may still contain folded line breaks.
+ * @param card A parsed card. @see carddav_vcard_parse()
+ * @param name Property name, case insensitive
+ * @param start Set to the first byte of the value
+ * @param len Set to the length of the value
+ * @return TRUE if the property exists, FALSE otherwise
+ */
+gboolean vcard_get_raw(carddav_vcard* card, const gchar* name,
+		const gchar** start, gsize* len);
+
+/**
+ * Return a newly allocated copy of the first value of a property.
+ * @param card A parsed card. @see carddav_vcard_parse()
+ * @param name Property name, case insensitive
+ * @return The unfolded value or NULL. Caller must g_free it.
+ */
+gchar* vcard_dup_value(carddav_vcard* card, const gchar* name);
+
+/**
+ * Offset of the END:VCARD line, or the length of the data if the card
+ * is not terminated. Forces a complete scan of the card.
+ * @param card A parsed card. @see carddav_vcard_parse()
+ * @return offset into the parsed data
+ */
+gsize vcard_end_offset(carddav_vcard* card);
+
+#endif
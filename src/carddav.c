@@ -30,17 +30,23 @@
 #include "modify-carddav-object.h"
 #include "get-display-name.h"
 #include "options-carddav-server.h"
+#include "carddav-cancel.h"
+#include "carddav-flight.h"
 #include <curl/curl.h>
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 static void init_runtime(runtime_info* info) {
     if (! info)
 		return;
     if (! info->error)
 		info->error = g_new0(carddav_error, 1);
+	else
+		clear_carddav_error(info->error);
     if (! info->options) {
 		info->options = g_new0(debug_curl, 1);
 		info->options->trace_ascii = 1;
@@ -51,6 +57,27 @@ static void init_runtime(runtime_info* info) {
     }
 }
 
+/**
+ * Copy the per-operation options of a runtime into the settings used
+ * for a single request.
+ * @param settings The settings to fill in.
+ * @param options The options given by the caller.
+ */
+static void apply_options(carddav_settings* settings, debug_curl* options) {
+	settings->debug = options->debug ? TRUE : FALSE;
+	settings->trace_ascii = options->trace_ascii ? 1 : 0;
+	settings->use_locking = options->use_locking ? 1 : 0;
+	settings->max_response_size = options->max_response_size;
+	settings->max_memory_size = options->max_memory_size;
+	settings->deadline = operation_deadline(options->timeout_ms);
+	settings->cancel = options->cancel;
+	settings->counters = options->counters;
+	settings->limiter = options->limiter;
+	settings->max_retries = options->max_retries;
+	settings->retry_base_ms = options->retry_base_ms;
+	settings->retry_max_ms = options->retry_max_ms;
+}
+
 /**
  * @param curl An instance of libcurl.
  * @param settings Defines CardDAV resource. Receiver is responsible for freeing
@@ -67,24 +94,24 @@ static gboolean test_carddav_enabled(CURL* curl,
 
 /* 
  * @param settings An instance of carddav_settings. @see carddav_settings
+ * @param error Receives the reason of a failure. @see carddav_error
  * @return TRUE if there was an error. Error can be in libcurl, in libcarddav,
  * or an error related to the CardDAV protocol.
  */
-static gboolean make_carddav_call(carddav_settings* settings,
-				 runtime_info* info) {
+static gboolean run_carddav_call(carddav_settings* settings,
+				 carddav_error* error) {
 	CURL* curl;
 	gboolean result = FALSE;
 
-	g_return_val_if_fail(info != NULL, TRUE);
-
 	curl = get_curl(settings);
 	if (!curl) {
-		info->error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
 		return TRUE;
 	}
-	if (!test_carddav_enabled(curl, settings, info->error)) {
+	if (!test_carddav_enabled(curl, settings, error)) {
 		g_free(settings->file);
 		settings->file = NULL;
 		curl_easy_cleanup(curl);
@@ -93,27 +120,71 @@ static gboolean make_carddav_call(carddav_settings* settings,
 	curl_easy_cleanup(curl);
 	if (settings->use_uri == 0) {
 		switch (settings->ACTION) {
-			case GETALL: result = carddav_getall(settings, info->error); break;
-			case ADD: result = carddav_add(settings, info->error); break;
-			case DELETE: result = carddav_delete(settings, info->error); break;
-			case MODIFY: result = carddav_modify(settings, info->error); break;
-			case GETCALNAME: result = carddav_getname(settings, info->error); break;
+			case GETALL: result = carddav_getall(settings, error); break;
+			case ADD: result = carddav_add(settings, error); break;
+			case DELETE: result = carddav_delete(settings, error); break;
+			case MODIFY: result = carddav_modify(settings, error); break;
+			case GETCALNAME: result = carddav_getname(settings, error); break;
 			default: break;
 		}
 	}
 	else {
 		switch (settings->ACTION) {
-			case GETALL: result = carddav_getall_by_uri(settings, info->error); break;
-			case ADD: result = carddav_add(settings, info->error); break;
-			case DELETE: result = carddav_delete_by_uri(settings, info->error); break;
-			case MODIFY: result = carddav_modify_by_uri(settings, info->error); break;
-			case GETCALNAME: result = carddav_getname(settings, info->error); break;
+			case GETALL: result = carddav_getall_by_uri(settings, error); break;
+			case ADD: result = carddav_add(settings, error); break;
+			case DELETE: result = carddav_delete_by_uri(settings, error); break;
+			case MODIFY: result = carddav_modify_by_uri(settings, error); break;
+			case GETCALNAME: result = carddav_getname(settings, error); break;
 			default: break;
 		}
 	}
 	return result;
 }
 
+/*
+ * Run a read for flight_run(). Its text is the file of the settings.
+ */
+static gboolean run_read(gpointer data, gchar** text, carddav_error* error) {
+	carddav_settings* settings = (carddav_settings *) data;
+	gboolean result = run_carddav_call(settings, error);
+	gchar* file = settings->file;
+
+	settings->file = NULL;
+	*text = file;
+	return result;
+}
+
+/* 
+ * @param settings An instance of carddav_settings. @see carddav_settings
+ * @return TRUE if there was an error. Error can be in libcurl, in libcarddav,
+ * or an error related to the CardDAV protocol.
+ */
+static gboolean make_carddav_call(carddav_settings* settings,
+				 runtime_info* info) {
+	const gchar* what;
+	gchar* key;
+	gboolean result;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+
+	/* Identical reads running at the same time share their requests.
+	 * Cards handed to callbacks as they arrive cannot be shared. */
+	if (settings->card_func || settings->write_func)
+		return run_carddav_call(settings, info->error);
+	switch (settings->ACTION) {
+		case GETALL:
+			what = (settings->use_uri) ? "getall-uri" : "getall";
+			break;
+		case GETCALNAME: what = "displayname"; break;
+		default: return run_carddav_call(settings, info->error);
+	}
+	key = flight_key(settings, what);
+	result = flight_run(key, settings, run_read, settings, &settings->file,
+			&settings->file_owner, info->error);
+	g_free(key);
+	return result;
+}
+
 /**
  * Function for adding a new event.
  * @param object Appointment following ICal format (RFC2445). Receiver is
@@ -126,27 +197,37 @@ static gboolean make_carddav_call(carddav_settings* settings,
 CARDDAV_RESPONSE carddav_add_object(const char* object,
 				  const char* URL,
 				  runtime_info* info) {
+	g_return_val_if_fail(object != NULL, TRUE);
+
+	return carddav_add_object_len(object, strlen(object), URL, info);
+}
+
+/**
+ * Function for adding a new event.
+ * @param object Card following VCard format (RFC2426). Need not be NUL
+ * terminated. It is only read during the call and never copied.
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_add_object_len(const char* object,
+				  size_t len,
+				  const char* URL,
+				  runtime_info* info) {
 	carddav_settings settings;
 	CARDDAV_RESPONSE carddav_response;
 
 	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(object != NULL || len == 0, TRUE);
 
 	init_runtime(info);
 	init_carddav_settings(&settings);
-	settings.file = g_strdup(object);
+	settings.object = object;
+	settings.object_len = len;
 	settings.ACTION = ADD;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
 	if (res) {
@@ -160,8 +241,7 @@ CARDDAV_RESPONSE carddav_add_object(const char* object,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
@@ -183,27 +263,37 @@ CARDDAV_RESPONSE carddav_add_object(const char* object,
 CARDDAV_RESPONSE carddav_delete_object(const char* object,
 				     const char* URL,
 				     runtime_info* info) {
+	g_return_val_if_fail(object != NULL, TRUE);
+
+	return carddav_delete_object_len(object, strlen(object), URL, info);
+}
+
+/**
+ * Function for deleting an event.
+ * @param object Card following VCard format (RFC2426). Need not be NUL
+ * terminated. It is only read during the call and never copied.
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_delete_object_len(const char* object,
+				     size_t len,
+				     const char* URL,
+				     runtime_info* info) {
 	carddav_settings settings;
 	CARDDAV_RESPONSE carddav_response;
 
 	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(object != NULL || len == 0, TRUE);
 
 	init_runtime(info);
 	init_carddav_settings(&settings);
-	settings.file = g_strdup(object);
+	settings.object = object;
+	settings.object_len = len;
 	settings.ACTION = DELETE;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	settings.use_uri = 0;
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
@@ -218,8 +308,7 @@ CARDDAV_RESPONSE carddav_delete_object(const char* object,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
@@ -245,23 +334,14 @@ CARDDAV_RESPONSE carddav_delete_object_by_uri(const char* object,
 	CARDDAV_RESPONSE carddav_response;
 
 	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(object != NULL, TRUE);
 
 	init_runtime(info);
 	init_carddav_settings(&settings);
-	settings.file = g_strdup(object);
+	settings.object = object;
+	settings.object_len = strlen(object);
 	settings.ACTION = DELETE;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	settings.use_uri = 1;
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
@@ -276,8 +356,7 @@ CARDDAV_RESPONSE carddav_delete_object_by_uri(const char* object,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
@@ -299,27 +378,37 @@ CARDDAV_RESPONSE carddav_delete_object_by_uri(const char* object,
 CARDDAV_RESPONSE carddav_modify_object(const char* object,
 				     const char* URL,
 				     runtime_info* info) {
+	g_return_val_if_fail(object != NULL, TRUE);
+
+	return carddav_modify_object_len(object, strlen(object), URL, info);
+}
+
+/**
+ * Function for modifying an event.
+ * @param object Card following VCard format (RFC2426). Need not be NUL
+ * terminated. It is only read during the call and never copied.
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_modify_object_len(const char* object,
+				     size_t len,
+				     const char* URL,
+				     runtime_info* info) {
 	carddav_settings settings;
 	CARDDAV_RESPONSE carddav_response;
 
 	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(object != NULL || len == 0, TRUE);
 
 	init_runtime(info);
 	init_carddav_settings(&settings);
-	settings.file = g_strdup(object);
+	settings.object = object;
+	settings.object_len = len;
 	settings.ACTION = MODIFY;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	settings.use_uri = 0;
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
@@ -334,8 +423,7 @@ CARDDAV_RESPONSE carddav_modify_object(const char* object,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
@@ -361,23 +449,14 @@ CARDDAV_RESPONSE carddav_modify_object_by_uri(const char* object,
 	CARDDAV_RESPONSE carddav_response;
 
 	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(object != NULL, TRUE);
 
 	init_runtime(info);
 	init_carddav_settings(&settings);
-	settings.file = g_strdup(object);
+	settings.object = object;
+	settings.object_len = strlen(object);
 	settings.ACTION = MODIFY;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	settings.use_uri = 1;
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
@@ -392,8 +471,7 @@ CARDDAV_RESPONSE carddav_modify_object_by_uri(const char* object,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
@@ -428,29 +506,19 @@ CARDDAV_RESPONSE carddav_get_object(response *result,
 
 	init_runtime(info);
 	if (!result) {
-		result = malloc(sizeof(response *));
-		memset(result, '\0', sizeof(response *));
+		result = malloc(sizeof(response));
+		memset(result, '\0', sizeof(response));
 	}
 	init_carddav_settings(&settings);
 	settings.ACTION = GET;
 	settings.start = start;
 	settings.end = end;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
 	if (res) {
 		result->msg = NULL;
+		result->shared = NULL;
 		if (info->error->code > 0) {
 			switch (info->error->code) {
 				case 403: carddav_response = FORBIDDEN; break;
@@ -461,12 +529,14 @@ CARDDAV_RESPONSE carddav_get_object(response *result,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
-		result->msg = g_strdup(settings.file);
+		result->msg = settings.file;
+		result->shared = settings.file_owner;
+		settings.file = NULL;
+		settings.file_owner = NULL;
 		carddav_response = OK;
 	}
 	free_carddav_settings(&settings);
@@ -492,28 +562,18 @@ CARDDAV_RESPONSE carddav_getall_object(response* result,
 
 	init_runtime(info);
 	if (!result) {
-		result = malloc(sizeof(response *));
-		memset(result, '\0', sizeof(response *));
+		result = malloc(sizeof(response));
+		memset(result, '\0', sizeof(response));
 	}
 	init_carddav_settings(&settings);
 	settings.ACTION = GETALL;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	settings.use_uri = 0;
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
 	if (res) {
 		result->msg = NULL;
+		result->shared = NULL;
 		if (info->error->code > 0) {
 			switch (info->error->code) {
 				case 403: carddav_response = FORBIDDEN; break;
@@ -524,12 +584,14 @@ CARDDAV_RESPONSE carddav_getall_object(response* result,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
-		result->msg = g_strdup(settings.file);
+		result->msg = settings.file;
+		result->shared = settings.file_owner;
+		settings.file = NULL;
+		settings.file_owner = NULL;
 		carddav_response = OK;
 	}
 	free_carddav_settings(&settings);
@@ -556,28 +618,70 @@ CARDDAV_RESPONSE carddav_getall_object_by_uri(response* result,
 
 	init_runtime(info);
 	if (!result) {
-		result = malloc(sizeof(response *));
-		memset(result, '\0', sizeof(response *));
+		result = malloc(sizeof(response));
+		memset(result, '\0', sizeof(response));
 	}
 	init_carddav_settings(&settings);
 	settings.ACTION = GETALL;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	settings.use_uri = 1;
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
 	if (res) {
 		result->msg = NULL;
+		result->shared = NULL;
+		if (info->error->code > 0) {
+			switch (info->error->code) {
+				case 403: carddav_response = FORBIDDEN; break;
+				case 409: carddav_response = CONFLICT; break;
+				case 423: carddav_response = LOCKED; break;
+				case 501: carddav_response = NOTIMPLEMENTED; break;
+				default: carddav_response = CONFLICT; break;
+			}
+		}
+		else {
+			carddav_response = transfer_failure_response(info->error);
+		}
+	}
+	else {
+		result->msg = settings.file;
+		result->shared = settings.file_owner;
+		settings.file = NULL;
+		settings.file_owner = NULL;
+		carddav_response = OK;
+	}
+	free_carddav_settings(&settings);
+	return carddav_response;
+}
+
+/**
+ * Function for receiving all cards from the collection one at a time.
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param user_data Passed unchanged to callback
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_getall_foreach(const char* URL,
+				     carddav_card_func callback,
+				     void* user_data,
+				     runtime_info* info) {
+	carddav_settings settings;
+	CARDDAV_RESPONSE carddav_response;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(callback != NULL, TRUE);
+
+	init_runtime(info);
+	init_carddav_settings(&settings);
+	settings.ACTION = GETALL;
+	settings.card_func = callback;
+	settings.card_data = user_data;
+	apply_options(&settings, info->options);
+	parse_url(&settings, URL);
+	gboolean res = make_carddav_call(&settings, info);
+	if (res) {
 		if (info->error->code > 0) {
 			switch (info->error->code) {
 				case 403: carddav_response = FORBIDDEN; break;
@@ -588,18 +692,168 @@ CARDDAV_RESPONSE carddav_getall_object_by_uri(response* result,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
-		result->msg = g_strdup(settings.file);
 		carddav_response = OK;
 	}
 	free_carddav_settings(&settings);
 	return carddav_response;
 }
 
+/**
+ * Function for writing all cards from the collection to an output sink
+ * while the response is received. Cards are written in the same format
+ * carddav_getall_object() returns, without the whole collection ever
+ * being held in memory.
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param writer Function receiving the output. @see carddav_write_func
+ * @param user_data Passed unchanged to writer
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_getall_write(const char* URL,
+				     carddav_write_func writer,
+				     void* user_data,
+				     runtime_info* info) {
+	carddav_settings settings;
+	CARDDAV_RESPONSE carddav_response;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(writer != NULL, TRUE);
+
+	init_runtime(info);
+	init_carddav_settings(&settings);
+	settings.ACTION = GETALL;
+	settings.write_func = writer;
+	settings.write_data = user_data;
+	apply_options(&settings, info->options);
+	parse_url(&settings, URL);
+	gboolean res = make_carddav_call(&settings, info);
+	if (res) {
+		if (info->error->code > 0) {
+			switch (info->error->code) {
+				case 403: carddav_response = FORBIDDEN; break;
+				case 409: carddav_response = CONFLICT; break;
+				case 423: carddav_response = LOCKED; break;
+				case 501: carddav_response = NOTIMPLEMENTED; break;
+				default: carddav_response = CONFLICT; break;
+			}
+		}
+		else {
+			carddav_response = transfer_failure_response(info->error);
+		}
+	}
+	else {
+		carddav_response = OK;
+	}
+	free_carddav_settings(&settings);
+	return carddav_response;
+}
+
+/**
+ * Output sink writing to a file descriptor. Short writes and EINTR are
+ * retried. @see carddav_write_func
+ * @param data Bytes to write
+ * @param len Length of data
+ * @param fd Pointer to an int holding an open file descriptor
+ * @return 0 (zero) on success, -1 on error
+ */
+int carddav_write_fd(const char* data, size_t len, void* fd) {
+	ssize_t written;
+
+	g_return_val_if_fail(fd != NULL, -1);
+
+	while (len > 0) {
+		written = write(*(int *) fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += written;
+		len -= written;
+	}
+	return 0;
+}
+
+/**
+ * Output sink appending to a caller owned buffer. The buffer grows by
+ * doubling. @see carddav_write_func
+ * @param data Bytes to write
+ * @param len Length of data
+ * @param buffer Pointer to a carddav_buffer, zero initialized or holding
+ * data from an earlier call. @see carddav_buffer
+ * @return 0 (zero) on success, -1 if out of memory
+ */
+int carddav_write_buffer(const char* data, size_t len, void* buffer) {
+	carddav_buffer* buf = (carddav_buffer *) buffer;
+	size_t alloc;
+	char* tmp;
+
+	g_return_val_if_fail(buf != NULL, -1);
+
+	if (len > G_MAXSIZE - buf->len - 1)
+		return -1;
+	if (buf->len + len + 1 > buf->alloc) {
+		alloc = (buf->alloc) ? buf->alloc : 1024;
+		while (alloc < buf->len + len + 1)
+			alloc = (alloc > G_MAXSIZE / 2) ? buf->len + len + 1 : alloc * 2;
+		tmp = realloc(buf->data, alloc);
+		if (!tmp)
+			return -1;
+		buf->data = tmp;
+		buf->alloc = alloc;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+	return 0;
+}
+
+/**
+ * Function for storing all cards from the collection in a snapshot.
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param path Where the snapshot is to be stored. It is only replaced if
+ * all cards were received and written.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_getall_snapshot(const char* URL,
+				     const char* path,
+				     runtime_info* info) {
+	carddav_snapshot_writer* writer;
+	CARDDAV_RESPONSE carddav_response;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(path != NULL, TRUE);
+
+	init_runtime(info);
+	writer = carddav_snapshot_writer_new(path);
+	if (!writer) {
+		set_carddav_error(info->error, CARDDAV_PHASE_NONE, -1, 0, CURLE_OK,
+				"Could not create snapshot");
+		return CONFLICT;
+	}
+	carddav_response = carddav_getall_foreach(URL,
+			carddav_snapshot_add, writer, info);
+	if (carddav_response != OK) {
+		carddav_snapshot_writer_free(&writer);
+		return carddav_response;
+	}
+	if (carddav_snapshot_writer_commit(&writer) != 0) {
+		set_carddav_error(info->error, CARDDAV_PHASE_NONE, -1, 0, CURLE_OK,
+				"Could not write snapshot");
+		carddav_response = CONFLICT;
+	}
+	return carddav_response;
+}
+
 /**
  * Function for getting the stored display name for the collection.
  * @param result A pointer to struct _response where the result is to stored.
@@ -619,27 +873,17 @@ CARDDAV_RESPONSE carddav_get_displayname(response* result,
 
 	init_runtime(info);
 	if (!result) {
-		result = malloc(sizeof(response *));
-		memset(result, '\0', sizeof(response *));
+		result = malloc(sizeof(response));
+		memset(result, '\0', sizeof(response));
 	}
 	init_carddav_settings(&settings);
 	settings.ACTION = GETCALNAME;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 	parse_url(&settings, URL);
 	gboolean res = make_carddav_call(&settings, info);
 	if (res) {
 		result->msg = NULL;
+		result->shared = NULL;
 		if (info->error->code > 0) {
 			switch (info->error->code) {
 				case 403: carddav_response = FORBIDDEN; break;
@@ -650,12 +894,14 @@ CARDDAV_RESPONSE carddav_get_displayname(response* result,
 			}
 		}
 		else {
-			/* fall-back to conflicting state */
-			carddav_response = CONFLICT;
+			carddav_response = transfer_failure_response(info->error);
 		}
 	}
 	else {
-		result->msg = g_strdup(settings.file);
+		result->msg = settings.file;
+		result->shared = settings.file_owner;
+		settings.file = NULL;
+		settings.file_owner = NULL;
 		carddav_response = OK;
 	}
 	free_carddav_settings(&settings);
@@ -679,13 +925,15 @@ int carddav_enabled_resource(const char* URL, runtime_info* info) {
 
 	init_runtime(info);
 	init_carddav_settings(&settings);
+	settings.ACTION = ISCARDDAV;
 
 	parse_url(&settings, URL);
 	curl = get_curl(&settings);
 	if (!curl) {
-		info->error->code = -1;
-		info->error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(info->error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		settings.file = NULL;
+		free_carddav_settings(&settings);
 		return TRUE;
 	}
 
@@ -693,10 +941,7 @@ int carddav_enabled_resource(const char* URL, runtime_info* info) {
 		data.trace_ascii = 1;
 	else
 		data.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 
 	if (info->options->debug) {
 		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
@@ -740,12 +985,23 @@ carddav_error* carddav_get_error(carddav_error* lib_error) {
  * @param lib_error A pointer to a struct _carddav_error. @see _carddav_error
  */
 void carddav_free_error(carddav_error* lib_error) {
-	if (lib_error->str)
-		g_free(lib_error->str);
+	clear_carddav_error(lib_error);
 	g_free(lib_error);
 	lib_error = NULL;
 }
 
+/**
+ * Function for copying an error. Unlike a plain struct copy, str of the
+ * copy points to its own excerpt.
+ * @param to The error to overwrite. @see _carddav_error
+ * @param from The error to copy. @see _carddav_error
+ */
+void carddav_copy_error(carddav_error* to, const carddav_error* from) {
+	g_return_if_fail(to != NULL && from != NULL);
+
+	copy_carddav_error(to, from);
+}
+
 /**
  * Function to call to get a list of supported CardDAV options for a server
  * @param URL Defines CardDAV resource. Receiver is responsible for
@@ -756,7 +1012,7 @@ void carddav_free_error(carddav_error* lib_error) {
 char** carddav_get_server_options(const char* URL, runtime_info* info) {
 	CURL* curl;
 	carddav_settings settings;
-	response server_options;
+	response server_options = {0};
 	gchar** option_list = NULL;
 	gchar** tmp;
 	gboolean res = FALSE;
@@ -766,19 +1022,18 @@ char** carddav_get_server_options(const char* URL, runtime_info* info) {
 	init_runtime(info);
 	tmp = option_list = NULL;
 	init_carddav_settings(&settings);
+	settings.ACTION = OPTIONS;
 
 	parse_url(&settings, URL);
 	curl = get_curl(&settings);
 	if (!curl) {
-		info->error->code = -1;
-		info->error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(info->error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		settings.file = NULL;
+		free_carddav_settings(&settings);
 		return NULL;
 	}
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	apply_options(&settings, info->options);
 
 	res = carddav_getoptions(curl, &settings, &server_options, info->error, FALSE);
 	if (res) {
@@ -788,6 +1043,7 @@ char** carddav_get_server_options(const char* URL, runtime_info* info) {
 			while (*tmp) {
 				g_strstrip(*tmp++);
 			}
+			release_text(server_options.msg, server_options.shared);
 		}
 	}
 	free_carddav_settings(&settings);
@@ -821,8 +1077,7 @@ void carddav_free_runtime_info(runtime_info** info) {
     if (*info) {
 		ri = *info;
 		if (ri->error) {
-		    if (ri->error->str)
-			g_free(ri->error->str);
+		    clear_carddav_error(ri->error);
 		    g_free(ri->error);
 		    ri->error = NULL;
 		}
@@ -860,8 +1115,7 @@ void carddav_free_response(response** resp) {
 
 	if (*resp) {
 		r = *resp;
-		if (r->msg)
-			g_free(r->msg);
+		release_text(r->msg, r->shared);
 		g_free(r);
 		*resp = r = NULL;
 	}
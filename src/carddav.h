@@ -46,6 +46,40 @@
 
 #include <time.h>
 
+/*
+ * Thread safety
+ *
+ * All functions may be called from any number of threads at once.
+ * libcurl is initialized by the library, once, on first use, so callers
+ * need not call curl_global_init(). Every call uses its own transfers
+ * and per thread caches; process wide statistics are updated under a
+ * lock. Objects passed in belong to the caller: a runtime_info, response
+ * or carddav_vcard must only be used by one call at a time, and a failed
+ * call reports its error in the runtime_info it was given and nowhere
+ * else. A carddav_snapshot is read only and may be shared between
+ * threads once opened. An engine and its operations belong to the thread
+ * which created the engine; an executor may be shared.
+ */
+
+/**
+ * @typedef struct _carddav_cancel carddav_cancel
+ * Opaque cancellation token. Triggering it aborts the transfers of every
+ * operation using it. @see carddav_cancel_new()
+ */
+typedef struct _carddav_cancel carddav_cancel;
+
+/**
+ * @typedef struct _carddav_counters carddav_counters
+ * Opaque set of request counters for a session. @see carddav_counters_new()
+ */
+typedef struct _carddav_counters carddav_counters;
+
+/**
+ * @typedef struct _carddav_limiter carddav_limiter
+ * Opaque per-host request limits for a session. @see carddav_limiter_new()
+ */
+typedef struct _carddav_limiter carddav_limiter;
+
 /* For debug purposes */
 /**
  * @typedef struct debug_curl
@@ -61,8 +95,75 @@ typedef struct {
   int		verify_ssl_certificate;
   int		use_locking;
   char*		custom_cacert; 
+  size_t	max_response_size; /** @var size_t max_response_size
+					 	  * Largest response body or header block
+					 	  * accepted in bytes. 0 means no limit
+					 	  */
+  size_t	max_memory_size; /** @var size_t max_memory_size
+					 	  * Response bodies growing beyond this many
+					 	  * bytes are kept in an unlinked temporary
+					 	  * file instead of on the heap. 0 means never
+					 	  */
+  long		timeout_ms; /** @var long timeout_ms
+					 	  * Time allowed for a whole operation, all of
+					 	  * its requests included, in milliseconds.
+					 	  * 0 means no limit
+					 	  */
+  carddav_cancel* cancel; /** @var carddav_cancel* cancel
+					 	  * Token aborting the operation when triggered,
+					 	  * or NULL. @see carddav_cancel_new()
+					 	  */
+  carddav_counters* counters; /** @var carddav_counters* counters
+					 	  * Also count the requests of the operation
+					 	  * here, or NULL. @see carddav_counters_new()
+					 	  */
+  carddav_limiter* limiter; /** @var carddav_limiter* limiter
+					 	  * Limits for the requests of the operation,
+					 	  * or NULL for the global limits.
+					 	  * @see carddav_set_limits()
+					 	  */
+  int		max_retries; /** @var int max_retries
+					 	  * Times a request failing transiently is
+					 	  * repeated. 0 means the default of 3, less
+					 	  * than 0 never. Requests which may change
+					 	  * the collection are only repeated when the
+					 	  * server refused them
+					 	  */
+  long		retry_base_ms; /** @var long retry_base_ms
+					 	  * Longest wait before the first repetition
+					 	  * in milliseconds, doubling with each one.
+					 	  * The wait is random below it. 0 means 100
+					 	  */
+  long		retry_max_ms; /** @var long retry_max_ms
+					 	  * Longest wait between attempts in
+					 	  * milliseconds. A longer Retry-After ends
+					 	  * the retries. 0 means 10000
+					 	  */
 } debug_curl;
 
+/**
+ * @enum CARDDAV_PHASE specifies which step of an operation failed.
+ * NONE. Failed before talking to the server, or the step is unknown.
+ * PROBE. Checking that the URL is a CardDAV resource (OPTIONS).
+ * LOOKUP. Finding or reading cards (REPORT or PROPFIND).
+ * LOCK. Locking a card.
+ * WRITE. Storing or removing a card (PUT, POST or DELETE).
+ * UNLOCK. Unlocking a card.
+ */
+typedef enum {
+	CARDDAV_PHASE_NONE,
+	CARDDAV_PHASE_PROBE,
+	CARDDAV_PHASE_LOOKUP,
+	CARDDAV_PHASE_LOCK,
+	CARDDAV_PHASE_WRITE,
+	CARDDAV_PHASE_UNLOCK
+} CARDDAV_PHASE;
+
+/**
+ * Size of the message stored inline in a carddav_error, NUL included
+ */
+#define CARDDAV_ERROR_EXCERPT 256
+
 /**
  * @typedef struct _carddav_error carddav_error
  * Pointer to a carddav_error structure
@@ -71,7 +172,12 @@ typedef struct _carddav_error carddav_error;
 
 /**
  * @struct _carddav_error
- * A struct for storing error codes and messages
+ * A struct for storing error codes and messages. Recording an error
+ * never allocates memory: the message is a bounded excerpt of the
+ * server response or of the libcurl message, stored in the struct.
+ * Since str points into the struct itself, do not copy it by assignment
+ * or memcpy(): the copy would still point to the message of the
+ * original. Use carddav_copy_error() instead.
  */
 struct _carddav_error {
 	long code; /**
@@ -79,7 +185,26 @@ struct _carddav_error {
 				* if < 0 internal error > 0 CardDAV protocol error.
 				*/
 	char* str; /** @var char* str
-				* For storing human readable error message
+				* For storing human readable error message. Points to
+				* excerpt when set by the library, do not free it.
+				*/
+	long http_status; /** @var long http_status
+				* HTTP status of the failed request or 0 (zero) if no
+				* response was received
+				*/
+	int curl_code; /** @var int curl_code
+				* CURLcode of the failed transfer or 0 (zero)
+				*/
+	CARDDAV_PHASE phase; /** @var CARDDAV_PHASE phase
+				* Step of the operation which failed. @see CARDDAV_PHASE
+				*/
+	int retryable; /** @var int retryable
+				* 1 if the failure is likely transient (time outs,
+				* connection problems, 408, 423, 429 or 5xx) and
+				* repeating the whole call may succeed, 0 (zero) otherwise
+				*/
+	char excerpt[CARDDAV_ERROR_EXCERPT]; /** @var char excerpt
+				* NUL terminated message, truncated if longer
 				*/
 };
 
@@ -107,7 +232,12 @@ typedef struct _response response;
  */
 struct _response {
 	char* msg; /** @var char* msg
-				* String for storing response
+				* String for storing response. Identical reads running at
+				* the same time may share it, so treat it as read only and
+				* free it with carddav_free_response()
+				*/
+	void* shared; /** @var void* shared
+				* Internal. Set when msg is shared with other responses
 				*/
 };
 
@@ -140,16 +270,62 @@ typedef enum {
  * CONFLICT (HTTP 409). Conflict between current state of CardDAV collection
  * and request. Client must solve the conflict and then resend request.
  * LOCKED (HTTP 423). Locking failed.
+ * TIMEOUT. The operation ran out of its time. @see debug_curl
+ * CANCELLED. The operation was cancelled. @see carddav_cancel
  */
 typedef enum {
 	OK,
 	FORBIDDEN,
 	CONFLICT,
 	LOCKED,
-	NOTIMPLEMENTED
+	NOTIMPLEMENTED,
+	TIMEOUT,
+	CANCELLED
 } CARDDAV_RESPONSE;
 
 
+/**
+ * @typedef carddav_card_func
+ * Callback invoked once for every card received from the server.
+ * @param href The href of the card or NULL if the server sent none
+ * @param etag The entity tag of the card or NULL if the server sent none
+ * @param data The card as sent by the server, NUL terminated
+ * @param len Length of data
+ * @param user_data The pointer given to the library
+ * @return 0 (zero) to continue, non-zero to stop receiving cards
+ */
+typedef int (*carddav_card_func)(const char* href, const char* etag,
+				const char* data, size_t len, void* user_data);
+
+/**
+ * @typedef carddav_write_func
+ * Callback receiving output of the library piece by piece.
+ * @param data Bytes to write, not NUL terminated
+ * @param len Length of data
+ * @param user_data The pointer given to the library
+ * @return 0 (zero) on success, non-zero if data could not be written. The
+ * operation is aborted in that case.
+ */
+typedef int (*carddav_write_func)(const char* data, size_t len,
+				void* user_data);
+
+/**
+ * @typedef struct carddav_buffer
+ * A growable buffer owned by the caller. @see carddav_write_buffer()
+ */
+typedef struct {
+  char*		data;  /** @var char* data
+					* NUL terminated contents. Allocated with malloc(),
+					* the caller frees it with free(). May be preallocated.
+					*/
+  size_t	len;   /** @var size_t len
+					* Number of bytes in data
+					*/
+  size_t	alloc; /** @var size_t alloc
+					* Bytes allocated for data
+					*/
+} carddav_buffer;
+
 #ifndef __CARDDAV_USERAGENT
 #define __CARDDAV_USERAGENT "libcurl-agent/0.1"
 #endif
@@ -169,6 +345,22 @@ CARDDAV_RESPONSE carddav_add_object(const char* object,
 				  const char* URL,
 				  runtime_info* info);
 
+/**
+ * Function for adding a new card.
+ * @param object Card following VCard format (RFC2426). Need not be NUL
+ * terminated. It is only read during the call and never copied.
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_add_object_len(const char* object,
+				  size_t len,
+				  const char* URL,
+				  runtime_info* info);
+
 /**
  * Function for deleting a card.
  * @param object Appointment following ICal format (RFC2445). Receiver is
@@ -183,6 +375,22 @@ CARDDAV_RESPONSE carddav_delete_object(const char* object,
 				     const char* URL,
 				     runtime_info* info);
 
+/**
+ * Function for deleting a card.
+ * @param object Card following VCard format (RFC2426). Need not be NUL
+ * terminated. It is only read during the call and never copied.
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_delete_object_len(const char* object,
+				     size_t len,
+				     const char* URL,
+				     runtime_info* info);
+
 /**
  * Function for deleting a card by URI.
  * @param object Appointment following ICal format (RFC2445). Receiver is
@@ -211,6 +419,22 @@ CARDDAV_RESPONSE carddav_modify_object(const char* object,
 				     const char* URL,
 				     runtime_info* info);
 
+/**
+ * Function for modifying a card.
+ * @param object Card following VCard format (RFC2426). Need not be NUL
+ * terminated. It is only read during the call and never copied.
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_modify_object_len(const char* object,
+				     size_t len,
+				     const char* URL,
+				     runtime_info* info);
+
 /**
  * Function for modifying a card by URI.
  * @param object Appointment following ICal format (RFC2445). Receiver is
@@ -272,6 +496,65 @@ CARDDAV_RESPONSE carddav_getall_object_by_uri(response* result,
 				     const char* URL,
 				     runtime_info* info);
 
+/**
+ * Function for receiving all cards from the collection one at a time.
+ * The callback is invoked for each card while the response is still
+ * being received. All strings passed to the callback are only valid
+ * during the call.
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param user_data Passed unchanged to callback
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE. Stopping
+ * early from the callback is not an error.
+ */
+CARDDAV_RESPONSE carddav_getall_foreach(const char* URL,
+				     carddav_card_func callback,
+				     void* user_data,
+				     runtime_info* info);
+
+/**
+ * Function for writing all cards from the collection to an output sink
+ * while the response is received. Cards are written in the same format
+ * carddav_getall_object() returns, without the whole collection ever
+ * being held in memory.
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param writer Function receiving the output. @see carddav_write_func
+ * @see carddav_write_fd() @see carddav_write_buffer()
+ * @param user_data Passed unchanged to writer
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_getall_write(const char* URL,
+				     carddav_write_func writer,
+				     void* user_data,
+				     runtime_info* info);
+
+/**
+ * Output sink writing to a file descriptor. Short writes and EINTR are
+ * retried. @see carddav_write_func
+ * @param data Bytes to write
+ * @param len Length of data
+ * @param fd Pointer to an int holding an open file descriptor
+ * @return 0 (zero) on success, -1 on error
+ */
+int carddav_write_fd(const char* data, size_t len, void* fd);
+
+/**
+ * Output sink appending to a caller owned buffer. The buffer grows by
+ * doubling. @see carddav_write_func
+ * @param data Bytes to write
+ * @param len Length of data
+ * @param buffer Pointer to a carddav_buffer, zero initialized or holding
+ * data from an earlier call. @see carddav_buffer
+ * @return 0 (zero) on success, -1 if out of memory
+ */
+int carddav_write_buffer(const char* data, size_t len, void* buffer);
+
 /**
  * Function for getting the stored display name for the collection.
  * @param result A pointer to struct _response where the result is to stored.
@@ -337,6 +620,14 @@ carddav_error* carddav_get_error(carddav_error* lib_error);
  */
 void carddav_free_error(carddav_error* lib_error);
 
+/**
+ * Function for copying an error. Unlike a plain struct copy, str of the
+ * copy points to its own excerpt.
+ * @param to The error to overwrite. @see _carddav_error
+ * @param from The error to copy. @see _carddav_error
+ */
+void carddav_copy_error(carddav_error* to, const carddav_error* from);
+
 /* Setting various options in library */
 
 /**
@@ -384,4 +675,1266 @@ response* carddav_get_response();
  */
 void carddav_free_response(response** info);
 
+/* Reading cards */
+
+/**
+ * @typedef struct _carddav_vcard carddav_vcard
+ * Opaque handle to a parsed card. Properties are indexed by name while
+ * they are looked up, and a value is only unfolded when it is asked for,
+ * so reading UID never touches a PHOTO further down the card.
+ */
+typedef struct _carddav_vcard carddav_vcard;
+
+/**
+ * Function for parsing a card. The data is not copied.
+ * @param data A card following the vCard format (RFC2426). Must stay
+ * valid until the card is freed. Parsing stops at END:VCARD.
+ * @param len Length of data.
+ * @return A card handle. @see carddav_vcard_free()
+ */
+carddav_vcard* carddav_vcard_parse(const char* data, size_t len);
+
+/**
+ * Function for getting the first value of a property.
+ * @param card A card handle. @see carddav_vcard_parse()
+ * @param name Property name like "UID" or "FN". Case insensitive.
+ * Groups (item1.EMAIL) are ignored.
+ * @return The unfolded value or NULL if the property is missing. The
+ * string belongs to the card.
+ */
+const char* carddav_vcard_get(carddav_vcard* card, const char* name);
+
+/**
+ * Function for getting the n'th value of a property.
+ * @param card A card handle. @see carddav_vcard_parse()
+ * @param name Property name. Case insensitive.
+ * @param n Zero based occurrence of the property.
+ * @return The unfolded value or NULL. The string belongs to the card.
+ */
+const char* carddav_vcard_get_nth(carddav_vcard* card, const char* name, int n);
+
+/**
+ * Function for counting how many times a property occurs in a card.
+ * @param card A card handle. @see carddav_vcard_parse()
+ * @param name Property name. Case insensitive.
+ * @return Number of occurrences.
+ */
+int carddav_vcard_count(carddav_vcard* card, const char* name);
+
+/**
+ * Function for getting a parameter of a property, like TYPE of EMAIL.
+ * @param card A card handle. @see carddav_vcard_parse()
+ * @param name Property name. Case insensitive.
+ * @param n Zero based occurrence of the property.
+ * @param param Parameter name. Case insensitive.
+ * @return The parameter value without quotes or NULL. The string belongs
+ * to the card.
+ */
+const char* carddav_vcard_get_param(carddav_vcard* card,
+				const char* name, int n, const char* param);
+
+/**
+ * Function for freeing memory for a previous parsed card.
+ * @param card Address to a pointer to a card handle.
+ */
+void carddav_vcard_free(carddav_vcard** card);
+
+/* Snapshots */
+
+/**
+ * @typedef struct _carddav_snapshot_writer carddav_snapshot_writer
+ * Opaque handle to a snapshot being written.
+ * @see carddav_snapshot_writer_new()
+ */
+typedef struct _carddav_snapshot_writer carddav_snapshot_writer;
+
+/**
+ * @typedef struct _carddav_snapshot carddav_snapshot
+ * Opaque handle to a snapshot of a collection: a versioned binary file
+ * holding the cards with their hrefs and entity tags, indexed by href and
+ * UID. It is mapped into memory when opened and used without parsing.
+ */
+typedef struct _carddav_snapshot carddav_snapshot;
+
+/**
+ * Function for starting a new snapshot. Cards are written to a
+ * temporary file in the same directory as they are added, so memory use
+ * does not grow with the size of the cards.
+ * @param path Where the snapshot is to be stored. An existing snapshot
+ * is only replaced by carddav_snapshot_writer_commit().
+ * @return A writer or NULL if the temporary file could not be created.
+ */
+carddav_snapshot_writer* carddav_snapshot_writer_new(const char* path);
+
+/**
+ * Function for adding a card to a snapshot. Has the signature of
+ * carddav_card_func, so a writer can be handed directly to
+ * carddav_getall_foreach().
+ * @param href The href of the card or NULL
+ * @param etag The entity tag of the card or NULL
+ * @param data The card
+ * @param len Length of data
+ * @param writer A carddav_snapshot_writer
+ * @return 0 (zero) on success, -1 on a write error
+ */
+int carddav_snapshot_add(const char* href, const char* etag,
+				const char* data, size_t len, void* writer);
+
+/**
+ * Function for finishing a snapshot. The indexes are written, the file
+ * is synced to disk and renamed over the path given to
+ * carddav_snapshot_writer_new(), so readers see either the old or the new
+ * snapshot. The writer is freed in any case.
+ * @param writer Address to a pointer to a writer
+ * @return 0 (zero) on success, -1 if the snapshot could not be written
+ */
+int carddav_snapshot_writer_commit(carddav_snapshot_writer** writer);
+
+/**
+ * Function for abandoning a snapshot. The temporary file is removed and
+ * an existing snapshot is left alone.
+ * @param writer Address to a pointer to a writer
+ */
+void carddav_snapshot_writer_free(carddav_snapshot_writer** writer);
+
+/**
+ * Function for storing all cards from the collection in a snapshot.
+ * @param URL Defines CardDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param path Where the snapshot is to be stored. It is only replaced if
+ * all cards were received and written.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_getall_snapshot(const char* URL,
+				     const char* path,
+				     runtime_info* info);
+
+/**
+ * Function for opening a snapshot. The file is mapped and only its
+ * header is checked; nothing is parsed or copied.
+ * @param path A file written by carddav_snapshot_writer_commit()
+ * @return A snapshot or NULL if the file is missing, damaged or was
+ * written by an incompatible version or host.
+ * @see carddav_snapshot_close()
+ */
+carddav_snapshot* carddav_snapshot_open(const char* path);
+
+/**
+ * Function for closing a snapshot. Strings returned from it become
+ * invalid.
+ * @param snapshot Address to a pointer to a snapshot
+ */
+void carddav_snapshot_close(carddav_snapshot** snapshot);
+
+/**
+ * Function for counting the cards in a snapshot.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @return Number of cards
+ */
+size_t carddav_snapshot_count(carddav_snapshot* snapshot);
+
+/**
+ * Function for getting a card of a snapshot. Cards are numbered in
+ * href order.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @param n Zero based number of the card
+ * @param href Set to the href or NULL if not NULL
+ * @param etag Set to the entity tag or NULL if not NULL
+ * @param len Set to the length of the card if not NULL
+ * @return The NUL terminated card or NULL if n is out of range. The
+ * strings stay valid until the snapshot is closed.
+ */
+const char* carddav_snapshot_get(carddav_snapshot* snapshot, size_t n,
+				const char** href, const char** etag, size_t* len);
+
+/**
+ * Function for finding a card by its href.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @param href The href of the card
+ * @param n Set to the number of the card if found
+ * @return 1 if the card was found, 0 (zero) otherwise
+ */
+int carddav_snapshot_find_href(carddav_snapshot* snapshot,
+				const char* href, size_t* n);
+
+/**
+ * Function for finding a card by its UID.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @param uid The UID of the card
+ * @param n Set to the number of the card if found
+ * @return 1 if the card was found, 0 (zero) otherwise
+ */
+int carddav_snapshot_find_uid(carddav_snapshot* snapshot,
+				const char* uid, size_t* n);
+
+/**
+ * Function for visiting every card of a snapshot in href order.
+ * @param snapshot A snapshot. @see carddav_snapshot_open()
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param user_data Passed unchanged to callback
+ * @return 0 (zero) if all cards were visited, otherwise the value which
+ * stopped the callback
+ */
+int carddav_snapshot_foreach(carddav_snapshot* snapshot,
+				carddav_card_func callback, void* user_data);
+
+/* Memory statistics */
+
+/**
+ * @enum CARDDAV_MEM specifies what counted memory is used for.
+ * RECEIVE. Buffers holding response bodies and headers as they arrive.
+ * PARSE. Copies made while taking responses apart: hrefs, entity tags,
+ * request bodies and cards handed to output sinks.
+ * RESULT. Strings returned to the caller, like the cards collected by
+ * carddav_getall_object().
+ */
+typedef enum {
+	CARDDAV_MEM_RECEIVE,
+	CARDDAV_MEM_PARSE,
+	CARDDAV_MEM_RESULT,
+	CARDDAV_MEM_CATEGORIES
+} CARDDAV_MEM;
+
+/**
+ * @typedef struct carddav_mem_stats
+ * Memory used by all calls of one operation type. Arrays are indexed by
+ * CARDDAV_MEM. Buffers reused from per thread caches are only counted
+ * by the call which allocated them.
+ */
+typedef struct {
+  unsigned long	calls; /** @var unsigned long calls
+					 	  * Number of calls recorded
+					 	  */
+  unsigned long	allocations[CARDDAV_MEM_CATEGORIES]; /** @var allocations
+					 	  * Number of allocations and reallocations
+					 	  * which grew memory
+					 	  */
+  unsigned long long bytes[CARDDAV_MEM_CATEGORIES]; /** @var bytes
+					 	  * Bytes allocated in total
+					 	  */
+  size_t	peak; /** @var size_t peak
+					 	  * Highest number of bytes live at once during
+					 	  * a single call
+					 	  */
+  size_t	category_peak[CARDDAV_MEM_CATEGORIES]; /** @var category_peak
+					 	  * Like peak, for each category on its own
+					 	  */
+} carddav_mem_stats;
+
+/**
+ * Function for getting memory statistics of an operation type, counted
+ * since the process started or since carddav_reset_mem_stats().
+ * @param action The operation. @see CARDDAV_ACTION
+ * @param stats Filled with the statistics. @see carddav_mem_stats
+ */
+void carddav_get_mem_stats(CARDDAV_ACTION action, carddav_mem_stats* stats);
+
+/**
+ * Function for clearing the memory statistics of all operation types.
+ */
+void carddav_reset_mem_stats(void);
+
+/* Request statistics */
+
+/**
+ * @enum CARDDAV_METHOD specifies the HTTP methods the library sends.
+ */
+typedef enum {
+	CARDDAV_METHOD_OPTIONS,
+	CARDDAV_METHOD_GET,
+	CARDDAV_METHOD_PUT,
+	CARDDAV_METHOD_DELETE,
+	CARDDAV_METHOD_PROPFIND,
+	CARDDAV_METHOD_REPORT,
+	CARDDAV_METHOD_LOCK,
+	CARDDAV_METHOD_UNLOCK,
+	CARDDAV_METHODS
+} CARDDAV_METHOD;
+
+/**
+ * Number of entries in carddav_stats.responses: no response, then the
+ * status classes 1xx to 5xx
+ */
+#define CARDDAV_STATUS_CLASSES 6
+
+/**
+ * @typedef struct carddav_stats
+ * Snapshot of request counters. Counters are updated with atomic
+ * operations as requests finish and read one by one, so a snapshot
+ * taken while requests run may be off by the requests in flight.
+ */
+typedef struct {
+  unsigned long long requests[CARDDAV_METHODS]; /** @var requests
+					 	  * Requests sent, indexed by CARDDAV_METHOD
+					 	  */
+  unsigned long long responses[CARDDAV_STATUS_CLASSES]; /** @var responses
+					 	  * Requests by outcome: [0] got no response,
+					 	  * [1] to [5] got a 1xx to 5xx status
+					 	  */
+  unsigned long long bytes_sent; /** @var bytes_sent
+					 	  * Request headers and bodies
+					 	  */
+  unsigned long long bytes_received; /** @var bytes_received
+					 	  * Response headers and bodies
+					 	  */
+  unsigned long long retries; /** @var retries
+					 	  * Requests repeated after a transient failure
+					 	  */
+  unsigned long long locks; /** @var locks
+					 	  * Locks acquired on cards
+					 	  */
+  unsigned long long connections_new; /** @var connections_new
+					 	  * Connections opened
+					 	  */
+  unsigned long long connections_reused; /** @var connections_reused
+					 	  * Requests sent on a connection kept from
+					 	  * an earlier request
+					 	  */
+  unsigned long long parsed; /** @var parsed
+					 	  * Multistatus response elements parsed
+					 	  */
+  unsigned long long parse_time_us; /** @var parse_time_us
+					 	  * Microseconds spent parsing them, callbacks
+					 	  * receiving the cards excluded
+					 	  */
+  unsigned long long coalesced; /** @var coalesced
+					 	  * Operations and probes which took the
+					 	  * outcome of an identical one in flight
+					 	  * instead of sending requests of their own
+					 	  */
+} carddav_stats;
+
+/**
+ * Function for getting the request counters of the whole process,
+ * counted since it started or since carddav_reset_stats().
+ * @param stats Filled with the counters. @see carddav_stats
+ */
+void carddav_get_stats(carddav_stats* stats);
+
+/**
+ * Function for clearing the request counters of the whole process.
+ */
+void carddav_reset_stats(void);
+
+/**
+ * Function for creating a set of counters for a session. Operations
+ * whose runtime_info options point to it count their requests there as
+ * well as in the process wide counters. It may be shared by any number
+ * of threads.
+ * @return New counters, all zero. Free them with carddav_counters_free().
+ */
+carddav_counters* carddav_counters_new(void);
+
+/**
+ * Function for freeing a set of counters. No operation may use it any
+ * longer.
+ * @param counters Address to a pointer to counters
+ */
+void carddav_counters_free(carddav_counters** counters);
+
+/**
+ * Function for reading a set of counters.
+ * @param counters Counters. @see carddav_counters_new()
+ * @param stats Filled with the counters. @see carddav_stats
+ */
+void carddav_counters_get(carddav_counters* counters, carddav_stats* stats);
+
+/* Rate limiting */
+
+/**
+ * Function for creating limits which sessions may share. Each host gets
+ * a token bucket of burst requests, refilled at rate requests per
+ * second, and at most max_in_flight of its requests run at a time. A
+ * request waits until both allow it, or until its operation times out
+ * or is cancelled.
+ * @param rate Requests per second, 0 (zero) for no rate limit
+ * @param burst Requests which may be sent at once after an idle period.
+ * Less than 1 is taken as 1
+ * @param max_in_flight Concurrent requests, 0 (zero) for no limit
+ * @return New limits. Free them with carddav_limiter_free() once no
+ * operation uses them.
+ */
+carddav_limiter* carddav_limiter_new(double rate, unsigned burst,
+		unsigned max_in_flight);
+
+/**
+ * Function for freeing limits.
+ * @param limiter Address to a pointer to limits
+ */
+void carddav_limiter_free(carddav_limiter** limiter);
+
+/**
+ * Function for changing limits while operations use them. Requests
+ * waiting are re-evaluated under the new limits.
+ * @param limiter Limits. @see carddav_limiter_new()
+ * @param rate @see carddav_limiter_new()
+ * @param burst @see carddav_limiter_new()
+ * @param max_in_flight @see carddav_limiter_new()
+ */
+void carddav_limiter_set(carddav_limiter* limiter, double rate,
+		unsigned burst, unsigned max_in_flight);
+
+/**
+ * Function for setting the limits applied to every host by operations
+ * whose debug_curl.limiter is NULL. There are none by default.
+ * @param rate @see carddav_limiter_new()
+ * @param burst @see carddav_limiter_new()
+ * @param max_in_flight @see carddav_limiter_new()
+ */
+void carddav_set_limits(double rate, unsigned burst, unsigned max_in_flight);
+
+/* Cancellation */
+
+/**
+ * Function for creating a cancellation token. Set it in the options of
+ * a runtime_info to make the operations using it cancellable. A
+ * cancelled operation returns CANCELLED. Transfers waiting for the
+ * server notice within about a second.
+ * @return A new token which has not been triggered. Free it with
+ * carddav_cancel_free().
+ */
+carddav_cancel* carddav_cancel_new(void);
+
+/**
+ * Function for freeing a cancellation token. No operation may use it
+ * any longer.
+ * @param cancel Address to a pointer to a token
+ */
+void carddav_cancel_free(carddav_cancel** cancel);
+
+/**
+ * Function for cancelling every operation using a token. May be called
+ * from any thread, including from a callback of the library.
+ * @param cancel A token. @see carddav_cancel_new()
+ */
+void carddav_cancel_trigger(carddav_cancel* cancel);
+
+/**
+ * Function for checking whether a token was triggered.
+ * @param cancel A token. @see carddav_cancel_new()
+ * @return 1 if triggered, 0 (zero) otherwise
+ */
+int carddav_cancel_requested(carddav_cancel* cancel);
+
+/**
+ * Function for making a triggered token usable again. Must not be
+ * called while an operation uses it.
+ * @param cancel A token. @see carddav_cancel_new()
+ */
+void carddav_cancel_reset(carddav_cancel* cancel);
+
+/* Asynchronous operations */
+
+/**
+ * @typedef struct _carddav_engine carddav_engine
+ * Opaque handle driving asynchronous operations from an event loop. The
+ * engine tells the loop which sockets to watch and when to time out
+ * through callbacks; the loop reports activity back with
+ * carddav_engine_socket_action(). An engine and its operations must only
+ * be used from the thread which created it.
+ *
+ * Each operation runs on a stack of its own, CARDDAV_ENGINE_STACK_SIZE
+ * bytes unless changed with carddav_engine_set_stack_size(). The
+ * carddav_card_func and carddav_write_func callbacks of an operation run
+ * on that stack too. It is not grown: a callback using more stack than
+ * is left, through large local arrays or deep recursion, hits a guard
+ * page and the process is killed with SIGSEGV.
+ */
+typedef struct _carddav_engine carddav_engine;
+
+/**
+ * Default size of the stack of an asynchronous operation in bytes
+ */
+#define CARDDAV_ENGINE_STACK_SIZE (256 * 1024)
+
+/**
+ * @enum CARDDAV_POLL specifies socket activity.
+ * IN. Wait for the socket to become readable.
+ * OUT. Wait for the socket to become writable.
+ * INOUT. Wait for both.
+ * REMOVE. Stop watching the socket.
+ * ERR. An error condition on the socket, only used when reporting
+ * activity to carddav_engine_socket_action().
+ */
+typedef enum {
+	CARDDAV_POLL_IN = 1,
+	CARDDAV_POLL_OUT = 2,
+	CARDDAV_POLL_INOUT = 3,
+	CARDDAV_POLL_REMOVE = 4,
+	CARDDAV_POLL_ERR = 8
+} CARDDAV_POLL;
+
+/**
+ * Passed to carddav_engine_socket_action() instead of a socket when the
+ * timer expired
+ */
+#define CARDDAV_SOCKET_TIMEOUT (-1)
+
+/**
+ * @typedef carddav_socket_func
+ * Callback asking the event loop to change what it watches on a socket.
+ * Besides the sockets of transfers the engine may have a pipe of its own
+ * watched, through which other threads wake it. Its activity is reported
+ * like that of any socket.
+ * @param fd The socket
+ * @param what Activity to wait for or CARDDAV_POLL_REMOVE. @see CARDDAV_POLL
+ * @param user_data The pointer given to carddav_engine_new()
+ */
+typedef void (*carddav_socket_func)(int fd, CARDDAV_POLL what,
+				void* user_data);
+
+/**
+ * @typedef carddav_timer_func
+ * Callback asking the event loop to (re)arm its single timer for the
+ * engine. When it expires the loop calls carddav_engine_socket_action()
+ * with CARDDAV_SOCKET_TIMEOUT.
+ * @param timeout_ms Milliseconds from now, 0 (zero) for as soon as
+ * possible or -1 to stop the timer
+ * @param user_data The pointer given to carddav_engine_new()
+ */
+typedef void (*carddav_timer_func)(long timeout_ms, void* user_data);
+
+/**
+ * @typedef carddav_done_func
+ * Callback invoked once when an asynchronous operation has finished.
+ * It is never invoked from within the call starting the operation.
+ * @param result What the blocking variant of the operation would have
+ * returned. @see CARDDAV_RESPONSE
+ * @param user_data The pointer given when the operation was started
+ */
+typedef void (*carddav_done_func)(CARDDAV_RESPONSE result, void* user_data);
+
+/**
+ * Function for creating an engine.
+ * @param socket_func Called when sockets are to be watched or released.
+ * @see carddav_socket_func
+ * @param timer_func Called when the timer is to be changed.
+ * @see carddav_timer_func
+ * @param user_data Passed unchanged to socket_func and timer_func
+ * @return A new engine or NULL if libcurl could not be initialized. Free
+ * it with carddav_engine_free().
+ */
+carddav_engine* carddav_engine_new(carddav_socket_func socket_func,
+				carddav_timer_func timer_func,
+				void* user_data);
+
+/**
+ * Function for freeing an engine. Operations still running are aborted
+ * and their callbacks invoked with CANCELLED before this function returns.
+ * @param engine Address to a pointer to an engine
+ */
+void carddav_engine_free(carddav_engine** engine);
+
+/**
+ * Function reporting socket activity or an expired timer to an engine.
+ * Operations advance and completion callbacks are invoked from here.
+ * Must not be called from a callback of the library.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param fd The active socket or CARDDAV_SOCKET_TIMEOUT
+ * @param events CARDDAV_POLL_IN, CARDDAV_POLL_OUT and CARDDAV_POLL_ERR
+ * or'ed together, 0 (zero) for a timeout
+ */
+void carddav_engine_socket_action(carddav_engine* engine, int fd, int events);
+
+/**
+ * Function for getting the number of operations which have not invoked
+ * their callback yet.
+ * @param engine An engine. @see carddav_engine_new()
+ * @return Number of unfinished operations
+ */
+int carddav_engine_running(carddav_engine* engine);
+
+/**
+ * Function for changing the stack size of operations started on an
+ * engine from now on. Raise it when the callbacks of an operation need
+ * much stack. @see carddav_engine
+ * @param engine An engine. @see carddav_engine_new()
+ * @param size Usable stack in bytes. Rounded up to whole pages and to at
+ * least CARDDAV_ENGINE_STACK_SIZE / 4
+ */
+void carddav_engine_set_stack_size(carddav_engine* engine, size_t size);
+
+struct _GMainContext;
+
+/**
+ * Function for creating an engine driven by a GMainContext. The engine
+ * attaches a source to the context which watches its sockets and
+ * timer, so operations advance and their callbacks are invoked while
+ * the context is iterated. Use the engine from the thread iterating the
+ * context only.
+ * @param context A GMainContext or NULL for the default context
+ * @return A new engine or NULL if libcurl could not be initialized. Free
+ * it with carddav_engine_free(), which also removes the source.
+ */
+carddav_engine* carddav_engine_new_with_context(struct _GMainContext* context);
+
+/*
+ * Each asynchronous variant below starts the operation of the same name
+ * and returns at once. Cards and URLs are copied. info, result and any
+ * callback data must stay valid until done has been invoked. All return
+ * 0 (zero) if the operation was started, in which case done is invoked
+ * exactly once, and -1 otherwise.
+ */
+
+/**
+ * Start carddav_add_object_len() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_add_object_async(carddav_engine* engine,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_delete_object_len() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_delete_object_async(carddav_engine* engine,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_delete_object_by_uri() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_delete_object_by_uri_async(carddav_engine* engine,
+				const char* object,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_modify_object_len() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_modify_object_async(carddav_engine* engine,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_modify_object_by_uri() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_modify_object_by_uri_async(carddav_engine* engine,
+				const char* object,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_get_object() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param result Receives the cards. @see response
+ * @param start Start of the range
+ * @param end End of the range
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_get_object_async(carddav_engine* engine, response* result,
+				time_t start, time_t end,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_getall_object() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_object_async(carddav_engine* engine, response* result,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_getall_object_by_uri() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_object_by_uri_async(carddav_engine* engine,
+				response* result,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_getall_foreach() on an engine. The callback is invoked
+ * from carddav_engine_socket_action() as cards arrive.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param callback_data Passed unchanged to callback
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_foreach_async(carddav_engine* engine,
+				const char* URL,
+				carddav_card_func callback, void* callback_data,
+				runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_getall_write() on an engine. The writer is invoked
+ * from carddav_engine_socket_action() as cards arrive.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param writer Function receiving the output. @see carddav_write_func
+ * @param writer_data Passed unchanged to writer
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_write_async(carddav_engine* engine,
+				const char* URL,
+				carddav_write_func writer, void* writer_data,
+				runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_getall_snapshot() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param path File the snapshot is written to
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_getall_snapshot_async(carddav_engine* engine,
+				const char* URL, const char* path,
+				runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_get_displayname() on an engine.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param result Receives the display name. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_get_displayname_async(carddav_engine* engine, response* result,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_enabled_resource() on an engine. done receives OK if the
+ * resource is CardDAV enabled and NOTIMPLEMENTED otherwise.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_enabled_resource_async(carddav_engine* engine,
+				const char* URL, runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/**
+ * Start carddav_get_server_options() on an engine. done receives OK if
+ * options were stored and CONFLICT otherwise.
+ * @param engine An engine. @see carddav_engine_new()
+ * @param URL Defines CardDAV resource.
+ * @param options Set to the list of options, or NULL, before done is
+ * invoked. Caller frees it like the result of carddav_get_server_options()
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @param done Invoked when finished. @see carddav_done_func
+ * @param user_data Passed unchanged to done
+ * @return 0 (zero) if started, -1 otherwise
+ */
+int carddav_get_server_options_async(carddav_engine* engine,
+				const char* URL, char*** options,
+				runtime_info* info,
+				carddav_done_func done, void* user_data);
+
+/* Worker pool */
+
+/**
+ * @typedef struct _carddav_executor carddav_executor
+ * Opaque handle to a fixed pool of worker threads running blocking
+ * operations. Submitting returns at once with a task to wait on, as
+ * long as the bounded queue has room; otherwise it blocks. Each worker
+ * keeps its connections alive between operations. An executor may be
+ * used from any number of threads at once.
+ */
+typedef struct _carddav_executor carddav_executor;
+
+/**
+ * @typedef struct _carddav_task carddav_task
+ * Opaque handle to an operation submitted to an executor. A task belongs
+ * to the thread which submitted it until freed.
+ */
+typedef struct _carddav_task carddav_task;
+
+/**
+ * Function for creating a pool of worker threads running operations.
+ * Each worker keeps its own connections alive between operations.
+ * @param threads Number of workers, 0 (zero) or less for one per
+ * processor
+ * @param queue_size Operations which may wait for a worker before
+ * submitting blocks, 0 (zero) or less for four per worker
+ * @return A new executor or NULL if no worker could be started. Free it
+ * with carddav_executor_free().
+ */
+carddav_executor* carddav_executor_new(int threads, int queue_size);
+
+/**
+ * Function for freeing an executor. Operations already submitted run to
+ * their end, then the workers exit. Submissions waiting for room in the
+ * queue return NULL, and this function waits until they have left.
+ * Starting a submission once this has been called is undefined, as the
+ * executor may already be gone. Must not be called from a worker.
+ * @param executor Address to a pointer to an executor
+ */
+void carddav_executor_free(carddav_executor** executor);
+
+/*
+ * Each variant below submits the operation of the same name to an
+ * executor. Cards, URLs and paths are copied. info, result and any
+ * callback data must stay valid until the task is done, and info must
+ * not be shared with other running operations. All return a task, to be
+ * freed with carddav_task_free(), or NULL if the executor is closing.
+ */
+
+/**
+ * Submit carddav_add_object_len() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_add_object_submit(carddav_executor* executor,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_delete_object_len() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_delete_object_submit(carddav_executor* executor,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_delete_object_by_uri() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_delete_object_by_uri_submit(carddav_executor* executor,
+				const char* object,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_modify_object_len() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_modify_object_submit(carddav_executor* executor,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_modify_object_by_uri() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_modify_object_by_uri_submit(carddav_executor* executor,
+				const char* object,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_get_object() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param result Receives the cards. @see response
+ * @param start Start of the range
+ * @param end End of the range
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_get_object_submit(carddav_executor* executor,
+				response* result, time_t start, time_t end,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_getall_object() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_object_submit(carddav_executor* executor,
+				response* result,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_getall_object_by_uri() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_object_by_uri_submit(carddav_executor* executor,
+				response* result,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_getall_foreach() to an executor. The callback is
+ * invoked from a worker thread.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param callback Function invoked for each card. @see carddav_card_func
+ * @param callback_data Passed unchanged to callback
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_foreach_submit(carddav_executor* executor,
+				const char* URL,
+				carddav_card_func callback, void* callback_data,
+				runtime_info* info);
+
+/**
+ * Submit carddav_getall_write() to an executor. The writer is invoked
+ * from a worker thread.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param writer Function receiving the output. @see carddav_write_func
+ * @param writer_data Passed unchanged to writer
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_write_submit(carddav_executor* executor,
+				const char* URL,
+				carddav_write_func writer, void* writer_data,
+				runtime_info* info);
+
+/**
+ * Submit carddav_getall_snapshot() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param path File the snapshot is written to
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_getall_snapshot_submit(carddav_executor* executor,
+				const char* URL, const char* path,
+				runtime_info* info);
+
+/**
+ * Submit carddav_get_displayname() to an executor.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param result Receives the display name. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_get_displayname_submit(carddav_executor* executor,
+				response* result,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_enabled_resource() to an executor. The task yields OK
+ * if the resource is CardDAV enabled and NOTIMPLEMENTED otherwise.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_enabled_resource_submit(carddav_executor* executor,
+				const char* URL, runtime_info* info);
+
+/**
+ * Submit carddav_get_server_options() to an executor. The task yields OK
+ * if options were stored and CONFLICT otherwise.
+ * @param executor An executor. @see carddav_executor_new()
+ * @param URL Defines CardDAV resource.
+ * @param options Set to the list of options, or NULL, before the task
+ * is done. Caller frees it like the result of carddav_get_server_options()
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return A task or NULL if not submitted
+ */
+carddav_task* carddav_get_server_options_submit(carddav_executor* executor,
+				const char* URL, char*** options,
+				runtime_info* info);
+
+/**
+ * Function waiting for a task to finish.
+ * @param task A task. @see carddav_executor_new()
+ * @return What the blocking variant of the operation returned.
+ * @see CARDDAV_RESPONSE
+ */
+CARDDAV_RESPONSE carddav_task_wait(carddav_task* task);
+
+/**
+ * Function checking whether a task has finished, without waiting.
+ * @param task A task. @see carddav_executor_new()
+ * @return 1 if finished, 0 (zero) otherwise
+ */
+int carddav_task_done(carddav_task* task);
+
+/**
+ * Function for freeing a task. Waits for the task to finish first, since
+ * it still uses the arguments it was submitted with.
+ * @param task Address to a pointer to a task
+ */
+void carddav_task_free(carddav_task** task);
+
+/* Batches */
+
+/**
+ * @typedef struct _carddav_batch carddav_batch
+ * Opaque handle to operations running at the same time on one thread,
+ * waited on together. Items are numbered from 0 (zero) in the order
+ * they were added. Cards and URLs are copied; info and result must stay
+ * valid until the item has finished, and info must not be shared with
+ * other running items.
+ */
+typedef struct _carddav_batch carddav_batch;
+
+/**
+ * Function for creating a batch. Operations added to it run at the same
+ * time on its own engine, which only advances while the batch is waited
+ * on. A batch must only be used from the thread which created it.
+ * @return A new batch or NULL if libcurl could not be initialized. Free
+ * it with carddav_batch_free().
+ */
+carddav_batch* carddav_batch_new(void);
+
+/**
+ * Function for freeing a batch. Operations still running are aborted and
+ * finish with CANCELLED.
+ * @param batch Address to a pointer to a batch
+ */
+void carddav_batch_free(carddav_batch** batch);
+
+/**
+ * Add carddav_add_object_len() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_add_object(carddav_batch* batch,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info);
+
+/**
+ * Add carddav_delete_object_len() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_delete_object(carddav_batch* batch,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info);
+
+/**
+ * Add carddav_delete_object_by_uri() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_delete_object_by_uri(carddav_batch* batch,
+				const char* object,
+				const char* URL, runtime_info* info);
+
+/**
+ * Add carddav_modify_object_len() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card following VCard format (RFC2426), need not be NUL
+ * terminated
+ * @param len Length of object in bytes
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_modify_object(carddav_batch* batch,
+				const char* object, size_t len,
+				const char* URL, runtime_info* info);
+
+/**
+ * Add carddav_modify_object_by_uri() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param object Card carrying its URI. @see carddav_getall_object_by_uri()
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_modify_object_by_uri(carddav_batch* batch,
+				const char* object,
+				const char* URL, runtime_info* info);
+
+/**
+ * Add carddav_get_object() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param result Receives the cards. @see response
+ * @param start Start of the range
+ * @param end End of the range
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_get_object(carddav_batch* batch, response* result,
+				time_t start, time_t end,
+				const char* URL, runtime_info* info);
+
+/**
+ * Add carddav_getall_object() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_getall_object(carddav_batch* batch, response* result,
+				const char* URL, runtime_info* info);
+
+/**
+ * Add carddav_getall_object_by_uri() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param result Receives the cards. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_getall_object_by_uri(carddav_batch* batch,
+				response* result,
+				const char* URL, runtime_info* info);
+
+/**
+ * Add carddav_get_displayname() to a batch.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param result Receives the display name. @see response
+ * @param URL Defines CardDAV resource.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Index of the item or -1 if not started
+ */
+int carddav_batch_get_displayname(carddav_batch* batch, response* result,
+				const char* URL, runtime_info* info);
+
+/**
+ * Function waiting until an item of a batch finishes. Each finished item
+ * is returned once, in the order the items finished, so new items can
+ * be added as others complete.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param timeout_ms Longest wait in milliseconds, -1 for no limit, 0 (zero)
+ * to advance the items without blocking
+ * @return Index of a finished item, or -1 if the time ran out or every
+ * item has been returned already
+ */
+int carddav_batch_wait_any(carddav_batch* batch, long timeout_ms);
+
+/**
+ * Function waiting until every item of a batch has finished.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param timeout_ms Longest wait in milliseconds, -1 for no limit, 0 (zero)
+ * to advance the items without blocking
+ * @return 0 (zero) if all items finished, -1 if the time ran out
+ */
+int carddav_batch_wait_all(carddav_batch* batch, long timeout_ms);
+
+/**
+ * Function for getting the result of an item.
+ * @param batch A batch. @see carddav_batch_new()
+ * @param item Index returned when the item was added
+ * @param result Set to what the blocking variant of the operation
+ * returned, if the item has finished. @see CARDDAV_RESPONSE
+ * @return 1 if the item has finished, 0 (zero) otherwise
+ */
+int carddav_batch_result(carddav_batch* batch, int item,
+				CARDDAV_RESPONSE* result);
+
+/**
+ * Function for getting the number of items of a batch which have not
+ * finished.
+ * @param batch A batch. @see carddav_batch_new()
+ * @return Number of unfinished items
+ */
+int carddav_batch_running(carddav_batch* batch);
+
 #endif
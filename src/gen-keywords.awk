@@ -0,0 +1,151 @@
+# Generate a perfect hash for a list of keywords.
+#
+# Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# Usage: awk -v prefix=vcard -f gen-keywords.awk vcard-keywords.list
+#
+# The list holds one keyword per line. Empty lines and lines starting
+# with '#' are ignored. The output is a header defining an enum with one
+# member per keyword and an inline lookup function mapping a name,
+# ignoring ASCII case, to its member in a few instructions:
+#
+#   h = 0; for each byte c: h = h * 31 + (c | 0x20)     (mod 2^32)
+#   slot = (h * multiplier mod 2^32) >> (32 - bits)
+#
+# Multipliers are tried until no two keywords share a slot. The table
+# entry is compared against the name afterwards, so names which are not
+# keywords map to <PREFIX>_UNKNOWN. awk has no 64 bit integers, so the
+# products are computed on 16 bit halves to stay exact in a double.
+
+function lowbyte(c,    x) {
+	x = ord[c]
+	if (int(x / 32) % 2 == 0)
+		x += 32
+	return x
+}
+
+# a * b mod 2^32 for a, b < 2^32
+function mul32(a, b,    hi, lo) {
+	hi = int(a / 65536)
+	lo = a % 65536
+	return ((hi * b) % 65536 * 65536 + lo * b) % 4294967296
+}
+
+BEGIN {
+	if (prefix == "") {
+		print "gen-keywords.awk: prefix is not set" > "/dev/stderr"
+		exit 1
+	}
+	PREFIX = toupper(prefix)
+	for (i = 1; i < 128; i++)
+		ord[sprintf("%c", i)] = i
+	n = 0
+}
+
+/^[ \t]*(#|$)/ { next }
+
+{
+	word = $1
+	if (word in seen) {
+		printf("gen-keywords.awk: %s listed twice\n", word) > "/dev/stderr"
+		exit 1
+	}
+	seen[word] = 1
+	n++
+	key[n] = word
+	len[n] = length(word)
+	hash[n] = 0
+	for (i = 1; i <= len[n]; i++)
+		hash[n] = (hash[n] * 31 + lowbyte(substr(word, i, 1))) % 4294967296
+}
+
+END {
+	if (n == 0 || n > 254) {
+		print "gen-keywords.awk: need between 1 and 254 keywords" > "/dev/stderr"
+		exit 1
+	}
+	bits = 1
+	while (2 ^ bits < 2 * n)
+		bits++
+	found = 0
+	while (!found && bits <= 12) {
+		div = 2 ^ (32 - bits)
+		x = 1
+		for (try = 0; try < 100000 && !found; try++) {
+			x = (x * 69069 + 1) % 4294967296
+			mult = (x % 2) ? x : x + 1
+			split("", used)
+			found = 1
+			for (k = 1; k <= n; k++) {
+				s = int(mul32(hash[k], mult) / div)
+				if (s in used) {
+					found = 0
+					break
+				}
+				used[s] = k
+			}
+		}
+		if (!found)
+			bits++
+	}
+	if (!found) {
+		print "gen-keywords.awk: no perfect hash found" > "/dev/stderr"
+		exit 1
+	}
+	size = 2 ^ bits
+	guard = "__" PREFIX "_KEYWORDS_H__"
+
+	list = FILENAME
+	sub(/.*\//, "", list)
+	printf("/* Generated by gen-keywords.awk from %s. Do not edit. */\n\n",
+			list)
+	printf("#ifndef %s\n#define %s\n\n#include <glib.h>\n\n", guard, guard)
+
+	printf("/**\n * @enum %s_keyword\n", prefix)
+	printf(" * Keywords recognized by %s_keyword_lookup()\n */\n", prefix)
+	printf("typedef enum {\n\t%s_UNKNOWN = 0,\n", PREFIX)
+	for (k = 1; k <= n; k++) {
+		id = toupper(key[k])
+		gsub(/[^A-Z0-9]/, "_", id)
+		printf("\t%s_%s,\n", PREFIX, id)
+	}
+	printf("\t%s_KEYWORDS\n} %s_keyword;\n\n", PREFIX, prefix)
+
+	printf("static const gchar* const %s_keyword_names[] = {\n\tNULL", prefix)
+	for (k = 1; k <= n; k++)
+		printf(",\n\t\"%s\"", key[k])
+	printf("\n};\n\n")
+
+	printf("static const guint8 %s_keyword_lengths[] = {\n\t0", prefix)
+	for (k = 1; k <= n; k++)
+		printf(",%s%d", (k % 16 == 0) ? "\n\t" : " ", len[k])
+	printf("\n};\n\n")
+
+	printf("static const guint8 %s_keyword_slots[%d] = {", prefix, size)
+	for (s = 0; s < size; s++)
+		printf("%s%d%s", (s % 16 == 0) ? "\n\t" : " ",
+				(s in used) ? used[s] : 0, (s < size - 1) ? "," : "")
+	printf("\n};\n\n")
+
+	printf("/**\n * Map a name to its keyword, ignoring ASCII case.\n")
+	printf(" * @param name Start of the name, need not be NUL terminated\n")
+	printf(" * @param len Length of name\n")
+	printf(" * @return The keyword or %s_UNKNOWN\n */\n", PREFIX)
+	printf("static inline %s_keyword %s_keyword_lookup(\n", prefix, prefix)
+	printf("\t\tconst gchar* name, gsize len) {\n")
+	printf("\tguint32 h = 0;\n\tgsize i;\n\tguint k;\n\n")
+	printf("\tfor (i = 0; i < len; i++)\n")
+	printf("\t\th = h * 31 + ((guchar) name[i] | 0x20);\n")
+	printf("\tk = %s_keyword_slots[(guint32) (h * %uU) >> %d];\n",
+			prefix, mult, 32 - bits)
+	printf("\tif (k && %s_keyword_lengths[k] == len &&\n", prefix)
+	printf("\t\t\tg_ascii_strncasecmp(name, %s_keyword_names[k], len) == 0)\n",
+			prefix)
+	printf("\t\treturn (%s_keyword) k;\n", prefix)
+	printf("\treturn %s_UNKNOWN;\n}\n\n#endif\n", PREFIX)
+}
@@ -23,6 +23,8 @@
 #endif
 
 #include "get-carddav-report.h"
+#include "carddav-alloc.h"
+#include "carddav-stats.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -60,12 +62,15 @@ static const char* getall_request_footer =
 #define ELEM_HREF "href"
 
 /**
- * Function for listing a directory.
+ * Function for listing a directory. An href element is appended to hrefs
+ * for every member of the collection.
  * @param settings A pointer to carddav_settings. @see carddav_settings
+ * @param hrefs String the listing is appended to
  * @param error A pointer to carddav_error. @see carddav_error
  * @return TRUE in case of error, FALSE otherwise.
  */
-static gchar* carddav_dirlist(carddav_settings* settings, carddav_error* error) {
+static gboolean carddav_dirlist(carddav_settings* settings, GString* hrefs,
+		carddav_error* error) {
 	CURL* curl;
 	CURLcode res = 0;
 	char error_buf[CURL_ERROR_SIZE];
@@ -73,20 +78,18 @@ static gchar* carddav_dirlist(carddav_settings* settings, carddav_error* error)
 	struct MemoryStruct chunk;
 	struct MemoryStruct headers;
 	struct curl_slist *http_header = NULL;
-	gchar* all_href = NULL;
+	gboolean result = FALSE;
 
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&chunk);
+	init_memory_struct(&headers);
 
 	curl = get_curl(settings);
 	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
-		return NULL;
+		return TRUE;
 	}
 
 	http_header = curl_slist_append(http_header,
@@ -94,16 +97,9 @@ static gchar* carddav_dirlist(carddav_settings* settings, carddav_error* error)
 	http_header = curl_slist_append(http_header, "Depth: 1");
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
+	http_header = append_connection_header(http_header);
 	data.trace_ascii = settings->trace_ascii;
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	set_memory_callbacks(curl, settings, &chunk, &headers);
 	/* enable uploading */
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, dirlist_request);
 	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(dirlist_request));
@@ -114,125 +110,187 @@ static gchar* carddav_dirlist(carddav_settings* settings, carddav_error* error)
 		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PROPFIND");
+	set_request_method(curl, settings, CARDDAV_METHOD_PROPFIND);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = perform_curl(curl, settings, &chunk, &headers);
+	if (res == CURLE_OK && !map_memory_struct(&chunk, error_buf))
+		res = CURLE_WRITE_ERROR;
 	if (res != 0) {
-		error->code = -1;
-		error->str = g_strdup_printf("%s", error_buf);
+		set_curl_error(error, CARDDAV_PHASE_LOOKUP, res, error_buf);
 		g_free(settings->file);
 		settings->file = NULL;
+		result = TRUE;
 	}
 	else {
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 		if (code != 207) {
-			error->code = code;
-			error->str = g_strdup(headers.memory);
+			set_http_error(error, CARDDAV_PHASE_LOOKUP, code, headers.memory);
+			result = TRUE;
 		}
 		else {
-			gchar* tmp_report = NULL;
 			gchar* href = NULL;
-			gchar* tmp = NULL;
 			char* pos;
-			tmp_report = g_strdup(chunk.memory);
-			href = get_tag(ELEM_HREF, tmp_report);
+			href = get_tag(settings->arena, ELEM_HREF, chunk.memory);
 			/* Maybe namespace prefixed */
 			if (!href) {
-				href = get_tag("D:href", tmp_report);
+				href = get_tag(settings->arena, "D:href", chunk.memory);
 			}
 			if (!href) {
-				href = get_tag("d:href", tmp_report);
+				href = get_tag(settings->arena, "d:href", chunk.memory);
 			}
-			pos = strstr(tmp_report, href);
-			all_href = g_strdup_printf("");
+			pos = (href) ? strstr(chunk.memory, href) : NULL;
 			while ((href != NULL) && (pos != NULL)) {
-				href = get_tag(ELEM_HREF, pos);
+				href = get_tag(settings->arena, ELEM_HREF, pos);
 				/* Maybe namespace prefixed */
 				if (!href) {
-					href = get_tag("D:href", pos);
+					href = get_tag(settings->arena, "D:href", pos);
 				}
 				if (!href) {
-					href = get_tag("d:href", pos);
+					href = get_tag(settings->arena, "d:href", pos);
 				}
 				if (!href)
 					break;
 				pos = strstr(pos, href);
-				tmp = g_strdup(all_href);
-				g_free(all_href);
-				all_href = g_strdup_printf("%s <D:href>%s</D:href>\r\n", tmp, href);
-				g_free(tmp);
+				g_string_append_printf(hrefs,
+						" <D:href>%s</D:href>\r\n", href);
 			}
-			g_free(tmp_report);
 		}
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_memory_struct(&chunk);
+	free_memory_struct(&headers);
 	curl_slist_free_all(http_header);
 	curl_easy_cleanup(curl);
-	return all_href;
+	return result;
 }
 
 /**
- * Function for getting all cards from collection.
+ * Append a card to a GString in the form returned by carddav_getall().
+ * The href of the card is stored as an URI property.
+ * @param cards The string to append to
+ * @param href The href of the card or NULL
+ * @param data The card
+ * @param len Length of data
+ */
+static void format_card(GString* cards, const char* href,
+		const char* data, size_t len) {
+	const gchar* object;
+	const gchar* stop;
+
+	object = g_strstr_len(data, len, "BEGIN:VCARD");
+	if (!object)
+		return;
+	object += strlen("BEGIN:VCARD");
+	while (object < data + len && g_ascii_isspace(*object))
+		object++;
+	stop = g_strstr_len(object, data + len - object, "END:VCARD");
+	if (stop) {
+		g_string_append(cards, "BEGIN:VCARD\r\n");
+		g_string_append_len(cards, object, stop - object);
+		g_string_append_printf(cards, "URI:%s\r\nEND:VCARD\r\n",
+				(href) ? href : "none");
+	}
+}
+
+/**
+ * Collect a card in the GString returned to the caller.
+ * @see carddav_card_func
+ */
+static int append_card(const char* href, const char* etag,
+		const char* data, size_t len, void* user_data) {
+	GString* cards = (GString *) user_data;
+	gsize allocated = cards->allocated_len;
+
+	format_card(cards, href, data, len);
+	alloc_account(CARDDAV_MEM_RESULT, allocated, cards->allocated_len);
+	return 0;
+}
+
+/**
+ * @struct CardWriter
+ * Used by write_card to hand formatted cards to an output sink.
+ */
+struct CardWriter {
+	GString* card;
+	carddav_write_func write;
+	void* user_data;
+	gboolean failed;
+};
+
+/**
+ * Format a card like append_card() and write it to an output sink.
+ * @see carddav_card_func
+ */
+static int write_card(const char* href, const char* etag,
+		const char* data, size_t len, void* user_data) {
+	struct CardWriter* writer = (struct CardWriter *) user_data;
+	gsize allocated = writer->card->allocated_len;
+
+	g_string_truncate(writer->card, 0);
+	format_card(writer->card, href, data, len);
+	alloc_account(CARDDAV_MEM_PARSE, allocated, writer->card->allocated_len);
+	if (writer->card->len > 0 && writer->write(writer->card->str,
+				writer->card->len, writer->user_data) != 0) {
+		writer->failed = TRUE;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Function for fetching all cards from collection. Cards are handed to
+ * settings->card_func while the response is received.
  * @param settings A pointer to carddav_settings. @see carddav_settings
  * @param error A pointer to carddav_error. @see carddav_error
  * @return TRUE in case of error, FALSE otherwise.
  */
-gboolean carddav_getall(carddav_settings* settings, carddav_error* error) {
-	gchar * dav_file_listing;
-	dav_file_listing = carddav_dirlist(settings, error);
-	if (dav_file_listing == NULL)
+static gboolean carddav_report(carddav_settings* settings, carddav_error* error) {
+	GString* get_request;
+	get_request = g_string_new(getall_request_header);
+	if (carddav_dirlist(settings, get_request, error)) {
+		g_string_free(get_request, TRUE);
 		return TRUE;
+	}
+	g_string_append(get_request, getall_request_footer);
+	g_string_append(get_request, "\r\n");
 
 	CURL* curl;
 	CURLcode res = 0;
 	char error_buf[CURL_ERROR_SIZE];
 	struct config_data data;
-	struct MemoryStruct chunk;
+	struct ReportStream stream;
 	struct MemoryStruct headers;
 	struct curl_slist *http_header = NULL;
 	gboolean result = FALSE;
 
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&headers);
 
 	curl = get_curl(settings);
 	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
-		g_free(settings->file);
-		settings->file = NULL;
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
+		g_string_free(get_request, TRUE);
 		return TRUE;
 	}
+	init_report_stream(&stream, curl, settings->card_func, settings->card_data);
 
 	http_header = curl_slist_append(http_header,
 			"Content-Type: application/xml; charset=\"utf-8\"");
 	http_header = curl_slist_append(http_header, "Depth: 1");
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
+	http_header = append_connection_header(http_header);
 	data.trace_ascii = settings->trace_ascii;
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
-	/* assemble request */
-	gchar * get_request;
-	get_request = g_strdup_printf("%s%s%s\r\n", getall_request_header, dav_file_listing, getall_request_footer);
+	/* parse cards as they arrive */
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteReportCallback);
+	/* we pass our 'stream' struct to the callback function */
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&stream);
+	set_memory_callbacks(curl, settings, NULL, &headers);
 	/* enable uploading */
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, get_request);
-	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(get_request));
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, get_request->str);
+	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, get_request->len);
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
 	if (settings->debug) {
@@ -240,142 +298,95 @@ gboolean carddav_getall(carddav_settings* settings, carddav_error* error) {
 		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "REPORT");
+	set_request_method(curl, settings, CARDDAV_METHOD_REPORT);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
-	if (res != 0) {
-		error->code = -1;
-		error->str = g_strdup_printf("%s", error_buf);
-		g_free(settings->file);
-		settings->file = NULL;
+	res = perform_report(curl, settings, &stream, &headers);
+	stats_parse(settings, stream.parsed, stream.parse_time);
+	if (res != 0 && !stream.stopped) {
+		set_curl_error(error, CARDDAV_PHASE_LOOKUP, res, error_buf);
 		result = TRUE;
 	}
 	else {
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 		if (code != 207) {
-			error->code = code;
-			error->str = g_strdup(headers.memory);
+			set_http_error(error, CARDDAV_PHASE_LOOKUP, code, headers.memory);
 			result = TRUE;
 		}
-		else {
-			gchar* report;
-			report = parse_carddav_report(
-						chunk.memory, "address-data", "VCARD");
-			settings->file = g_strdup(report);
-			g_free(report);
-		}
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_report_stream(&stream);
+	free_memory_struct(&headers);
 	curl_slist_free_all(http_header);
 	curl_easy_cleanup(curl);
-	g_free(dav_file_listing);
+	g_string_free(get_request, TRUE);
 	return result;
 }
 
 /**
- * Function for getting all cards from collection.
- * This version stores each object's URI in a VCARD parameter.
+ * Function for getting all cards from collection. If settings->card_func
+ * is set every card is handed to it instead of being collected. If
+ * settings->write_func is set the cards are written to it as they arrive.
  * @param settings A pointer to carddav_settings. @see carddav_settings
  * @param error A pointer to carddav_error. @see carddav_error
  * @return TRUE in case of error, FALSE otherwise.
  */
-gboolean carddav_getall_by_uri(carddav_settings* settings, carddav_error* error) {
-	gchar * dav_file_listing;
-	dav_file_listing = carddav_dirlist(settings, error);
-	if (dav_file_listing == NULL)
-		return TRUE;
+gboolean carddav_getall(carddav_settings* settings, carddav_error* error) {
+	GString* cards;
+	gboolean result;
 
-	CURL* curl;
-	CURLcode res = 0;
-	char error_buf[CURL_ERROR_SIZE];
-	struct config_data data;
-	struct MemoryStruct chunk;
-	struct MemoryStruct headers;
-	struct curl_slist *http_header = NULL;
-	gboolean result = FALSE;
+	g_free(settings->file);
+	settings->file = NULL;
+	if (settings->card_func)
+		return carddav_report(settings, error);
 
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	if (settings->write_func) {
+		struct CardWriter writer;
 
-	curl = get_curl(settings);
-	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
-		g_free(settings->file);
-		settings->file = NULL;
-		return TRUE;
+		writer.card = g_string_sized_new(1024);
+		alloc_account(CARDDAV_MEM_PARSE, 0, writer.card->allocated_len);
+		writer.write = settings->write_func;
+		writer.user_data = settings->write_data;
+		writer.failed = FALSE;
+		settings->card_func = write_card;
+		settings->card_data = &writer;
+		result = carddav_report(settings, error);
+		settings->card_func = NULL;
+		settings->card_data = NULL;
+		if (!result && writer.failed) {
+			set_carddav_error(error, CARDDAV_PHASE_LOOKUP, -1, 0,
+					CURLE_WRITE_ERROR, "Could not write to output sink");
+			result = TRUE;
+		}
+		alloc_account(CARDDAV_MEM_PARSE, writer.card->allocated_len, 0);
+		g_string_free(writer.card, TRUE);
+		return result;
 	}
 
-	http_header = curl_slist_append(http_header,
-			"Content-Type: application/xml; charset=\"utf-8\"");
-	http_header = curl_slist_append(http_header, "Depth: 1");
-	http_header = curl_slist_append(http_header, "Expect:");
-	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
-	data.trace_ascii = settings->trace_ascii;
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
-	/* assemble request */
-	gchar * get_request;
-	get_request = g_strdup_printf("%s%s%s\r\n", getall_request_header, dav_file_listing, getall_request_footer);
-	/* enable uploading */
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, get_request);
-	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(get_request));
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "REPORT");
-	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
-	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
-	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
-	if (res != 0) {
-		error->code = -1;
-		error->str = g_strdup_printf("%s", error_buf);
-		g_free(settings->file);
-		settings->file = NULL;
-		result = TRUE;
-	}
+	cards = g_string_new(NULL);
+	alloc_account(CARDDAV_MEM_RESULT, 0, cards->allocated_len);
+	settings->card_func = append_card;
+	settings->card_data = cards;
+	result = carddav_report(settings, error);
+	settings->card_func = NULL;
+	settings->card_data = NULL;
+	if (!result && cards->len > 0)
+		settings->file = g_string_free(cards, FALSE);
 	else {
-		long code;
-		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-		if (code != 207) {
-			error->code = code;
-			error->str = g_strdup(headers.memory);
-			result = TRUE;
-		}
-		else {
-			gchar* report;
-			report = parse_carddav_report(
-						chunk.memory, "address-data", "VCARD");
-			settings->file = g_strdup(report);
-			g_free(report);
-		}
+		alloc_account(CARDDAV_MEM_RESULT, cards->allocated_len, 0);
+		g_string_free(cards, TRUE);
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
-	curl_slist_free_all(http_header);
-	curl_easy_cleanup(curl);
-	g_free(dav_file_listing);
 	return result;
-}
\ No newline at end of file
+}
+
+/**
+ * Function for getting all cards from collection.
+ * This version stores each object's URI in a VCARD parameter.
+ * @param settings A pointer to carddav_settings. @see carddav_settings
+ * @param error A pointer to carddav_error. @see carddav_error
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+gboolean carddav_getall_by_uri(carddav_settings* settings, carddav_error* error) {
+	return carddav_getall(settings, error);
+}
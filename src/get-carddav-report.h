@@ -28,13 +28,17 @@
 /**
  * Function for getting a WebDAV directory listing.
  * @param settings A pointer to carddav_settings. @see carddav_settings
+ * @param hrefs String the href elements for search are appended to
  * @param error A pointer to carddav_error. @see carddav_error
- * @return string containing list of href elements for search
+ * @return TRUE in case of error, FALSE otherwise.
  */
-static gchar* carddav_dirlist(carddav_settings* settings, carddav_error* error);
+static gboolean carddav_dirlist(carddav_settings* settings, GString* hrefs,
+		carddav_error* error);
 
 /**
- * Function for getting all cards from collection.
+ * Function for getting all cards from collection. If settings->card_func
+ * is set every card is handed to it instead of being collected. If
+ * settings->write_func is set the cards are written to it as they arrive.
  * @param settings A pointer to carddav_settings. @see carddav_settings
  * @param error A pointer to carddav_error. @see carddav_error
  * @return TRUE in case of error, FALSE otherwise.
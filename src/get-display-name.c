@@ -23,6 +23,7 @@
 #endif
 
 #include "get-carddav-report.h"
+#include "carddav-stats.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -58,15 +59,13 @@ gboolean carddav_getname(carddav_settings* settings, carddav_error* error) {
 	struct curl_slist *http_header = NULL;
 	gboolean result = FALSE;
 	
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&chunk);
+	init_memory_struct(&headers);
 
 	curl = get_curl(settings);
 	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
 		return TRUE;
@@ -77,16 +76,9 @@ gboolean carddav_getname(carddav_settings* settings, carddav_error* error) {
 	http_header = curl_slist_append(http_header, "Depth: 0");
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
+	http_header = append_connection_header(http_header);
 	data.trace_ascii = settings->trace_ascii;
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	set_memory_callbacks(curl, settings, &chunk, &headers);
 	/* enable uploading */
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, getname_request);
 	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(getname_request));
@@ -97,14 +89,15 @@ gboolean carddav_getname(carddav_settings* settings, carddav_error* error) {
 		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PROPFIND");
+	set_request_method(curl, settings, CARDDAV_METHOD_PROPFIND);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = perform_curl(curl, settings, &chunk, &headers);
+	if (res == CURLE_OK && !map_memory_struct(&chunk, error_buf))
+		res = CURLE_WRITE_ERROR;
 	if (res != 0) {
-		error->code = -1;
-		error->str = g_strdup_printf("%s", error_buf);
+		set_curl_error(error, CARDDAV_PHASE_LOOKUP, res, error_buf);
 		g_free(settings->file);
 		settings->file = NULL;
 		result = TRUE;
@@ -113,26 +106,24 @@ gboolean carddav_getname(carddav_settings* settings, carddav_error* error) {
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 		if (code != 207) {
-			error->code = code;
-			error->str = g_strdup(headers.memory);
+			set_http_error(error, CARDDAV_PHASE_LOOKUP, code, headers.memory);
 			result = TRUE;
 		}
 		else {
 			gchar* displayname;
-			displayname = get_tag("displayname", chunk.memory);
+			displayname = get_tag(settings->arena,
+					"displayname", chunk.memory);
 			/* Maybe namespace prefixed */
 			if (!displayname) {
-				displayname = get_tag("D:displayname", chunk.memory);
+				displayname = get_tag(settings->arena,
+						"D:displayname", chunk.memory);
 			}
 			settings->file = (displayname) ? 
 					g_strdup(displayname) : g_strdup("");
-			g_free(displayname);
 		}
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_memory_struct(&chunk);
+	free_memory_struct(&headers);
 	curl_slist_free_all(http_header);
 	curl_easy_cleanup(curl);
 	return result;
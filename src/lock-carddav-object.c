@@ -23,6 +23,7 @@
 
 #include "lock-carddav-object.h"
 #include "options-carddav-server.h"
+#include "carddav-stats.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -32,7 +33,7 @@
 /**
  * A static literal string containing the lock query.
  */
-static char* lock_query =
+static const char* lock_query =
 "<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
 "<D:lockinfo xmlns:D=\"DAV:\">"
 "  <D:lockscope><D:exclusive/></D:lockscope>"
@@ -56,19 +57,16 @@ gchar* carddav_lock_object(
 	struct MemoryStruct headers;
 	struct curl_slist *http_header = NULL;
 	gchar* lock_token = NULL;
-	gchar* url;
 
 	if (! carddav_lock_support(settings, error))
 		return lock_token;
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&chunk);
+	init_memory_struct(&headers);
 
 	curl = get_curl(settings);
 	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
 		return lock_token;
@@ -79,42 +77,30 @@ gchar* carddav_lock_object(
 	http_header = curl_slist_append(http_header, "Timeout: Second-300");
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
+	http_header = append_connection_header(http_header);
 	data.trace_ascii = settings->trace_ascii;
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,	WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	set_memory_callbacks(curl, settings, &chunk, &headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
 	if (settings->debug) {
 		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
 		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	if (settings->usehttps) {
-		url = g_strdup_printf("https://%s", URI);
-	} else {
-		url = g_strdup_printf("http://%s", URI);
-	}
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	g_free(url);
+	curl_easy_setopt(curl, CURLOPT_URL, rebuild_url(settings, URI));
 	/* enable uploading */
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, lock_query);
 	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(lock_query));
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "LOCK");
+	set_request_method(curl, settings, CARDDAV_METHOD_LOCK);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = perform_curl(curl, settings, &chunk, &headers);
+	if (res == CURLE_OK && !map_memory_struct(&chunk, error_buf))
+		res = CURLE_WRITE_ERROR;
 	curl_slist_free_all(http_header);
 	if (res != 0) {
-		error->code = -1;
-		error->str = g_strdup_printf("%s", error_buf);
+		set_curl_error(error, CARDDAV_PHASE_LOCK, res, error_buf);
 		g_free(settings->file);
 		settings->file = NULL;
 	}
@@ -122,26 +108,24 @@ gchar* carddav_lock_object(
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 		if (code != 200) {
-			gchar* status = get_tag("status", chunk.memory);
+			gchar* status = get_tag(settings->arena, "status", chunk.memory);
 			if (status && strstr(status, "423") != NULL) {
-				error->code = 423;
-				error->str = g_strdup(status);
+				/* the multistatus body names the locked resource */
+				set_http_error(error, CARDDAV_PHASE_LOCK, 423, status);
 			}
 			else {
-				error->code = code;
-				error->str = g_strdup(chunk.memory);
+				set_http_error(error, CARDDAV_PHASE_LOCK, code, chunk.memory);
 			}
-			g_free(status);
 		}
 		else {
-			lock_token = get_response_header(
-						"Lock-Token", headers.memory, FALSE);
+			lock_token = g_strdup(
+						get_response_header(&headers, "Lock-Token"));
+			if (lock_token)
+				stats_lock(settings);
 		}
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_memory_struct(&chunk);
+	free_memory_struct(&headers);
 	curl_easy_cleanup(curl);
 	return lock_token;
 }
@@ -164,62 +148,47 @@ gboolean carddav_unlock_object(gchar* lock_token, gchar* URI,
 	struct MemoryStruct headers;
 	struct curl_slist *http_header = NULL;
 	gboolean result = FALSE;
-	gchar* url;
 
 	if (! carddav_lock_support(settings, error))
 		return result;
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&chunk);
+	init_memory_struct(&headers);
 
 	curl = get_curl(settings);
 	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
 		return TRUE;
 	}
 
 	http_header = curl_slist_append(http_header, 
-			g_strdup_printf("Lock-Token: %s", lock_token));
+			arena_strdup_printf(settings->arena, "Lock-Token: %s", lock_token));
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
+	http_header = append_connection_header(http_header);
 	data.trace_ascii = settings->trace_ascii;
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,	WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	set_memory_callbacks(curl, settings, &chunk, &headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
 	if (settings->debug) {
 		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
 		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	if (settings->usehttps) {
-		url = g_strdup_printf("https://%s", URI);
-	} else {
-		url = g_strdup_printf("http://%s", URI);
-	}
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	g_free(url);
+	curl_easy_setopt(curl, CURLOPT_URL, rebuild_url(settings, URI));
 	/* enable uploading */
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "UNLOCK");
+	set_request_method(curl, settings, CARDDAV_METHOD_UNLOCK);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = perform_curl(curl, settings, &chunk, &headers);
+	if (res == CURLE_OK && !map_memory_struct(&chunk, error_buf))
+		res = CURLE_WRITE_ERROR;
 	curl_slist_free_all(http_header);
 	if (res != 0) {
-		error->code = -1;
-		error->str = g_strdup_printf("%s", error_buf);
+		set_curl_error(error, CARDDAV_PHASE_UNLOCK, res, error_buf);
 		g_free(settings->file);
 		settings->file = NULL;
 	}
@@ -227,17 +196,14 @@ gboolean carddav_unlock_object(gchar* lock_token, gchar* URI,
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 		if (code != 204) {
-			error->code = code;
-			error->str = g_strdup(chunk.memory);
+			set_http_error(error, CARDDAV_PHASE_UNLOCK, code, chunk.memory);
 		}
 		else {
 			result = TRUE;
 		}
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_memory_struct(&chunk);
+	free_memory_struct(&headers);
 	curl_easy_cleanup(curl);
 	return result;
 }
@@ -251,44 +217,32 @@ gboolean carddav_unlock_object(gchar* lock_token, gchar* URI,
  * @return True if locking is supported by the server. False otherwise
  */
 gboolean carddav_lock_support(carddav_settings* settings, carddav_error* error) {
+	CURL* curl;
+	response options;
 	gboolean found = FALSE;
-	gchar* url = NULL;
-	gchar* mystr = NULL;
-	runtime_info* info;
-	
-	info = carddav_get_runtime_info();
-	info->options->verify_ssl_certificate = settings->verify_ssl_certificate;
-	info->options->custom_cacert = g_strdup(settings->custom_cacert);
-	if (settings->usehttps) {
-		mystr =  g_strdup("https://");
-	} else {
-		mystr =  g_strdup("http://");
-	}
-	
 
-	if (settings->username && settings->password) {
-		url = g_strdup_printf("%s%s:%s@%s",
-				mystr, settings->username, settings->password, settings->url);
-	}
-	else if (settings->username) {
-		url = g_strdup_printf("%s%s@%s", 
-				mystr, settings->username, settings->url);
-	}
-	else {
-		url = g_strdup_printf("%s%s", mystr, settings->url);
-	}
-	gchar** options = carddav_get_server_options(url, info);
-	g_free(url);
-	gchar** tmp = options;
-	carddav_free_runtime_info(&info);
-	while (*options) {
-		if (strcmp(*options++, "LOCK") == 0) {
-			found = TRUE;
-			break;
+	/* Probe with the caller's settings: no second runtime_info and no
+	 * URL rebuilt with the credentials in it */
+	curl = get_curl(settings);
+	if (!curl)
+		return FALSE;
+	options.msg = NULL;
+	options.shared = NULL;
+	if (carddav_getoptions(curl, settings, &options, NULL, FALSE) &&
+			options.msg) {
+		gchar** list = g_strsplit(options.msg, ",", 0);
+		gchar** tmp;
+
+		for (tmp = list; *tmp; tmp++) {
+			if (strcmp(g_strstrip(*tmp), "LOCK") == 0) {
+				found = TRUE;
+				break;
+			}
 		}
+		g_strfreev(list);
 	}
-	g_strfreev(tmp);			
-	g_free(mystr);
+	release_text(options.msg, options.shared);
+	curl_easy_cleanup(curl);
 	return found;
 }
 
@@ -329,20 +329,26 @@ md5_final(unsigned char *digest, MD5_CONTEXT *ctx)
  * string S.  hextdigest but be buffer of at lease 33 bytes!
  */
 static void
-md5_hex_digest(char *hexdigest, const unsigned char *s)
+md5_hex_digest_len(char *hexdigest, const unsigned char *s, size_t len)
 {
 	int i;
 	MD5_CONTEXT context;
 	unsigned char digest[16];
 
 	md5_init(&context);
-	md5_update(&context, s, strlen((gchar *) s));
+	md5_update(&context, s, len);
 	md5_final(digest, &context);
 
 	for (i = 0; i < 16; i++)
 		sprintf(hexdigest + 2 * i, "%02x", digest[i]);
 }
 
+static void
+md5_hex_digest(char *hexdigest, const unsigned char *s)
+{
+	md5_hex_digest_len(hexdigest, s, strlen((gchar *) s));
+}
+
 
 /*
 ** Function: md5_hmac
@@ -435,6 +441,11 @@ void carddav_md5_hex_digest(char *hexdigest, const unsigned char *s) {
 	md5_hex_digest(hexdigest, s);
 }
 
+void carddav_md5_hex_digest_len(char *hexdigest,
+		const unsigned char *s, size_t len) {
+	md5_hex_digest_len(hexdigest, s, len);
+}
+
 void carddav_md5_hex_hmac(char *hexdigest,
                   const unsigned char* text, int text_len,
                   const unsigned char* key, int key_len) {
@@ -44,6 +44,9 @@ typedef struct {  /* Hmm, should be private */
 
 void carddav_md5_hex_digest(char *hexdigest, const unsigned char *s);
 
+void carddav_md5_hex_digest_len(char *hexdigest,
+		const unsigned char *s, size_t len);
+
 void carddav_md5_hex_hmac(char *hexdigest,
                   const unsigned char* text, int text_len,
                   const unsigned char* key, int key_len);
@@ -24,6 +24,8 @@
 
 #include "modify-carddav-object.h"
 #include "lock-carddav-object.h"
+#include "carddav-vcard.h"
+#include "carddav-stats.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -34,7 +36,7 @@
  * A static literal string containing the first part of the calendar query.
  * The actual UID to use for the query is added at runtime.
  */
-static char* search_head =
+static const char* search_head =
 "<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
 "<C:addressbook-query xmlns:D=\"DAV:\""
 "                 xmlns:C=\"urn:ietf:params:xml:ns:carddav\">"
@@ -50,7 +52,7 @@ static char* search_head =
 /**
  * A static literal string containing the last part of the calendar query
  */
-static char* search_tail =
+static const char* search_tail =
 "    </C:prop-filter>"
 " </C:filter>"
 "</C:addressbook-query>\r\n";
@@ -71,19 +73,18 @@ gboolean carddav_modify(carddav_settings* settings, carddav_error* error) {
 	struct curl_slist *http_header = NULL;
 	gchar* search;
 	gchar* uid;
+	carddav_vcard* card;
 	gboolean result = FALSE;
 	gboolean LOCKSUPPORT = FALSE;
 	gchar* lock_token = NULL;
 
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&chunk);
+	init_memory_struct(&headers);
 
 	curl = get_curl(settings);
 	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
 		return TRUE;
@@ -94,53 +95,48 @@ gboolean carddav_modify(carddav_settings* settings, carddav_error* error) {
 	http_header = curl_slist_append(http_header, "Depth: 1");
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
+	http_header = append_connection_header(http_header);
 	data.trace_ascii = settings->trace_ascii;
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,	WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	set_memory_callbacks(curl, settings, &chunk, &headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
 	if (settings->debug) {
 		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
 		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	gchar* file = g_strdup(settings->file);
-	if ((uid = get_response_header("uid", file, FALSE)) == NULL) {
-		g_free(file);
-		error->code = 1;
-		error->str = g_strdup("Error: Missing required UID for object");
+	card = carddav_vcard_parse(settings->object, settings->object_len);
+	uid = vcard_dup_value(card, "UID");
+	carddav_vcard_free(&card);
+	if (uid == NULL) {
+		set_carddav_error(error, CARDDAV_PHASE_NONE, 1, 0, CURLE_OK,
+				"Error: Missing required UID for object");
+		curl_slist_free_all(http_header);
+		curl_easy_cleanup(curl);
 		return TRUE;
 	}
-	g_free(file);
 	/*
 	 * collation is not supported by ICalendar.
 	 * <C:text-match collation=\"i;ascii-casemap\">%s</C:text-match>
 	 */
-	search = g_strdup_printf(
+	search = arena_strdup_printf(settings->arena,
 		"%s<C:text-match collation=\"i;unicode-casemap\" negate-condition=\"no\" match-type=\"exact\">%s</C:text-match>%s",
 		search_head, uid, search_tail);
 	g_free(uid);
 	/* enable uploading */
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, search);
 	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(search));
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "REPORT");
+	set_request_method(curl, settings, CARDDAV_METHOD_REPORT);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = perform_curl(curl, settings, &chunk, &headers);
+	if (res == CURLE_OK && !map_memory_struct(&chunk, error_buf))
+		res = CURLE_WRITE_ERROR;
 	curl_slist_free_all(http_header);
 	http_header = NULL;
-	g_free(search);
 	if (res != 0) {
-		error->code = -1;
-		error->str = g_strdup_printf("%s", error_buf);
+		set_curl_error(error, CARDDAV_PHASE_LOOKUP, res, error_buf);
 		g_free(settings->file);
 		settings->file = NULL;
 		result = TRUE;
@@ -149,49 +145,36 @@ gboolean carddav_modify(carddav_settings* settings, carddav_error* error) {
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 		if (code != 207) {
-			error->code = code;
-			error->str = g_strdup(chunk.memory);
+			set_http_error(error, CARDDAV_PHASE_LOOKUP, code, chunk.memory);
 			result = TRUE;
 		}
 		else {
 			/* enable uploading */
 			gchar* url = NULL;
 			gchar* etag = NULL;
-			url = get_url(chunk.memory);
+			url = get_url(settings->arena, chunk.memory);
 			if (url) {
-				etag = get_etag(chunk.memory);
+				etag = get_etag(settings->arena, chunk.memory);
 				if (etag) {
-					gchar* host = get_host(settings->url);
-					if (host) {
-						file = g_strdup(url);
-						g_free(url);
-						url = g_strdup_printf("%s%s", host, file);
-						g_free(file);
-						g_free(host);
-					}
-					else {
-						g_free(etag);
-						g_free(url);
+					const gchar* host = get_host(settings);
+					if (host)
+						url = arena_strdup_printf(settings->arena,
+								"%s%s", host, url);
+					else
 						url = NULL;
-					}
 				}
-				else {
-					g_free(url);
+				else
 					url = NULL;
-				}
 				if (url) {
 					int lock = 0;
-					carddav_error lock_error;
+					carddav_error lock_error = {0};
 
-					file = g_strdup(etag);
-					g_free(etag);
-					etag = g_strdup_printf("If-Match: %s", file);
-					g_free(file);
-					http_header = curl_slist_append(http_header, etag);
-					g_free(etag);
+					http_header = curl_slist_append(http_header,
+							arena_strdup_printf(settings->arena,
+								"If-Match: %s", etag));
 					http_header = curl_slist_append(http_header,
 						"Content-Type: text/directory; charset=\"utf-8\"");
-					http_header = curl_slist_append(http_header, "Connection: close");
+					http_header = append_connection_header(http_header);
 					http_header = curl_slist_append(http_header, "Expect:");
 					http_header = curl_slist_append(
 									http_header, "Transfer-Encoding:");
@@ -203,7 +186,7 @@ gboolean carddav_modify(carddav_settings* settings, carddav_error* error) {
 						lock_token = carddav_lock_object(url, settings, &lock_error);
 						if (lock_token) {
 							http_header = curl_slist_append(
-								http_header, g_strdup_printf(
+								http_header, arena_strdup_printf(settings->arena,
 										"If: (%s)", lock_token));
 						}
 						/*
@@ -226,31 +209,29 @@ gboolean carddav_modify(carddav_settings* settings, carddav_error* error) {
 					if (! LOCKSUPPORT || (LOCKSUPPORT && lock_token && lock_error.code != 423)) {
 						curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
 						curl_easy_setopt(curl, CURLOPT_URL, rebuild_url(settings, url));
-						curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->file);
+						curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->object);
 						curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE,
-									strlen(settings->file));
+									(long) settings->object_len);
 						curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 						curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 						curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-						curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
-						res = curl_easy_perform(curl);
+						set_request_method(curl, settings, CARDDAV_METHOD_PUT);
+						res = perform_curl(curl, settings, &chunk, &headers);
+						if (res == CURLE_OK && !map_memory_struct(&chunk, error_buf))
+							res = CURLE_WRITE_ERROR;
 						if (LOCKSUPPORT && lock_token) {
 							carddav_unlock_object(
 									lock_token, url, settings, &lock_error);
 						}
 					}
-					g_free(url);
 					g_free(lock_token);
 					if (res != 0 || lock < 0) {
-						/* Is this a lock_error don't change error*/
-						if (lock == 0 || lock_error.code == 423) {
-							error->code = code;
-							error->str = g_strdup(chunk.memory);
-						}
-						else {
-							error->code = lock_error.code;
-							error->str = g_strdup(lock_error.str);
-						}
+						/* a failed lock was recorded in lock_error */
+						if (lock < 0)
+							copy_carddav_error(error, &lock_error);
+						else
+							set_curl_error(error, CARDDAV_PHASE_WRITE,
+									res, error_buf);
 						result = TRUE;
 						g_free(settings->file);
 						settings->file = NULL;
@@ -260,19 +241,16 @@ gboolean carddav_modify(carddav_settings* settings, carddav_error* error) {
 						res = curl_easy_getinfo(
 									curl, CURLINFO_RESPONSE_CODE, &code);
 						if (code != 204) {
-							error->code = code;
-							error->str = g_strdup(chunk.memory);
+							set_http_error(error, CARDDAV_PHASE_WRITE,
+									code, chunk.memory);
 							result = TRUE;
 						}
 					}
 					curl_slist_free_all(http_header);
 				}
 				else {
-					error->code = code;
-					if (chunk.memory)
-						error->str = g_strdup(chunk.memory);
-					else
-						error->str = g_strdup("No object found");
+					set_http_error(error, CARDDAV_PHASE_LOOKUP, code,
+							(chunk.memory) ? chunk.memory : "No object found");
 					result = TRUE;
 				}
 			}
@@ -281,16 +259,14 @@ gboolean carddav_modify(carddav_settings* settings, carddav_error* error) {
 				 * No object found on server. Posible synchronization
 				 * problem or a server side race condition
 				 */
-				error->code = 409;
-				error->str = g_strdup("No object found");
+				set_carddav_error(error, CARDDAV_PHASE_LOOKUP, 409, 0, CURLE_OK,
+						"No object found");
 				result = TRUE;
 			}
 		}
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_memory_struct(&chunk);
+	free_memory_struct(&headers);
 	curl_easy_cleanup(curl);
 	return result;
 }
@@ -309,21 +285,19 @@ gboolean carddav_modify_by_uri(carddav_settings* settings, carddav_error* error)
 	struct MemoryStruct chunk;
 	struct MemoryStruct headers;
 	struct curl_slist *http_header = NULL;
-	gchar* search;
 	gchar* uid;
+	carddav_vcard* card;
 	gboolean result = FALSE;
 	gboolean LOCKSUPPORT = FALSE;
 	gchar* lock_token = NULL;
 
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&chunk);
+	init_memory_struct(&headers);
 
 	curl = get_curl(settings);
 	if (!curl) {
-		error->code = -1;
-		error->str = g_strdup("Could not initialize libcurl");
+		set_carddav_error(error, CARDDAV_PHASE_NONE, -1, 0,
+				CURLE_FAILED_INIT, "Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
 		return TRUE;
@@ -334,66 +308,49 @@ gboolean carddav_modify_by_uri(carddav_settings* settings, carddav_error* error)
 	http_header = curl_slist_append(http_header, "Depth: 1");
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
-	http_header = curl_slist_append(http_header, "Connection: close");
+	http_header = append_connection_header(http_header);
 	data.trace_ascii = settings->trace_ascii;
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,	WriteHeaderCallback);
-	/* we pass our 'headers' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	set_memory_callbacks(curl, settings, &chunk, &headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
 	if (settings->debug) {
 		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
 		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	gchar* file = g_strdup(settings->file);
-	if ((uid = get_response_header("uri", file, FALSE)) == NULL) {
-		g_free(file);
-		error->code = 1;
-		error->str = g_strdup("Error: Missing required URI for object\nThe requested contact may not exist on the server");
+	card = carddav_vcard_parse(settings->object, settings->object_len);
+	uid = vcard_dup_value(card, "URI");
+	carddav_vcard_free(&card);
+	if (uid == NULL) {
+		set_carddav_error(error, CARDDAV_PHASE_NONE, 1, 0, CURLE_OK,
+				"Error: Missing required URI for object\n"
+				"The requested contact may not exist on the server");
+		curl_slist_free_all(http_header);
+		curl_easy_cleanup(curl);
 		return TRUE;
 	}
-	g_free(file);
 
 	/* enable uploading */
-	long code;
+	long code = 0;
 	gchar* url = NULL;
-	gchar* etag = NULL;
 	url = uid;
 	if (url) {
-		gchar* host = get_host(settings->url);
-		if (host) {
-			file = g_strdup(url);
-			g_free(url);
-			url = g_strdup_printf("%s%s", host, file);
-			g_free(file);
-			g_free(host);
-		}
-		else {
-			g_free(url);
+		const gchar* host = get_host(settings);
+		if (host)
+			url = arena_strdup_printf(settings->arena, "%s%s", host, url);
+		else
 			url = NULL;
-		}
+		g_free(uid);
 		if (url) {
 			int lock = 0;
-			carddav_error lock_error;
+			carddav_error lock_error = {0};
 
-			file = g_strdup(etag);
-			g_free(etag);
-			etag = g_strdup_printf("If-Match: %s", file);
-			g_free(file);
-			http_header = curl_slist_append(http_header, etag);
-			g_free(etag);
 			http_header = curl_slist_append(http_header,
 				"Content-Type: text/directory; charset=\"utf-8\"");
 			http_header = curl_slist_append(http_header, "Expect:");
 			http_header = curl_slist_append(
 							http_header, "Transfer-Encoding:");
-			http_header = curl_slist_append(http_header, "Connection: close");
+			http_header = append_connection_header(http_header);
 			if (settings->use_locking)
 				LOCKSUPPORT = carddav_lock_support(settings, &lock_error);
 			else
@@ -402,7 +359,7 @@ gboolean carddav_modify_by_uri(carddav_settings* settings, carddav_error* error)
 				lock_token = carddav_lock_object(url, settings, &lock_error);
 				if (lock_token) {
 					http_header = curl_slist_append(
-						http_header, g_strdup_printf(
+						http_header, arena_strdup_printf(settings->arena,
 								"If: (%s)", lock_token));
 				}
 				/*
@@ -425,31 +382,28 @@ gboolean carddav_modify_by_uri(carddav_settings* settings, carddav_error* error)
 			if (! LOCKSUPPORT || (LOCKSUPPORT && lock_token && lock_error.code != 423)) {
 				curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
 				curl_easy_setopt(curl, CURLOPT_URL, rebuild_url(settings, url));
-				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->file);
+				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->object);
 				curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE,
-							strlen(settings->file));
+							(long) settings->object_len);
 				curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 				curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 				curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-				curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
-				res = curl_easy_perform(curl);
+				set_request_method(curl, settings, CARDDAV_METHOD_PUT);
+				res = perform_curl(curl, settings, &chunk, &headers);
+				if (res == CURLE_OK && !map_memory_struct(&chunk, error_buf))
+					res = CURLE_WRITE_ERROR;
 				if (LOCKSUPPORT && lock_token) {
 					carddav_unlock_object(
 							lock_token, url, settings, &lock_error);
 				}
 			}
-			g_free(url);
 			g_free(lock_token);
 			if (res != 0 || lock < 0) {
-				/* Is this a lock_error don't change error*/
-				if (lock == 0 || lock_error.code == 423) {
-					error->code = code;
-					error->str = g_strdup(chunk.memory);
-				}
-				else {
-					error->code = lock_error.code;
-					error->str = g_strdup(lock_error.str);
-				}
+				/* a failed lock was recorded in lock_error */
+				if (lock < 0)
+					copy_carddav_error(error, &lock_error);
+				else
+					set_curl_error(error, CARDDAV_PHASE_WRITE, res, error_buf);
 				result = TRUE;
 				g_free(settings->file);
 				settings->file = NULL;
@@ -459,19 +413,16 @@ gboolean carddav_modify_by_uri(carddav_settings* settings, carddav_error* error)
 				res = curl_easy_getinfo(
 							curl, CURLINFO_RESPONSE_CODE, &code);
 				if (code != 204) {
-					error->code = code;
-					error->str = g_strdup(chunk.memory);
+					set_http_error(error, CARDDAV_PHASE_WRITE,
+							code, chunk.memory);
 					result = TRUE;
 				}
 			}
 			curl_slist_free_all(http_header);
 		}
 		else {
-			error->code = code;
-			if (chunk.memory)
-				error->str = g_strdup(chunk.memory);
-			else
-				error->str = g_strdup("No object found");
+			set_http_error(error, CARDDAV_PHASE_LOOKUP, code,
+					(chunk.memory) ? chunk.memory : "No object found");
 			result = TRUE;
 		}
 	}
@@ -480,14 +431,12 @@ gboolean carddav_modify_by_uri(carddav_settings* settings, carddav_error* error)
 			* No object found on server. Posible synchronization
 			* problem or a server side race condition
 			*/
-		error->code = 409;
-		error->str = g_strdup("No object found");
+		set_carddav_error(error, CARDDAV_PHASE_LOOKUP, 409, 0, CURLE_OK,
+				"No object found");
 		result = TRUE;
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_memory_struct(&chunk);
+	free_memory_struct(&headers);
 	curl_easy_cleanup(curl);
 	return result;
 }
@@ -23,6 +23,8 @@
 #endif
 
 #include "options-carddav-server.h"
+#include "carddav-stats.h"
+#include "carddav-flight.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -30,110 +32,164 @@
 #include <string.h>
 
 /**
- * Function for getting supported options from a server.
- * @param curl A pointer to an initialized CURL instance
- * @param settings struct containing the URL to the server. If authentication
- * is required prior to making the call the credentials must be available
- * via CURLOPT_USERPWD before calling.
- * @param result A pointer to a struct _response. If test is true
- * this variable can be NULL. Caller is responsible for freeing associated
- * memory.
- * @param error A pointer to carddav_error. @see carddav_error
- * @param test if this is true response will be whether the server
- * represented by the URL is a CardDAV collection or not.
- * @return FALSE in case of error, TRUE otherwise.
+ * Test whether a compliance class is listed in a DAV header value.
+ * @param value The DAV header value. A comma separated list
+ * @param class The compliance class to look for, case insensitive
+ * @return TRUE if class is listed, FALSE otherwise
  */
-gboolean carddav_getoptions(CURL* curl, carddav_settings* settings, response* result,
-		carddav_error* error, gboolean test) {
+static gboolean has_dav_class(const gchar* value, const gchar* class) {
+	gsize len = strlen(class);
+
+	while (*value) {
+		const gchar* end;
+
+		while (*value == ',' || *value == ' ' || *value == '\t')
+			value++;
+		end = value;
+		while (*end && *end != ',')
+			end++;
+		while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+			end--;
+		if ((gsize) (end - value) == len &&
+				g_ascii_strncasecmp(value, class, len) == 0)
+			return TRUE;
+		while (*end && *end != ',')
+			end++;
+		value = end;
+	}
+	return FALSE;
+}
+
+/* What probe_server() needs besides its result */
+struct probe {
+	CURL* curl;
+	carddav_settings* settings;
+};
+
+/**
+ * Send OPTIONS and check for the addressbook compliance class. Runs for
+ * flight_run(), so identical probes at the same time share the request.
+ * @param data A struct probe
+ * @param allow Set to the Allow header of a CardDAV resource
+ * @param error Receives the reason of a failure
+ * @return TRUE if the URL is not a CardDAV resource, FALSE otherwise
+ */
+static gboolean probe_server(gpointer data, gchar** allow,
+		carddav_error* error) {
+	CURL* curl = ((struct probe *) data)->curl;
+	carddav_settings* settings = ((struct probe *) data)->settings;
 	CURLcode res = 0;
 	char error_buf[CURL_ERROR_SIZE];
 	struct MemoryStruct chunk;
 	struct MemoryStruct headers;
 	gboolean enabled = FALSE;
 
-	if (! curl)
-		return FALSE;
-
-	if (!error) {
-		error = (carddav_error *) malloc(sizeof(struct _carddav_error));
-		memset(error, '\0', sizeof(struct _carddav_error));
-	}
-	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
-	chunk.size = 0;    /* no data at this point */
-	headers.memory = NULL;
-	headers.size = 0;
+	init_memory_struct(&chunk);
+	init_memory_struct(&headers);
 
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	set_memory_callbacks(curl, settings, &chunk, &headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "OPTIONS");
+	set_request_method(curl, settings, CARDDAV_METHOD_OPTIONS);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
 	if (settings->debug) {
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	}
-	res = curl_easy_perform(curl);
+	res = perform_curl(curl, settings, &chunk, &headers);
 	if (res == 0) {
-		gchar* head;
-		head = get_response_header("DAV", headers.memory, TRUE);
-		if (head && strstr(head, "addressbook") != NULL) {
+		const gchar* head;
+		head = get_response_header(&headers, "DAV");
+		if (head && has_dav_class(head, "addressbook")) {
 			enabled = TRUE;
-			if (! test) {
-				result->msg = g_strdup(
-						get_response_header("Allow", headers.memory, FALSE));
-			}
+			*allow = g_strdup(get_response_header(&headers, "Allow"));
 		}
 		else {
 			long code;
 			res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 			if (code == 200) {
-				error->code = -1;
-				error->str = g_strdup("URL is not a CardDAV resource");
+				set_carddav_error(error, CARDDAV_PHASE_PROBE, -1, code,
+						CURLE_OK, "URL is not a CardDAV resource");
 			}
 			else {
-				error->code = -1 * code;
-				error->str = g_strdup(headers.memory);
+				/* negated to tell it apart from a failed request */
+				set_carddav_error(error, CARDDAV_PHASE_PROBE, -1 * code, code,
+						CURLE_OK, headers.memory);
 			}
 		}
-		g_free(head);
 	}
 	else if (
 		(res == CURLE_SSL_CONNECT_ERROR ||
-		 CURLE_PEER_FAILED_VERIFICATION ||
-		 CURLE_SSL_ENGINE_NOTFOUND ||
-		 CURLE_SSL_ENGINE_SETFAILED ||
-		 CURLE_SSL_CERTPROBLEM ||
-		 CURLE_SSL_CIPHER ||
-		 CURLE_SSL_CACERT ||
-		 CURLE_SSL_CACERT_BADFILE ||
-		 CURLE_SSL_CRL_BADFILE ||
-		 CURLE_SSL_ISSUER_ERROR) && settings->usehttps) {
-		error->code = -2;
-		error->str = g_strdup(error_buf);
+		 res == CURLE_PEER_FAILED_VERIFICATION ||
+		 res == CURLE_SSL_ENGINE_NOTFOUND ||
+		 res == CURLE_SSL_ENGINE_SETFAILED ||
+		 res == CURLE_SSL_CERTPROBLEM ||
+		 res == CURLE_SSL_CIPHER ||
+		 res == CURLE_SSL_CACERT ||
+		 res == CURLE_SSL_CACERT_BADFILE ||
+		 res == CURLE_SSL_CRL_BADFILE ||
+		 res == CURLE_SSL_ISSUER_ERROR) && settings->usehttps) {
+		set_carddav_error(error, CARDDAV_PHASE_PROBE, -2, 0, res, error_buf);
 	}
 	else if (res == CURLE_COULDNT_RESOLVE_HOST) {
-		error->code = -3;
-		error->str = g_strdup("Could not resolve host");
+		set_carddav_error(error, CARDDAV_PHASE_PROBE, -3, 0, res,
+				"Could not resolve host");
 	}
 	else if (res == CURLE_COULDNT_CONNECT) {
-		error->code = -4;
-		error->str = g_strdup("Unable to connect");
+		set_carddav_error(error, CARDDAV_PHASE_PROBE, -4, 0, res,
+				"Unable to connect");
 	}
 	else {
-		error->code = -1;
-		error->str = g_strdup("URL is not a CardDAV resource");
+		set_carddav_error(error, CARDDAV_PHASE_PROBE, -1, 0, res,
+				"URL is not a CardDAV resource");
 	}
-	if (chunk.memory)
-		free(chunk.memory);
-	if (headers.memory)
-		free(headers.memory);
+	free_memory_struct(&chunk);
+	free_memory_struct(&headers);
 	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "GET");
-	return enabled;
+	return !enabled;
+}
+
+/**
+ * Function for getting supported options from a server.
+ * @param curl A pointer to an initialized CURL instance
+ * @param settings struct containing the URL to the server. If authentication
+ * is required prior to making the call the credentials must be available
+ * via CURLOPT_USERPWD before calling.
+ * @param result A pointer to a struct _response. If test is true
+ * this variable can be NULL. Caller is responsible for freeing associated
+ * memory.
+ * @param error A pointer to carddav_error. @see carddav_error. May be
+ * NULL if the reason of a failure is not wanted.
+ * @param test if this is true response will be whether the server
+ * represented by the URL is a CardDAV collection or not.
+ * @return FALSE in case of error, TRUE otherwise.
+ */
+gboolean carddav_getoptions(CURL* curl, carddav_settings* settings, response* result,
+		carddav_error* error, gboolean test) {
+	struct probe probe;
+	carddav_error ignored = {0};
+	gchar* allow = NULL;
+	shared_text* owner;
+	gchar* key;
+	gboolean failed;
+
+	if (! curl)
+		return FALSE;
+
+	/* callers not interested in the reason pass NULL */
+	if (!error)
+		error = &ignored;
+	probe.curl = curl;
+	probe.settings = settings;
+	key = flight_key(settings, "options");
+	failed = flight_run(key, settings, probe_server, &probe, &allow, &owner,
+			error);
+	g_free(key);
+	if (!failed && !test) {
+		result->msg = allow;
+		result->shared = owner;
+	} else {
+		release_text(allow, owner);
+	}
+	return !failed;
 }
@@ -33,7 +33,8 @@
  * @param result A pointer to a struct _response. If test is true
  * this variable can be NULL. Caller is responsible for freeing associated
  * memory.
- * @param error A pointer to carddav_error. @see carddav_error
+ * @param error A pointer to carddav_error. @see carddav_error. May be
+ * NULL if the reason of a failure is not wanted.
  * @param test if this is true response will be whether the server
  * represented by the URL is a CardDAV collection or not.
  * @return FALSE in case of error, TRUE otherwise.
@@ -0,0 +1,109 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Check the response header index built by WriteHeaderCallback(). Lines
+ * are fed one per call as libcurl does, and the index is read back with
+ * get_response_header().
+ */
+
+#include "carddav-utils.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+struct header_case {
+	const gchar* what;
+	const gchar* lines[8];
+	const gchar* expect[8][2];	/* name and value, NULL value for absent */
+};
+
+static const struct header_case cases[] = {
+	{ "single header, any case",
+		{ "HTTP/1.1 200 OK\r\n", "ETag: \"abc\"\r\n", "\r\n" },
+		{ { "ETag", "\"abc\"" }, { "etag", "\"abc\"" }, { "ETAG", "\"abc\"" },
+		  { "Location", NULL } } },
+	{ "folded lines are joined",
+		{ "HTTP/1.1 200 OK\r\n", "X-Long: first\r\n", "  second \r\n",
+		  "\tthird\r\n", "Next: value\r\n" },
+		{ { "X-Long", "first second third" }, { "Next", "value" } } },
+	{ "repeated headers are merged",
+		{ "HTTP/1.1 200 OK\r\n", "DAV: 1, 2\r\n", "dav: addressbook\r\n",
+		  "  access-control\r\n" },
+		{ { "DAV", "1, 2, addressbook access-control" } } },
+	{ "a new status line starts over",
+		{ "HTTP/1.1 401 Unauthorized\r\n", "WWW-Authenticate: Basic\r\n",
+		  "ETag: old\r\n", "\r\n", "HTTP/1.1 200 OK\r\n", "ETag: new\r\n" },
+		{ { "WWW-Authenticate", NULL }, { "ETag", "new" } } },
+	{ "white space is trimmed",
+		{ "HTTP/1.1 200 OK\r\n", "Name \t:  value  \r\n", "Empty:\r\n",
+		  "Bare: x\n" },
+		{ { "Name", "value" }, { "Empty", "" }, { "Bare", "x" } } },
+	{ "malformed lines are skipped",
+		{ "HTTP/1.1 200 OK\r\n", " orphan continuation\r\n",
+		  "no colon here\r\n", ": no name\r\n", "Kept: yes\r\n" },
+		{ { "Kept", "yes" }, { "no colon here", NULL }, { "", NULL } } },
+	{ "no headers at all",
+		{ "HTTP/1.1 204 No Content\r\n", "\r\n" },
+		{ { "ETag", NULL } } },
+};
+
+static int run_case(const struct header_case* test) {
+	struct MemoryStruct headers;
+	int failures = 0;
+	guint i;
+
+	init_memory_struct(&headers);
+	for (i = 0; i < G_N_ELEMENTS(test->lines) && test->lines[i]; i++) {
+		size_t len = strlen(test->lines[i]);
+
+		if (WriteHeaderCallback((void *) test->lines[i], 1, len,
+					&headers) != len) {
+			fprintf(stderr, "%s: line %u not taken\n", test->what, i);
+			failures++;
+		}
+	}
+	for (i = 0; i < G_N_ELEMENTS(test->expect) && test->expect[i][0]; i++) {
+		const gchar* value = get_response_header(&headers,
+				test->expect[i][0]);
+		const gchar* expected = test->expect[i][1];
+
+		if ((value == NULL) != (expected == NULL) ||
+				(value && strcmp(value, expected) != 0)) {
+			fprintf(stderr, "%s: %s is \"%s\", expected \"%s\"\n",
+					test->what, test->expect[i][0],
+					value ? value : "(none)",
+					expected ? expected : "(none)");
+			failures++;
+		}
+	}
+	free_memory_struct(&headers);
+	return failures;
+}
+
+int main(int argc, char** argv) {
+	int failures = 0;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(cases); i++)
+		failures += run_case(&cases[i]);
+	printf("%u cases, %d failed\n", (guint) G_N_ELEMENTS(cases), failures);
+	return (failures == 0) ? 0 : 1;
+}
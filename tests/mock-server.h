@@ -0,0 +1,68 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __MOCK_SERVER_H__
+#define __MOCK_SERVER_H__
+
+#include <glib.h>
+
+/**
+ * @typedef struct _mock_server mock_server
+ * A minimal CardDAV server on the loopback interface, just enough for
+ * the library's own requests. Every connection is served by a thread of
+ * its own and the cards are kept in memory.
+ */
+typedef struct _mock_server mock_server;
+
+/**
+ * Start a server on a free port.
+ * @return The server or NULL if no socket could be opened
+ */
+mock_server* mock_server_start(void);
+
+/**
+ * URL of the address book of a server, with credentials.
+ * @param server @see mock_server
+ * @return The URL, owned by the server
+ */
+const gchar* mock_server_url(mock_server* server);
+
+/**
+ * Number of requests served so far.
+ * @param server @see mock_server
+ * @return number of requests
+ */
+guint mock_server_requests(mock_server* server);
+
+/**
+ * Number of cards stored.
+ * @param server @see mock_server
+ * @return number of cards
+ */
+guint mock_server_cards(mock_server* server);
+
+/**
+ * Stop accepting connections and free a server. Connections still open
+ * are served until the client closes them.
+ * @param server @see mock_server
+ */
+void mock_server_stop(mock_server* server);
+
+#endif
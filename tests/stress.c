@@ -0,0 +1,158 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Run every operation of the library from many threads at once against
+ * a mock server. Each thread works on cards of its own, so every call
+ * is expected to succeed, and the collection is empty at the end.
+ */
+
+#include "carddav.h"
+#include "mock-server.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STRESS_THREADS 32
+#define STRESS_ROUNDS 4
+
+static const gchar* url;
+static gint failures;
+static gint calls;
+
+static void check(gboolean ok, int thread, const gchar* what,
+		runtime_info* info) {
+	g_atomic_int_inc(&calls);
+	if (ok)
+		return;
+	g_atomic_int_inc(&failures);
+	fprintf(stderr, "thread %d: %s failed: %ld %s\n", thread, what,
+			info->error->code,
+			(info->error->str) ? info->error->str : "");
+}
+
+static int count_card(const char* href, const char* etag,
+		const char* data, size_t len, void* count) {
+	(*(int *) count)++;
+	return 0;
+}
+
+static gpointer worker(gpointer data) {
+	int id = GPOINTER_TO_INT(data);
+	runtime_info* info = carddav_get_runtime_info();
+	gchar* snapshot = g_strdup_printf("%s/libcarddav-stress-%d-%d.snap",
+			g_get_tmp_dir(), (int) getpid(), id);
+	int round;
+
+	/* half of the threads take the LOCK/UNLOCK path */
+	info->options->use_locking = id % 2;
+	for (round = 0; round < STRESS_ROUNDS; round++) {
+		gchar* card = g_strdup_printf("BEGIN:VCARD\r\nVERSION:3.0\r\n"
+				"UID:stress-%d-%d\r\nFN:Stress %d\r\nEND:VCARD\r\n",
+				id, round, round);
+		gchar* changed = g_strdup_printf("BEGIN:VCARD\r\nVERSION:3.0\r\n"
+				"UID:stress-%d-%d\r\nFN:Changed & <escaped>\r\nEND:VCARD\r\n",
+				id, round);
+		response* result;
+		carddav_buffer buffer = { NULL, 0, 0 };
+		carddav_batch* batch;
+		CARDDAV_RESPONSE status = CONFLICT;
+		char** options;
+		int cards = 0;
+
+		check(carddav_add_object(card, url, info) == OK, id, "add", info);
+		check(carddav_modify_object(changed, url, info) == OK, id,
+				"modify", info);
+
+		result = carddav_get_response();
+		check(carddav_getall_object(result, url, info) == OK &&
+				result->msg && strstr(result->msg, "stress-") != NULL,
+				id, "getall", info);
+		carddav_free_response(&result);
+
+		result = carddav_get_response();
+		check(carddav_getall_object_by_uri(result, url, info) == OK, id,
+				"getall by URI", info);
+		carddav_free_response(&result);
+
+		check(carddav_getall_foreach(url, count_card, &cards, info) == OK &&
+				cards > 0, id, "getall foreach", info);
+		check(carddav_getall_write(url, carddav_write_buffer, &buffer,
+					info) == OK && buffer.len > 0, id, "getall write", info);
+		free(buffer.data);
+		check(carddav_getall_snapshot(url, snapshot, info) == OK, id,
+				"getall snapshot", info);
+
+		result = carddav_get_response();
+		check(carddav_get_displayname(result, url, info) == OK &&
+				result->msg && strcmp(result->msg, "Mock Book") == 0,
+				id, "displayname", info);
+		carddav_free_response(&result);
+
+		check(carddav_enabled_resource(url, info), id, "enabled", info);
+		options = carddav_get_server_options(url, info);
+		check(options != NULL, id, "server options", info);
+		g_strfreev(options);
+
+		/* the asynchronous core, from every thread at once */
+		result = carddav_get_response();
+		batch = carddav_batch_new();
+		check(carddav_batch_getall_object(batch, result, url, info) == 0 &&
+				carddav_batch_wait_all(batch, -1) == 0 &&
+				carddav_batch_result(batch, 0, &status) && status == OK,
+				id, "batch getall", info);
+		carddav_batch_free(&batch);
+		carddav_free_response(&result);
+
+		check(carddav_delete_object(changed, url, info) == OK, id,
+				"delete", info);
+		g_free(changed);
+		g_free(card);
+	}
+	unlink(snapshot);
+	g_free(snapshot);
+	carddav_free_runtime_info(&info);
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	GThread* threads[STRESS_THREADS];
+	mock_server* server = mock_server_start();
+	guint left;
+	int i;
+
+	if (!server) {
+		fprintf(stderr, "could not start the mock server\n");
+		return 77;
+	}
+	url = mock_server_url(server);
+	for (i = 0; i < STRESS_THREADS; i++)
+		threads[i] = g_thread_new("stress", worker, GINT_TO_POINTER(i));
+	for (i = 0; i < STRESS_THREADS; i++)
+		g_thread_join(threads[i]);
+	left = mock_server_cards(server);
+	printf("%d threads: %d calls, %d failed, %u requests, %u cards left\n",
+			STRESS_THREADS, g_atomic_int_get(&calls),
+			g_atomic_int_get(&failures), mock_server_requests(server), left);
+	mock_server_stop(server);
+	return (failures == 0 && left == 0) ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2010 Timothy Pearson (kb9vqf@pearsoncomputing.net)
+ * Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Check decode_xml_text() on the character data forms a multistatus
+ * response can carry: predefined entities, numeric references, CDATA
+ * sections and references that are cut short or unknown.
+ */
+
+#include "carddav-utils.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+struct decode_case {
+	const gchar* input;
+	gsize len;	/* 0 means strlen(input) */
+	const gchar* expected;
+};
+
+static const struct decode_case cases[] = {
+	{ "plain text", 0, "plain text" },
+	{ "", 0, "" },
+	{ "&lt;a&gt; &amp; &quot;b&quot; &apos;c&apos;", 0, "<a> & \"b\" 'c'" },
+	{ "&amp;lt;", 0, "&lt;" },
+	{ "&#65;&#x42;&#X43;", 0, "ABC" },
+	{ "caf&#233; &#x263A;", 0, "caf\xc3\xa9 \xe2\x98\xba" },
+	{ "&#x1F600;", 0, "\xf0\x9f\x98\x80" },
+	{ "&#0; &#x110000; &#12a;", 0, "&#0; &#x110000; &#12a;" },
+	{ "&nbsp; &unknown;", 0, "&nbsp; &unknown;" },
+	{ "x<![CDATA[<b>&amp;</b>]]>y", 0, "x<b>&amp;</b>y" },
+	{ "<![CDATA[]]>", 0, "" },
+	{ "<![CDATA[open", 0, "open" },
+	{ "<![CDATA[", 0, "<![CDATA[" },
+	{ "tail &amp", 0, "tail &amp" },
+	{ "tail &", 0, "tail &" },
+	{ "&#x41", 0, "&#x41" },
+	{ "&verylongname;", 0, "&verylongname;" },
+	/* the terminating ';' lies beyond len and must not be seen */
+	{ "&amp;", 4, "&amp" },
+	{ "<![CDATA[ab]]>", 12, "ab]" },
+};
+
+int main(int argc, char** argv) {
+	int failures = 0;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(cases); i++) {
+		gsize len = cases[i].len ? cases[i].len : strlen(cases[i].input);
+		gchar* text = g_strdup(cases[i].input);
+		gsize decoded = decode_xml_text(text, len);
+
+		if (decoded > len || decoded != strlen(cases[i].expected) ||
+				memcmp(text, cases[i].expected, decoded) != 0) {
+			fprintf(stderr, "\"%s\": got \"%.*s\", expected \"%s\"\n",
+					cases[i].input, (int) MIN(decoded, len), text,
+					cases[i].expected);
+			failures++;
+		}
+		g_free(text);
+	}
+	printf("%u cases, %d failed\n", (guint) G_N_ELEMENTS(cases), failures);
+	return (failures == 0) ? 0 : 1;
+}